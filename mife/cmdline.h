@@ -4,6 +4,7 @@
 #include "mbp_types.h"
 #include "mife.h"
 #include "mbp_glue.h"
+#include "substream.h"
 #include "util.h"
 
 bool mbp_template_to_mife_pp(mife_pp_t pp, const mbp_template *const template, mbp_template_stats *const stats);
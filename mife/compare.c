@@ -0,0 +1,334 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gghlite/misc.h>
+
+#include "compare.h"
+#include "util.h"
+
+typedef struct compare_memo_entry {
+  /* "a\tb"; tabs can't appear in uids */
+  char *key;
+  /* negative, zero or positive as a sorts before, equal to, or after b;
+   * without an equal label, zero never happens and positive means only
+   * "not before" */
+  int order;
+  struct compare_memo_entry *next;
+} compare_memo_entry;
+
+struct comparator {
+  const mmap_vtable *mmap;
+  const evaluator *ev;
+  char *positions[2];
+  const char *less, *equal;
+  compare_memo_entry **buckets;
+  size_t num_buckets, num_entries;
+  pthread_mutex_t lock;
+  unsigned long evaluations, memo_hits;
+  uint64_t start;
+};
+
+#define COMPARE_MEMO_INITIAL_BUCKETS 1024
+/* merges of at most this many records are done without spawning tasks */
+#define COMPARE_MERGE_GRAIN 8
+
+static size_t compare_hash(const char *key) {
+  uint64_t h = 14695981039346656037ull;
+  for(; *key; key++) {
+    h ^= (unsigned char)*key;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+static char *compare_key(const char *a, const char *b) {
+  const size_t a_len = strlen(a), b_len = strlen(b);
+  char *key;
+  if(ALLOC_FAILS(key, a_len + b_len + 2)) return NULL;
+  memcpy(key, a, a_len);
+  key[a_len] = '\t';
+  memcpy(key + a_len + 1, b, b_len + 1);
+  return key;
+}
+
+static bool compare_has_output(const evaluator *ev, const char *label) {
+  const string_matrix outputs = evaluator_template(ev)->outputs;
+  for(unsigned int i = 0; i < outputs.num_rows; i++)
+    for(unsigned int j = 0; j < outputs.num_cols; j++)
+      if(!strcmp(outputs.elems[i][j], label))
+        return true;
+  fprintf(stderr, "the template has no output labelled '%s'\n", label);
+  return false;
+}
+
+comparator *comparator_new(const_mmap_vtable mmap, const evaluator *ev,
+    const char *left, const char *right, const char *less) {
+  const mbp_template_stats *const stats = evaluator_stats(ev);
+
+  if(2 != stats->positions_len) {
+    fprintf(stderr, "comparisons need a template with exactly 2 positions, not %u\n", stats->positions_len);
+    return NULL;
+  }
+  if(NULL == left)  left  = stats->positions[0];
+  if(NULL == right) right = stats->positions[strcmp(left, stats->positions[0]) ? 0 : 1];
+  for(unsigned int i = 0; i < 2; i++) {
+    const char *position = 0 == i ? left : right;
+    if(strcmp(position, stats->positions[0]) && strcmp(position, stats->positions[1])) {
+      fprintf(stderr, "the template has no position %s\n", position);
+      return NULL;
+    }
+  }
+  if(!strcmp(left, right)) {
+    fprintf(stderr, "the left and right positions must differ\n");
+    return NULL;
+  }
+  if(!compare_has_output(ev, less))
+    return NULL;
+
+  comparator *c = calloc(1, sizeof(*c));
+  if(NULL == c) return NULL;
+  if(NULL == (c->buckets = calloc(COMPARE_MEMO_INITIAL_BUCKETS, sizeof(*c->buckets)))) {
+    free(c);
+    return NULL;
+  }
+  c->mmap = mmap;
+  c->ev = ev;
+  /* ciphertext_mapping wants mutable strings, but never modifies them */
+  c->positions[0] = (char *)left;
+  c->positions[1] = (char *)right;
+  c->less = less;
+  c->num_buckets = COMPARE_MEMO_INITIAL_BUCKETS;
+  c->start = ggh_walltime(0);
+  pthread_mutex_init(&c->lock, NULL);
+  return c;
+}
+
+bool comparator_set_equal(comparator *c, const char *equal) {
+  if(!compare_has_output(c->ev, equal))
+    return false;
+  c->equal = equal;
+  return true;
+}
+
+/* call with the lock held */
+static compare_memo_entry *compare_memo_find(const comparator *c, const char *key) {
+  compare_memo_entry *e = c->buckets[compare_hash(key) & (c->num_buckets-1)];
+  while(NULL != e && strcmp(e->key, key)) e = e->next;
+  return e;
+}
+
+/* call with the lock held; takes ownership of key; failing to remember an
+ * answer only costs a repeat evaluation later, so that isn't an error */
+static void compare_memo_insert(comparator *c, char *key, int order) {
+  compare_memo_entry *e;
+  if(NULL != compare_memo_find(c, key) || NULL == (e = malloc(sizeof(*e)))) {
+    free(key);
+    return;
+  }
+
+  if(c->num_entries >= c->num_buckets) {
+    const size_t num_buckets = 2*c->num_buckets;
+    compare_memo_entry **buckets = calloc(num_buckets, sizeof(*buckets));
+    if(NULL != buckets) {
+      for(size_t b = 0; b < c->num_buckets; b++) {
+        compare_memo_entry *f = c->buckets[b], *next;
+        for(; NULL != f; f = next) {
+          next = f->next;
+          const size_t nb = compare_hash(f->key) & (num_buckets-1);
+          f->next = buckets[nb];
+          buckets[nb] = f;
+        }
+      }
+      free(c->buckets);
+      c->buckets = buckets;
+      c->num_buckets = num_buckets;
+    }
+  }
+
+  const size_t b = compare_hash(key) & (c->num_buckets-1);
+  e->key = key;
+  e->order = order;
+  e->next = c->buckets[b];
+  c->buckets[b] = e;
+  c->num_entries++;
+}
+
+/* looks up a against b, or failing that b against a, which answers it if b
+ * sorts first or if equality can be told apart */
+static bool compare_memo_lookup(comparator *c, const char *key, const char *reverse_key, int *order) {
+  compare_memo_entry *e;
+  bool found = false;
+  pthread_mutex_lock(&c->lock);
+  if(NULL != (e = compare_memo_find(c, key))) {
+    *order = e->order;
+    found = true;
+  } else if(NULL != (e = compare_memo_find(c, reverse_key)) && (e->order < 0 || NULL != c->equal)) {
+    *order = -e->order;
+    found = true;
+  }
+  if(found) c->memo_hits++;
+  pthread_mutex_unlock(&c->lock);
+  return found;
+}
+
+bool comparator_compare(comparator *c, const char *a, const char *b, int *order) {
+  const string_matrix outputs = evaluator_template(c->ev)->outputs;
+  char *key = compare_key(a, b), *reverse_key = compare_key(b, a);
+  bool success = false;
+
+  if(NULL == key || NULL == reverse_key) goto free_keys;
+  if(compare_memo_lookup(c, key, reverse_key, order)) {
+    success = true;
+    goto free_keys;
+  }
+
+  char *uids[2] = { (char *)a, (char *)b };
+  const ciphertext_mapping mapping = { 2, c->positions, uids };
+  f2_matrix result = evaluator_evaluate(c->mmap, c->ev, mapping);
+  if(NULL == result.elems) goto free_keys;
+
+  *order = 1;
+  for(unsigned int i = 0; i < result.num_rows && i < outputs.num_rows; i++)
+    for(unsigned int j = 0; j < result.num_cols && j < outputs.num_cols; j++) {
+      if(!result.elems[i][j]) continue;
+      if(!strcmp(outputs.elems[i][j], c->less))
+        *order = -1;
+      else if(NULL != c->equal && 1 == *order && !strcmp(outputs.elems[i][j], c->equal))
+        *order = 0;
+    }
+  f2_matrix_free(result);
+  success = true;
+
+  pthread_mutex_lock(&c->lock);
+  c->evaluations++;
+  compare_memo_insert(c, key, *order);
+  key = NULL;
+  pthread_mutex_unlock(&c->lock);
+
+free_keys:
+  free(key);
+  free(reverse_key);
+  return success;
+}
+
+bool comparator_less(comparator *c, const char *a, const char *b, bool *less) {
+  int order;
+  if(!comparator_compare(c, a, b, &order)) return false;
+  *less = order < 0;
+  return true;
+}
+
+typedef struct {
+  comparator *c;
+  char *const *uids;
+  /* set if any comparison could not be evaluated */
+  bool failed;
+} compare_sort_state;
+
+/* a failed comparison says "not less", which keeps the sort well-defined; the
+ * failure is reported at the end */
+static bool compare_sort_less(compare_sort_state *const s, const unsigned int a, const unsigned int b) {
+  bool less;
+  if(comparator_less(s->c, s->uids[a], s->uids[b], &less)) return less;
+#pragma omp atomic write
+  s->failed = true;
+  return false;
+}
+
+/* Stably merges the sorted runs a and b into out. The larger run is split at
+ * its middle record, whose place in the other run is found by binary search;
+ * the two halves on either side are then merged concurrently. */
+static void compare_sort_merge(compare_sort_state *const s, const unsigned int *a, const size_t na, const unsigned int *b, const size_t nb, unsigned int *out) {
+  size_t lo = 0, hi, m;
+
+  if(na + nb <= COMPARE_MERGE_GRAIN) {
+    size_t i = 0, j = 0;
+    while(i < na && j < nb)
+      *out++ = compare_sort_less(s, b[j], a[i]) ? b[j++] : a[i++];
+    while(i < na) *out++ = a[i++];
+    while(j < nb) *out++ = b[j++];
+    return;
+  }
+
+  if(na >= nb) {
+    /* records of b that sort strictly before a[m] go before it */
+    m = na/2;
+    for(hi = nb; lo < hi; ) {
+      const size_t mid = lo + (hi-lo)/2;
+      if(compare_sort_less(s, b[mid], a[m])) lo = mid+1;
+      else hi = mid;
+    }
+    out[m+lo] = a[m];
+#pragma omp task
+    compare_sort_merge(s, a, m, b, lo, out);
+    compare_sort_merge(s, a+m+1, na-m-1, b+lo, nb-lo, out+m+lo+1);
+  } else {
+    /* records of a that b[m] does not sort strictly before go before it */
+    m = nb/2;
+    for(hi = na; lo < hi; ) {
+      const size_t mid = lo + (hi-lo)/2;
+      if(!compare_sort_less(s, b[m], a[mid])) lo = mid+1;
+      else hi = mid;
+    }
+    out[lo+m] = b[m];
+#pragma omp task
+    compare_sort_merge(s, a, lo, b, m, out);
+    compare_sort_merge(s, a+lo, na-lo, b+m+1, nb-m-1, out+lo+m+1);
+  }
+#pragma omp taskwait
+}
+
+static void compare_sort_range(compare_sort_state *const s, unsigned int *const order, unsigned int *const scratch, const size_t n) {
+  if(n < 2) return;
+  const size_t h = n/2;
+#pragma omp task
+  compare_sort_range(s, order, scratch, h);
+  compare_sort_range(s, order+h, scratch+h, n-h);
+#pragma omp taskwait
+  compare_sort_merge(s, order, h, order+h, n-h, scratch);
+  memcpy(order, scratch, n*sizeof(*order));
+}
+
+bool comparator_sort(comparator *c, char *const *uids, unsigned int *order, size_t n) {
+  compare_sort_state s = { c, uids, false };
+  unsigned int *scratch;
+  if(ALLOC_FAILS(scratch, n+1)) {
+    fprintf(stderr, "out of memory while sorting\n");
+    return false;
+  }
+
+#pragma omp parallel if(g_parallel)
+#pragma omp single
+  compare_sort_range(&s, order, scratch, n);
+
+  free(scratch);
+  return !s.failed;
+}
+
+void comparator_describe(const comparator *c, const char **left, const char **right, const char **less) {
+  *left  = c->positions[0];
+  *right = c->positions[1];
+  *less  = c->less;
+}
+
+void comparator_print_stats(const comparator *c, FILE *fp) {
+  const double seconds = ggh_seconds(ggh_walltime(c->start));
+  fprintf(fp, "comparisons: %lu evaluated, %lu from memo, in %.2fs (%.2f evaluations/s)\n",
+    c->evaluations, c->memo_hits, seconds, seconds > 0 ? c->evaluations / seconds : 0.0);
+}
+
+void comparator_free(comparator *c) {
+  for(size_t b = 0; b < c->num_buckets; b++) {
+    compare_memo_entry *e = c->buckets[b], *next;
+    for(; NULL != e; e = next) {
+      next = e->next;
+      free(e->key);
+      free(e);
+    }
+  }
+  free(c->buckets);
+  pthread_mutex_destroy(&c->lock);
+  free(c);
+}
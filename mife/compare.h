@@ -0,0 +1,43 @@
+#ifndef _MIFE_COMPARE_H
+#define _MIFE_COMPARE_H
+
+#include <stdio.h>
+
+#include "evaluator.h"
+
+/* Order comparisons between encrypted records, for templates with exactly two
+ * positions: one record goes in the left position, the other in the right,
+ * and the left one sorts first iff the evaluation's non-zero output carries
+ * the "less" label. Answers are memoized, and a comparator can be shared by
+ * any number of threads. */
+
+typedef struct comparator comparator;
+
+/* left and right may be NULL to mean the template's first and second
+ * positions; returns NULL (after saying why on stderr) if the template can't
+ * be used this way, or if out of memory */
+comparator *comparator_new(const_mmap_vtable mmap, const evaluator *ev,
+    const char *left, const char *right, const char *less);
+/* sets *less to whether the record with uid a sorts before the one with uid
+ * b; returns false if that could not be evaluated */
+bool comparator_less(comparator *c, const char *a, const char *b, bool *less);
+/* lets comparisons tell equal records apart, by the given output label;
+ * call before comparing anything. Returns false (after saying why on
+ * stderr) if the template has no such output. */
+bool comparator_set_equal(comparator *c, const char *equal);
+/* sets *order to a negative number, zero, or a positive number as the record
+ * with uid a sorts before, equal to, or after the one with uid b; without an
+ * equal label, zero never comes up and positive just means "not before".
+ * Returns false if that could not be evaluated. */
+bool comparator_compare(comparator *c, const char *a, const char *b, int *order);
+/* stably sorts order, a permutation of indices into uids, using every core;
+ * returns false if some comparison failed, in which case order is some
+ * arbitrary permutation */
+bool comparator_sort(comparator *c, char *const *uids, unsigned int *order, size_t n);
+/* the positions and output label the comparisons use */
+void comparator_describe(const comparator *c, const char **left, const char **right, const char **less);
+/* evaluations done, answers taken from the memo, and their rate so far */
+void comparator_print_stats(const comparator *c, FILE *fp);
+void comparator_free(comparator *c);
+
+#endif /* ifndef _MIFE_COMPARE_H */
@@ -0,0 +1,205 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "enc_cache.h"
+#include "util.h"
+
+typedef struct enc_cache_entry {
+  char *key;
+  mmap_enc_mat_t m;
+  size_t bytes;
+  unsigned int refs;
+  /* loading: some thread is filling in m right now; failed: it couldn't */
+  bool loading, failed;
+  struct enc_cache_entry *hash_next, *lru_prev, *lru_next;
+} enc_cache_entry;
+
+struct enc_cache {
+  const mmap_vtable *mmap;
+  size_t budget, used;
+  enc_cache_entry **buckets;
+  size_t num_buckets, num_entries;
+  /* only entries nobody holds are on this list; head is most recently used */
+  enc_cache_entry *lru_head, *lru_tail;
+  pthread_mutex_t lock;
+  pthread_cond_t loaded;
+  unsigned long hits, misses, evictions;
+};
+
+#define ENC_CACHE_INITIAL_BUCKETS 1024
+
+static size_t enc_cache_hash(const char *key) {
+  uint64_t h = 14695981039346656037ull;
+  for(; *key; key++) {
+    h ^= (unsigned char)*key;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+enc_cache *enc_cache_new(const_mmap_vtable mmap, size_t budget) {
+  enc_cache *c = calloc(1, sizeof(*c));
+  if(NULL == c) return NULL;
+  if(NULL == (c->buckets = calloc(ENC_CACHE_INITIAL_BUCKETS, sizeof(*c->buckets)))) {
+    free(c);
+    return NULL;
+  }
+  c->mmap = mmap;
+  c->budget = budget;
+  c->num_buckets = ENC_CACHE_INITIAL_BUCKETS;
+  pthread_mutex_init(&c->lock, NULL);
+  pthread_cond_init(&c->loaded, NULL);
+  return c;
+}
+
+static enc_cache_entry *enc_cache_find(const enc_cache *c, const char *key) {
+  enc_cache_entry *e = c->buckets[enc_cache_hash(key) & (c->num_buckets-1)];
+  while(NULL != e && strcmp(e->key, key)) e = e->hash_next;
+  return e;
+}
+
+/* doubles the table when it gets full; failing to grow just means longer
+ * chains, so that isn't an error */
+static void enc_cache_grow(enc_cache *c) {
+  const size_t num_buckets = 2*c->num_buckets;
+  enc_cache_entry **buckets = calloc(num_buckets, sizeof(*buckets));
+  if(NULL == buckets) return;
+  for(size_t b = 0; b < c->num_buckets; b++) {
+    enc_cache_entry *e = c->buckets[b], *next;
+    for(; NULL != e; e = next) {
+      next = e->hash_next;
+      const size_t nb = enc_cache_hash(e->key) & (num_buckets-1);
+      e->hash_next = buckets[nb];
+      buckets[nb] = e;
+    }
+  }
+  free(c->buckets);
+  c->buckets = buckets;
+  c->num_buckets = num_buckets;
+}
+
+static void enc_cache_insert(enc_cache *c, enc_cache_entry *e) {
+  if(c->num_entries >= c->num_buckets) enc_cache_grow(c);
+  const size_t b = enc_cache_hash(e->key) & (c->num_buckets-1);
+  e->hash_next = c->buckets[b];
+  c->buckets[b] = e;
+  c->num_entries++;
+}
+
+static void enc_cache_remove(enc_cache *c, enc_cache_entry *e) {
+  enc_cache_entry **p = c->buckets + (enc_cache_hash(e->key) & (c->num_buckets-1));
+  while(*p != e) p = &(*p)->hash_next;
+  *p = e->hash_next;
+  c->num_entries--;
+}
+
+static void enc_cache_lru_unlink(enc_cache *c, enc_cache_entry *e) {
+  if(NULL != e->lru_prev) e->lru_prev->lru_next = e->lru_next; else c->lru_head = e->lru_next;
+  if(NULL != e->lru_next) e->lru_next->lru_prev = e->lru_prev; else c->lru_tail = e->lru_prev;
+  e->lru_prev = e->lru_next = NULL;
+}
+
+static void enc_cache_lru_push(enc_cache *c, enc_cache_entry *e) {
+  e->lru_prev = NULL;
+  e->lru_next = c->lru_head;
+  if(NULL != c->lru_head) c->lru_head->lru_prev = e; else c->lru_tail = e;
+  c->lru_head = e;
+}
+
+static void enc_cache_entry_free(enc_cache *c, enc_cache_entry *e) {
+  if(!e->loading && !e->failed) mmap_enc_mat_clear(c->mmap, e->m);
+  free(e->key);
+  free(e);
+}
+
+/* call with the lock held */
+static void enc_cache_evict(enc_cache *c) {
+  while(c->used > c->budget && NULL != c->lru_tail) {
+    enc_cache_entry *e = c->lru_tail;
+    enc_cache_lru_unlink(c, e);
+    enc_cache_remove(c, e);
+    c->used -= e->bytes;
+    c->evictions++;
+    enc_cache_entry_free(c, e);
+  }
+}
+
+mmap_enc_mat_struct *enc_cache_acquire(enc_cache *c, const char *key, enc_cache_loader load, void *context) {
+  enc_cache_entry *e;
+  bool loaded;
+
+  pthread_mutex_lock(&c->lock);
+  if(NULL != (e = enc_cache_find(c, key))) {
+    if(0 == e->refs++) enc_cache_lru_unlink(c, e);
+    c->hits++;
+    while(e->loading) pthread_cond_wait(&c->loaded, &c->lock);
+    if(e->failed) {
+      if(0 == --e->refs) enc_cache_entry_free(c, e);
+      e = NULL;
+    }
+    pthread_mutex_unlock(&c->lock);
+    return NULL == e ? NULL : e->m;
+  }
+
+  c->misses++;
+  if(NULL == (e = calloc(1, sizeof(*e))) || NULL == (e->key = strdup(key))) {
+    pthread_mutex_unlock(&c->lock);
+    free(e);
+    return NULL;
+  }
+  e->refs = 1;
+  e->loading = true;
+  enc_cache_insert(c, e);
+  pthread_mutex_unlock(&c->lock);
+
+  /* other threads may hit this entry meanwhile, and will wait for it */
+  loaded = load(context, e->m, &e->bytes);
+
+  pthread_mutex_lock(&c->lock);
+  e->loading = false;
+  if(loaded) {
+    c->used += e->bytes;
+    enc_cache_evict(c);
+  } else {
+    e->failed = true;
+    enc_cache_remove(c, e);
+    if(0 == --e->refs) enc_cache_entry_free(c, e);
+    e = NULL;
+  }
+  pthread_cond_broadcast(&c->loaded);
+  pthread_mutex_unlock(&c->lock);
+  return NULL == e ? NULL : e->m;
+}
+
+void enc_cache_release(enc_cache *c, mmap_enc_mat_struct *m) {
+  enc_cache_entry *e = (enc_cache_entry *)((char *)m - offsetof(enc_cache_entry, m));
+  pthread_mutex_lock(&c->lock);
+  if(0 == --e->refs) {
+    enc_cache_lru_push(c, e);
+    enc_cache_evict(c);
+  }
+  pthread_mutex_unlock(&c->lock);
+}
+
+void enc_cache_print_stats(const enc_cache *c, FILE *fp) {
+  fprintf(fp, "cache: %lu hits, %lu misses, %lu evictions, %zu entries using about %zu bytes\n",
+    c->hits, c->misses, c->evictions, c->num_entries, c->used);
+}
+
+/* everything must have been released by now */
+void enc_cache_free(enc_cache *c) {
+  for(size_t b = 0; b < c->num_buckets; b++) {
+    enc_cache_entry *e = c->buckets[b], *next;
+    for(; NULL != e; e = next) {
+      next = e->hash_next;
+      enc_cache_entry_free(c, e);
+    }
+  }
+  free(c->buckets);
+  pthread_mutex_destroy(&c->lock);
+  pthread_cond_destroy(&c->loaded);
+  free(c);
+}
@@ -0,0 +1,29 @@
+#ifndef _MIFE_ENC_CACHE_H
+#define _MIFE_ENC_CACHE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <mmap/mmap.h>
+
+/* A thread-safe cache of deserialized encoded matrices, keyed by strings and
+ * bounded (approximately) by a byte budget. Matrices handed out by acquire
+ * are pinned until they are released; once nothing pins a matrix, it becomes
+ * a candidate for eviction in least-recently-used order. If every matrix is
+ * pinned, the budget is exceeded rather than failing. */
+
+typedef struct enc_cache enc_cache;
+
+/* fills in m, and an estimate of the memory it takes, for a cache miss;
+ * returns false if the matrix could not be loaded */
+typedef bool (*enc_cache_loader)(void *context, mmap_enc_mat_t m, size_t *bytes);
+
+enc_cache *enc_cache_new(const_mmap_vtable mmap, size_t budget);
+/* Returns the matrix for key, calling load to produce it if it isn't cached
+ * yet, or NULL if loading failed. Concurrent misses on one key load it only
+ * once. The caller must not modify the matrix. */
+mmap_enc_mat_struct *enc_cache_acquire(enc_cache *c, const char *key, enc_cache_loader load, void *context);
+void enc_cache_release(enc_cache *c, mmap_enc_mat_struct *m);
+void enc_cache_print_stats(const enc_cache *c, FILE *fp);
+void enc_cache_free(enc_cache *c);
+
+#endif /* ifndef _MIFE_ENC_CACHE_H */
@@ -0,0 +1,363 @@
+#include <getopt.h>
+#include <pthread.h>
+#include <string.h>
+
+#include <mife/mife.h>
+#include <mmap/mmap_gghlite.h>
+#include <mmap/mmap_clt.h>
+
+#include "encryptor.h"
+#include "parse.h"
+#include "queue.h"
+#include "server.h"
+#include "util.h"
+
+typedef struct {
+    encryptor enc;
+    const char *socket_path;
+    /* the most records to encode at once */
+    unsigned int group_size;
+    /* how many records may wait to be encoded before readers block */
+    unsigned int backlog;
+} encryptd_inputs;
+
+/* a record waiting to be encrypted */
+typedef struct {
+    server_conn *conn;
+    /* the record's line number on its connection, which tags the reply */
+    unsigned long id;
+    mbp_plaintext_record record;
+} encryptd_request;
+
+typedef struct {
+    const mmap_vtable *mmap;
+    encryptd_inputs *ins;
+    queue requests;
+    unsigned long encrypted, failed;
+} encryptd_server;
+
+void mife_encryptd_parse_cmdline(int argc, char **argv, encryptd_inputs *const ins, bool *use_clt);
+bool mife_encryptd_serve(encryptd_server *const server);
+
+int main(int argc, char **argv) {
+    encryptd_inputs ins;
+    encryptd_server server;
+    bool success;
+    bool use_clt = false;
+
+    mife_encryptd_parse_cmdline(argc, argv, &ins, &use_clt);
+
+    const mmap_vtable *mmap;
+    if (use_clt) {
+        mmap = &clt_vtable;
+    } else {
+        mmap = &gghlite_vtable;
+    }
+
+    server.mmap = mmap;
+    server.ins = &ins;
+    server.encrypted = server.failed = 0;
+    if(!queue_init(&server.requests, ins.backlog)) {
+        fprintf(stderr, "%s: out of memory while creating the request queue\n", *argv);
+        return -1;
+    }
+
+    success = mife_encryptd_serve(&server);
+    fprintf(stderr, "encrypted %lu records, %lu failed\n", server.encrypted, server.failed);
+
+    /* readers may still be parsing requests, but nothing touches the keys
+     * once the encoder has stopped */
+    encryptor_clear(mmap, &ins.enc);
+    return success ? 0 : -1;
+}
+
+static void mife_encryptd_usage(const int code) {
+    /* separate the diagnostic information from the usage information a little bit */
+    if(0 != code) printf("\n\n");
+    printf(
+        "USAGE: encryptd [OPTIONS] SOCKET\n"
+        "Loads the keys once, then encrypts records sent to the Unix domain socket\n"
+        "SOCKET until interrupted.\n"
+        "\n"
+        "Each request is one line in the same format encrypt --batch reads: either a\n"
+        "plaintext array, or an object with a \"plaintext\" array and optional \"uid\"\n"
+        "and \"partition\" fields. Clients may send any number of records without\n"
+        "waiting for replies. Records waiting from every connection are encoded\n"
+        "together, using every core, and each one is answered once it has been\n"
+        "written, with its line number on its connection, a tab, and then either\n"
+        "its uid or \"error\" and a description. When --queue records are already\n"
+        "waiting, the server stops reading from clients until there is room.\n"
+        "\n"
+        "Brackets indicate default values for each argument.\n"
+        "\n"
+        "Common options:\n"
+        "  -h, --help               Display this usage information\n"
+        "  -r, --private            A directory for private parameters [private]\n"
+        "  -u, --public             A directory for public parameters [public]\n"
+        "  -d, --db, --database     A directory to store encrypted values in [database]\n"
+        "  -C, --clt13              Use CLT13 as the underlying multilinear map\n"
+        "  -s, --sequential         Disable parallelism\n"
+        "\n"
+        "Server-specific options:\n"
+        "  -g, --group              Encode at most this many records at once [16]\n"
+        "  -q, --queue              How many records may wait to be encoded before\n"
+        "                           the server stops reading more [256]\n"
+        "  -P, --packed             Append each record to the packed store under\n"
+        "                           <database>/packed instead of writing one file\n"
+        "                           per step; eval detects this automatically\n"
+        "\n"
+        "Files used:\n"
+        "  SOCKET                    RW socket  created at startup, removed on exit\n"
+        "  <database>/<uid>/*/*.bin   W binary  the encrypted records\n"
+        "  <database>/packed/*/*     RW binary  the encrypted records (with -P only)\n"
+        "  <public>/template.json    R  JSON    a description of the function being\n"
+        "                                       encrypted\n"
+        "  <public>/mife.pub         R  custom  public parameters for evaluating\n"
+        "  <private>/mife.priv       R  custom  private parameters for encrypting\n"
+        "  <private>/kilian.pre      R  custom  precomputed matrices (optional)\n"
+        "  <private>/seed.bin        R  binary  %d-byte seed for PRNG\n"
+        "  /dev/urandom              R  binary  used in case above file is missing\n"
+        , AES_SEED_BYTE_SIZE
+        );
+    exit(code);
+}
+
+void mife_encryptd_parse_cmdline(int argc, char **argv, encryptd_inputs *const ins, bool *use_clt) {
+    bool done = false;
+
+    /* set defaults */
+    location public_location = { "public", true };
+    ins->enc.private_location  = (location) {  "private", true };
+    ins->enc.database_location = (location) { "database", true };
+    ins->enc.packed = false;
+    ins->group_size = 16;
+    ins->backlog = 256;
+
+    struct option long_opts[] =
+        { {"db"       , required_argument, NULL, 'd'}
+        , {"database" , required_argument, NULL, 'd'}
+        , {"help"     ,       no_argument, NULL, 'h'}
+        , {"group"    , required_argument, NULL, 'g'}
+        , {"queue"    , required_argument, NULL, 'q'}
+        , {"packed"   ,       no_argument, NULL, 'P'}
+        , {"private"  , required_argument, NULL, 'r'}
+        , {"public"   , required_argument, NULL, 'u'}
+        , {"clt"      ,       no_argument, NULL, 'C'}
+        , {"sequential",      no_argument, NULL, 's'}
+        , {NULL, 0, NULL, 0}
+        };
+
+    g_parallel = 1;
+
+    while(!done) {
+        int c = getopt_long(argc, argv, "d:g:hq:CPr:su:", long_opts, NULL);
+        switch(c) {
+            case  -1: done = true; break;
+            case   0: break; /* a long option with non-NULL flag; should never happen */
+            case '?': mife_encryptd_usage(1); break; /* braking is good defensive driving */
+            case 'd':
+                ins->enc.database_location = (location) { .path = optarg, .stack_allocated = true };
+                break;
+            case 'g':
+                if(atoi(optarg) < 1) {
+                    fprintf(stderr, "%s: unparseable group size '%s', should be positive number\n", *argv, optarg);
+                    mife_encryptd_usage(2);
+                }
+                ins->group_size = atoi(optarg);
+                break;
+            case 'h': mife_encryptd_usage(0); break;
+            case 'q':
+                if(atoi(optarg) < 1) {
+                    fprintf(stderr, "%s: unparseable queue length '%s', should be positive number\n", *argv, optarg);
+                    mife_encryptd_usage(2);
+                }
+                ins->backlog = atoi(optarg);
+                break;
+            case 'C':
+                *use_clt = true;
+                break;
+            case 'P':
+                ins->enc.packed = true;
+                break;
+            case 'r':
+                ins->enc.private_location = (location) { optarg, true };
+                break;
+            case 's':
+                g_parallel = 0;
+                break;
+            case 'u':
+                public_location = (location) { optarg, true };
+                break;
+            default:
+                fprintf(stderr, "The impossible happened! getopt returned %d (%c)\n", c, c);
+                exit(-1);
+                break;
+        }
+    }
+
+    if(optind != argc-1) {
+        fprintf(stderr, "%s: specify exactly one socket (found %d)\n", *argv, argc-optind);
+        mife_encryptd_usage(2);
+    }
+    ins->socket_path = argv[optind];
+
+    /* read the template, public parameters, keys, and seed */
+    const mmap_vtable *mmap;
+    if (*use_clt) {
+        mmap = &clt_vtable;
+    } else {
+        mmap = &gghlite_vtable;
+    }
+    const int code = encryptor_load(mmap, &ins->enc, public_location);
+    if(code > 0) mife_encryptd_usage(code);
+    if(code < 0) exit(-1);
+}
+
+/* writes one reply line */
+static void mife_encryptd_reply(server_conn *const conn, const unsigned long id, const char *const uid, const char *const error) {
+    FILE *const out = server_reply_begin(conn);
+    if(NULL != error)
+        fprintf(out, "%lu\terror %s\n", id, error);
+    else
+        fprintf(out, "%lu\t%s\n", id, uid);
+    server_reply_end(conn);
+}
+
+/* what went wrong, for each code encryptor_job_init can return */
+static const char *mife_encryptd_problem(const int problem) {
+    switch(problem) {
+        case 2: return "partition is not a base-10 number";
+        case 6: return "partition is too large for the key";
+        case 7: return "plaintext has the wrong number of symbols";
+        case 8: return "plaintext has a symbol the template does not know";
+        default: return "internal error";
+    }
+}
+
+static void mife_encryptd_request_free(encryptd_request *const r) {
+    mbp_plaintext_record_free(r->record);
+    server_conn_release(r->conn);
+    free(r);
+}
+
+/* whether r names a uid some request in batch already claimed; two records
+ * with one uid must not be written at the same time */
+static bool mife_encryptd_conflicts(encryptd_request *const *const batch, const unsigned int n, const encryptd_request *const r) {
+    if(NULL == r->record.uid) return false;
+    for(unsigned int i = 0; i < n; i++)
+        if(NULL != batch[i]->record.uid && !strcmp(batch[i]->record.uid, r->record.uid))
+            return true;
+    return false;
+}
+
+/* Takes whatever records are waiting, up to a group, and encodes them all
+ * together so that every core stays busy however the requests arrive; a lone
+ * record is encrypted as soon as it comes in. Stops between groups once the
+ * server is stopping, so no record is ever left half written. */
+static void *mife_encryptd_encoder(void *arg) {
+    encryptd_server *const server = arg;
+    encryptd_inputs *const ins = server->ins;
+    encryptd_request **batch, *carry = NULL;
+    encrypt_job *jobs;
+    unsigned int *job_request;
+    bool *job_success;
+
+    if(ALLOC_FAILS(batch, ins->group_size) || ALLOC_FAILS(jobs, ins->group_size) ||
+       ALLOC_FAILS(job_request, ins->group_size) || ALLOC_FAILS(job_success, ins->group_size)) {
+        fprintf(stderr, "out of memory while starting the encoder\n");
+        exit(-1);
+    }
+
+    while(!server_stopping()) {
+        unsigned int n = 0, num_jobs = 0;
+        if(NULL == carry && NULL == (carry = queue_pop(&server->requests))) break;
+        batch[n++] = carry;
+        carry = NULL;
+        while(n < ins->group_size && NULL != (carry = queue_try_pop(&server->requests))) {
+            if(mife_encryptd_conflicts(batch, n, carry)) break;
+            batch[n++] = carry;
+            carry = NULL;
+        }
+
+        for(unsigned int i = 0; i < n; i++) {
+            const int problem = encryptor_job_init(&ins->enc, &batch[i]->record, true, jobs + num_jobs);
+            if(0 == problem)
+                job_request[num_jobs++] = i;
+            else {
+                mife_encryptd_reply(batch[i]->conn, batch[i]->id, NULL, mife_encryptd_problem(problem));
+                server->failed++;
+            }
+        }
+
+        const uint64_t t = ggh_walltime(0);
+        if(num_jobs > 0)
+            encryptor_run(server->mmap, &ins->enc, jobs, num_jobs, job_success);
+        for(unsigned int j = 0; j < num_jobs; j++) {
+            encryptd_request *const r = batch[job_request[j]];
+            mife_encryptd_reply(r->conn, r->id, jobs[j].uid, job_success[j] ? NULL : "could not write the record");
+            if(job_success[j]) server->encrypted++;
+            else server->failed++;
+            encryptor_job_clear(&ins->enc, jobs + j);
+        }
+        if(num_jobs > 0)
+            fprintf(stderr, "encrypted a group of %u records in %.2fs\n", num_jobs, ggh_seconds(ggh_walltime(t)));
+
+        for(unsigned int i = 0; i < n; i++)
+            mife_encryptd_request_free(batch[i]);
+    }
+
+    if(NULL != carry) mife_encryptd_request_free(carry);
+    free(batch);
+    free(jobs);
+    free(job_request);
+    free(job_success);
+    return NULL;
+}
+
+/* turns one line into a record for the encoder */
+static void *mife_encryptd_parse(void *context, server_conn *conn, unsigned long id, char *line) {
+    encryptd_request *r;
+    (void) context;
+
+    if(ALLOC_FAILS(r, 1)) {
+        mife_encryptd_reply(conn, id, NULL, "out of memory");
+        return NULL;
+    }
+    if(!jsmn_parse_mbp_plaintext_record_string(line, &r->record)) {
+        mife_encryptd_reply(conn, id, NULL, "could not parse plaintext record");
+        free(r);
+        return NULL;
+    }
+    r->conn = conn;
+    r->id = id;
+    return r;
+}
+
+/* blocks when the queue is full, which holds back clients that get too far
+ * ahead */
+static void mife_encryptd_handle(void *context, void *request) {
+    encryptd_server *const server = context;
+    queue_push(&server->requests, request);
+}
+
+/* accepts connections until SIGINT or SIGTERM, then waits for the group being
+ * encoded to be written; returns false if the server could not be started */
+bool mife_encryptd_serve(encryptd_server *const encryptd) {
+    /* the keys are in this process, so only its owner gets to use them */
+    server s = { mife_encryptd_parse, mife_encryptd_handle, encryptd, encryptd->ins->socket_path, true, -1 };
+    pthread_t encoder;
+
+    if(!server_listen(&s)) return false;
+    if(0 != server_spawn(&encoder, NULL, mife_encryptd_encoder, encryptd)) {
+        fprintf(stderr, "could not start the encoder\n");
+        server_unlisten(&s);
+        return false;
+    }
+    fprintf(stderr, "listening on %s\n", encryptd->ins->socket_path);
+    server_run(&s);
+
+    /* wake the encoder if it is idle; records still queued are dropped */
+    queue_close(&encryptd->requests);
+    pthread_join(encoder, NULL);
+    return true;
+}
@@ -0,0 +1,453 @@
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "encryptor.h"
+#include "parse.h"
+#include "queue.h"
+#include "store.h"
+
+#define UID_TRIES 100
+#define INT_STR_LEN (3 * sizeof(int))
+
+/* the write-behind stage of encryptor_run: encoders queue up each
+ * finished matrix, and a writer thread saves and frees them in the background */
+typedef struct {
+    const_mmap_vtable mmap;
+    encryptor *enc;
+    encrypt_job *jobs;
+    unsigned int steps_len;
+    mmap_enc_mat_t *cts;
+    mife_encode_task *tasks;
+    queue pending;
+    bool *job_success;
+    /* with enc->packed, each record is assembled here until all its steps
+     * are done */
+    store_record *records;
+    unsigned int *steps_written;
+    uint64_t write_time; /* total time spent writing, in ggh_walltime units */
+} encrypt_writer;
+
+int encryptor_load(const_mmap_vtable mmap, encryptor *const enc, const location public_location) {
+    /* read the template */
+    location template_location = location_append(public_location, "template.json");
+    mbp_template *template = NULL;
+    mbp_template_stats *stats = NULL;
+    if(template_location.path == NULL || ALLOC_FAILS(template, 1) || ALLOC_FAILS(stats, 1)) {
+        fprintf(stderr, "out of memory while loading template\n");
+        return -1;
+    }
+    if(!jsmn_parse_mbp_template_location(template_location, template)) {
+        fprintf(stderr, "could not parse '%s' as a\nJSON representation of a matrix branching program template over the field F_2\n", template_location.path);
+        return 4;
+    }
+    if(!mbp_template_to_mife_pp(enc->pp, template, stats)) {
+        fprintf(stderr, "internal error while computing statistics for template\n");
+        return -1;
+    }
+    location_free(template_location);
+
+    /* read the public parameters */
+    location pp_location = location_append(public_location, "mife.pub");
+    if(pp_location.path == NULL) {
+        fprintf(stderr, "out of memory while loading public parameters\n");
+        return -1;
+    }
+
+    /* TODO: some error-checking would be nice here */
+    fread_mife_pp(mmap, enc->pp, pp_location.path);
+    location_free(pp_location);
+
+    /* read the secret key */
+    location sk_location = location_append(enc->private_location, "mife.priv");
+    if(sk_location.path == NULL) {
+        fprintf(stderr, "out of memory while loading private key\n");
+        return -1;
+    }
+    /* TODO: error-checking */
+    fread_mife_sk(mmap, enc->sk, sk_location.path);
+    location_free(sk_location);
+
+    /* read the precomputed Kilian conjugates, if keygen made any */
+    location kilian_location = location_append(enc->private_location, "kilian.pre");
+    if(kilian_location.path == NULL) {
+        fprintf(stderr, "out of memory while loading private key\n");
+        return -1;
+    }
+    fread_mife_kilian_cache(enc->sk, kilian_location.path);
+    location_free(kilian_location);
+
+    /* read the seed; each record's streams are derived from it on demand */
+    switch(load_master_seed(enc->private_location, &enc->seed)) {
+        case PARSE_SUCCESS: break;
+        case PARSE_OUT_OF_MEMORY: return -1;
+        case PARSE_INVALID:
+        case PARSE_IO_ERROR: return 5;
+    }
+
+
+    /* TODO: check that `enc->pp` and `stats` match up */
+    /* TODO: check that the secret key is appropriately dimensioned */
+    return 0;
+}
+
+void encryptor_clear(const_mmap_vtable mmap, encryptor *const enc) {
+    mife_clear_sk(mmap, enc->sk);
+    mbp_template_stats *stats = enc->pp->mbp_params;
+    mbp_template *templ = (mbp_template *)stats->template;
+    mbp_template_stats_free(*stats); free(stats);
+    mbp_template_free(*templ); free(templ);
+    mife_clear_pp_read(mmap, enc->pp);
+}
+
+/* reads (num_bits/8 + 1)*8 bytes into n, mod 2^num_bits */
+static bool fmpz_read_bits(fmpz_t n, FILE *file, int num_bits) {
+    fmpz_zero(n);
+    while(num_bits >= 8) {
+        int c = fgetc(file);
+        if(EOF == c) return false;
+        fmpz_mul_ui(n, n, 256);
+        fmpz_add_ui(n, n, c);
+        num_bits -= 8;
+    }
+    if(num_bits >= 0) {
+        int c = fgetc(file);
+        if(EOF == c) return false;
+        c = c % (1 << num_bits);
+        fmpz_mul_ui(n, n, 1 << num_bits);
+        fmpz_add_ui(n, n, c);
+    }
+    return true;
+}
+
+static FILE *encryption_fopen_bin(const location record_location, const char *const position, const int local_index) {
+    int tmp;
+    char *dir, *path;
+    const size_t  dir_len = strlen(record_location.path) + 1 + strlen(position), dir_size = dir_len + 1;
+    const size_t path_len = dir_len + 1 + INT_STR_LEN + 4, path_size = path_len + 1;
+    FILE *result = NULL;
+
+    if(ALLOC_FAILS( dir,  dir_size)) goto done;
+    if(ALLOC_FAILS(path, path_size)) goto free_dir;
+    tmp = snprintf( dir,  dir_size, "%s/%s"    , record_location.path, position);
+    assert(tmp < dir_size);
+    tmp = snprintf(path, path_size, "%s/%d.bin", dir, local_index);
+    assert(tmp < path_size);
+    if(!create_directory_if_missing(dir)) goto free_path;
+    result = fopen(path, "wb");
+
+free_path:
+    free(path);
+free_dir:
+    free(dir);
+done:
+    return result;
+}
+
+static bool encryption_write_step(const_mmap_vtable mmap, mife_pp_t pp, int global_index, mmap_enc_mat_t ct, location record_location) {
+    const mbp_template_stats *const stats    = pp->mbp_params;
+    const mbp_template       *const template = stats->template;
+
+    const int local_index = stats->local_index[global_index];
+    const char *const position = template->steps[global_index].position;
+    FILE *dest = encryption_fopen_bin(record_location, position, local_index);
+    if(NULL == dest) {
+        fprintf(stderr, "could not write %s/%d.bin\n", position, local_index);
+        return false;
+    }
+    const bool success = fwrite_mmap_enc_mat_bin(mmap, ct, global_index, dest);
+    if(0 != fclose(dest) || !success) {
+        fprintf(stderr, "could not write %s/%d.bin\n", position, local_index);
+        return false;
+    }
+    return true;
+}
+
+int encryptor_check_plaintext(const encryptor *const enc, const mbp_plaintext *const pt) {
+    const mbp_template *const template = ((mbp_template_stats *)enc->pp->mbp_params)->template;
+    unsigned int i, j;
+
+    /* check that the template and plaintext have the same length */
+    if(template->steps_len != pt->symbols_len) {
+        fprintf(stderr, "the number of symbols in the plaintext (%d)\ndoes not match the number of steps in the template (%d)\n",
+                pt->symbols_len, template->steps_len);
+        return 7;
+    }
+
+    /* check that each symbol is known at its step */
+    bool match_everywhere = true;
+    for(i = 0; i < template->steps_len; i++) {
+        bool match_here = false;
+        for(j = 0; j < template->steps[i].symbols_len; j++)
+            match_here |= !strcmp(template->steps[i].symbols[j], pt->symbols[i]);
+        if(!match_here) {
+            fprintf(stderr, "the plaintext symbol %s at index %d is unknown\n", pt->symbols[i], i);
+            fprintf(stderr, "\t(known symbols: ");
+            for(j = 0; j < template->steps[i].symbols_len-1; j++)
+                fprintf(stderr, "%s, ", template->steps[i].symbols[j]);
+            fprintf(stderr, "%s)\n", template->steps[i].symbols[j]);
+        }
+        match_everywhere &= match_here;
+    }
+    return match_everywhere ? 0 : 8;
+}
+
+bool encryptor_fresh_location(const location database_location, const int L, location *const record_location, char **const out_uid) {
+    const size_t offset = strlen(database_location.path) + 1;
+    /* uids are drawn from 2L+8 bits, and each base-62 character holds a bit
+     * more than 5 of them; leave room for the terminator */
+    const size_t record_location_size = offset + (2*L + 8) / 5 + 2;
+    /* it is not important that the uid be cryptographically random, so just
+     * use /dev/urandom */
+    FILE *urandom = fopen("/dev/urandom", "rb");
+    fmpz_t uid_num;
+    unsigned int i;
+    char *uid;
+
+    if(NULL == urandom) {
+        fprintf(stderr, "no uid specified and could not open /dev/urandom to choose one\n");
+        return false;
+    }
+    if(ALLOC_FAILS(record_location->path, record_location_size)) {
+        fclose(urandom);
+        fprintf(stderr, "out of memory while finding unused uid\n");
+        return false;
+    }
+
+    memcpy(record_location->path, database_location.path, offset-1);
+    record_location->path[offset-1] = '/';
+    record_location->stack_allocated = false;
+    uid = record_location->path+offset;
+
+    fmpz_init(uid_num);
+    for(i = 0; i < UID_TRIES; i++) {
+        /* from the birthday bound: if we draw 2^L elements from a pool of
+         * 2^(2L+8) possible elements, we have a roughly 0.2% chance of
+         * failing; that should be sufficiently low for our purposes */
+        fmpz_read_bits(uid_num, urandom, 2*L + 8);
+        fmpz_get_str(uid, 62, uid_num);
+        /* probably not totally foolproof, but is a decent quick check that
+         * the uid isn't taken, in either layout
+         */
+        if(!store_uid_exists(database_location, uid)) break;
+    }
+    fmpz_clear(uid_num);
+    fclose(urandom);
+
+    if(UID_TRIES == i) {
+        fprintf(stderr, "tried %d random uids, but they were all in use\n", UID_TRIES);
+        location_free(*record_location);
+        return false;
+    }
+
+    *out_uid = uid;
+    return true;
+}
+
+bool encryptor_random_partition(encryptor *const enc, const char *const uid, fmpz_t partition) {
+    aes_randstate_t randstate;
+    if(!mife_substream_init(randstate, &enc->seed, "partition", uid, MIFE_SUBSTREAM_ALL, MIFE_SUBSTREAM_ALL))
+        return false;
+    /* TODO: this cast -- from int to mp_bitcnt_t -- is probably fine...
+     * right??? the FLINT docs are surprisingly quiet about mp_bitcnt_t */
+    fmpz_randbits_aes(partition, randstate, enc->pp->L);
+    aes_randclear(randstate);
+    return true;
+}
+
+int encryptor_job_init(encryptor *const enc, mbp_plaintext_record *const record, bool always_print_uid, encrypt_job *const job) {
+    int problem;
+
+    if(0 != (problem = encryptor_check_plaintext(enc, &record->pt)))
+        return problem;
+
+    /* initialize record_location, ensuring uid is initialized as a side effect */
+    job->print_uid = always_print_uid;
+    if(NULL != record->uid) {
+        job->record_location = location_append(enc->database_location, record->uid);
+        if(NULL == job->record_location.path) {
+            fprintf(stderr, "out of memory while building path %s/%s\n", enc->database_location.path, record->uid);
+            return -1;
+        }
+        job->uid = job->record_location.path + strlen(enc->database_location.path) + 1;
+    } else {
+        if(!encryptor_fresh_location(enc->database_location, enc->pp->L, &job->record_location, &job->uid))
+            return -1;
+        job->print_uid = true;
+    }
+
+    /* initialize partition if it wasn't specified */
+    fmpz_init(job->partition);
+    if(NULL != record->partition) {
+        if(0 != fmpz_set_str(job->partition, record->partition, 10)) {
+            fprintf(stderr, "could not read %s as a base-10 number\n", record->partition);
+            problem = 2;
+            goto free_partition;
+        }
+    } else if(!encryptor_random_partition(enc, job->uid, job->partition)) {
+        problem = -1;
+        goto free_partition;
+    }
+
+    /* check that the partition is in range */
+    if(fmpz_sizeinbase(job->partition, 2) > (size_t)enc->pp->L) {
+        fprintf(stderr, "partition uses %zu bits, but the current key supports only up to %d bits\n", fmpz_sizeinbase(job->partition, 2), enc->pp->L);
+        problem = 6;
+        goto free_partition;
+    }
+
+    mife_encrypt_setup(enc->pp, job->partition, &record->pt, job->clr, &job->partitions);
+    return 0;
+
+free_partition:
+    fmpz_clear(job->partition);
+    location_free(job->record_location);
+    return problem;
+}
+
+void encryptor_job_clear(encryptor *const enc, encrypt_job *const job) {
+    mife_encrypt_clear(enc->pp, job->clr, job->partitions);
+    fmpz_clear(job->partition);
+    location_free(job->record_location);
+}
+
+/* Saves the ciphertext of task t and frees it. Only ever called from one
+ * thread at a time. */
+static void encryption_writer_write(encrypt_writer *const w, const unsigned int t) {
+    const unsigned int j = t / w->steps_len, i = t % w->steps_len;
+    const uint64_t start = ggh_walltime(0);
+    if(w->enc->packed) {
+        w->job_success[j] &= store_record_add(w->mmap, w->records + j, i, w->cts[t]);
+        if(++w->steps_written[j] == w->steps_len && w->job_success[j])
+            w->job_success[j] = store_append(w->enc->database_location, w->jobs[j].uid, w->records + j);
+    } else
+        w->job_success[j] &= encryption_write_step(w->mmap, w->enc->pp, i, w->cts[t], w->jobs[j].record_location);
+    mife_encrypt_task_clear(w->tasks + t);
+    mmap_enc_mat_clear(w->mmap, w->cts[t]);
+    w->write_time += ggh_walltime(start);
+}
+
+/* called by the encoders when a matrix is complete; blocks if the writer has
+ * fallen too far behind */
+static void encryption_writer_notify(void *context, int task) {
+    encrypt_writer *const w = context;
+    queue_push(&w->pending, w->tasks + task);
+}
+
+static void *encryption_writer_run(void *context) {
+    encrypt_writer *const w = context;
+    mife_encode_task *task;
+    while(NULL != (task = queue_pop(&w->pending)))
+        encryption_writer_write(w, task - w->tasks);
+    return NULL;
+}
+
+/* Encrypts and writes every step of every job. All of the encodings are
+ * scheduled together, so even templates with tiny matrices keep every core
+ * busy, and each matrix is written by a separate thread while the rest are
+ * still being encoded. Sets job_success[j] to whether jobs[j] was written
+ * successfully, and returns true iff every one was. */
+bool encryptor_run(const_mmap_vtable mmap, encryptor *const enc, encrypt_job *const jobs, const unsigned int num_jobs, bool *const job_success) {
+    const mbp_template *const template = ((mbp_template_stats *)enc->pp->mbp_params)->template;
+    const unsigned int steps_len = template->steps_len, num_tasks = num_jobs * steps_len;
+    mmap_enc_mat_t *cts;
+    mife_encode_task *tasks;
+    bool success = true;
+
+    if(ALLOC_FAILS(cts, num_tasks) || ALLOC_FAILS(tasks, num_tasks)) {
+        fprintf(stderr, "out of memory while scheduling encodings\n");
+        exit(-1);
+    }
+
+    /**
+     * determine the total # of encodings we need to make for these ciphertexts, for
+     * benchmarking and progress bar purposes
+     */
+    int encoding_count = 0;
+    for(unsigned int i = 0; i < steps_len; i++) {
+        const f2_matrix *const m = template->steps[i].matrix;
+        encoding_count += m->num_rows * m->num_cols;
+    }
+
+    set_NUM_ENC(num_jobs * encoding_count);
+    NUM_ENCODINGS_GENERATED = 0;
+
+    // now, perform the actual encryption
+
+    reset_T();
+    /* each (record, step) pair draws from its own substream, so the tasks can
+     * be prepared in any order without changing the output */
+    bool out_of_memory = false;
+#pragma omp parallel for schedule(dynamic,1) if(g_parallel)
+    for(unsigned int t = 0; t < num_tasks; t++) {
+        const unsigned int j = t / steps_len, i = t % steps_len;
+        aes_randstate_t randstate;
+        if(!mife_substream_init(randstate, &enc->seed, "encrypt", jobs[j].uid, i, MIFE_SUBSTREAM_ALL)) {
+            out_of_memory = true;
+            continue;
+        }
+        mife_encrypt_task_init(mmap, enc->pp, enc->sk, randstate, i,
+                               jobs[j].clr, jobs[j].partitions,
+                               cts[t], tasks + t);
+        aes_randclear(randstate);
+    }
+    if(out_of_memory) exit(-1);
+
+    /* write each matrix behind the encoders' backs as soon as it is done */
+    encrypt_writer writer = { mmap, enc, jobs, steps_len, cts, tasks, .records = NULL, .steps_written = NULL, .write_time = 0 };
+    pthread_t writer_thread;
+    bool threaded = false;
+    writer.job_success = job_success;
+    if(enc->packed && (ALLOC_FAILS(writer.records, num_jobs) || ALLOC_FAILS(writer.steps_written, num_jobs))) {
+        fprintf(stderr, "out of memory while scheduling encodings\n");
+        exit(-1);
+    }
+    for(unsigned int j = 0; j < num_jobs; j++) {
+        writer.job_success[j] = true;
+        if(enc->packed) {
+            writer.steps_written[j] = 0;
+            if(!store_record_init(writer.records + j, steps_len)) {
+                fprintf(stderr, "out of memory while scheduling encodings\n");
+                exit(-1);
+            }
+        }
+    }
+    if(queue_init(&writer.pending, steps_len)) {
+        threaded = 0 == pthread_create(&writer_thread, NULL, encryption_writer_run, &writer);
+        if(!threaded) queue_clear(&writer.pending);
+    }
+
+    if(threaded) {
+        mife_encode_tasks_notify(mmap, enc->sk, num_tasks, tasks, encryption_writer_notify, &writer);
+        timer_printf("\n");
+
+        const uint64_t t_encoded = ggh_walltime(0);
+        queue_close(&writer.pending);
+        pthread_join(writer_thread, NULL);
+        queue_clear(&writer.pending);
+        const uint64_t tail = ggh_walltime(t_encoded);
+        timer_printf("Wrote %u matrices in %8.2fs, %8.2fs of it hidden behind encoding\n",
+            num_tasks, ggh_seconds(writer.write_time),
+            ggh_seconds(writer.write_time > tail ? writer.write_time - tail : 0));
+    } else {
+        /* no writer thread; fall back to writing everything afterwards */
+        mife_encode_tasks(mmap, enc->sk, num_tasks, tasks);
+        timer_printf("\n");
+        for(unsigned int t = 0; t < num_tasks; t++)
+            encryption_writer_write(&writer, t);
+    }
+
+    for(unsigned int j = 0; j < num_jobs; j++)
+        success &= job_success[j];
+
+    if(enc->packed)
+        for(unsigned int j = 0; j < num_jobs; j++)
+            store_record_clear(writer.records + j);
+    free(writer.records);
+    free(writer.steps_written);
+    free(tasks);
+    free(cts);
+    return success;
+}
@@ -0,0 +1,62 @@
+#ifndef _MIFE_ENCRYPTOR_H
+#define _MIFE_ENCRYPTOR_H
+
+#include "cmdline.h"
+#include "mbp_types.h"
+#include "mife.h"
+#include "util.h"
+
+/* everything about encryption that stays the same from record to record */
+typedef struct {
+    mife_sk_t sk;
+    mife_pp_t pp;
+    location database_location;
+    location private_location;
+    /* every record's randomness is derived from this; see substream.h */
+    mife_master_seed seed;
+    /* append records to the packed store instead of one file per step */
+    bool packed;
+} encryptor;
+
+/* everything needed to encrypt one record, from choosing its uid through
+ * writing its step matrices */
+typedef struct {
+    location record_location;
+    char *uid; /* points into record_location */
+    bool print_uid;
+    fmpz_t partition;
+    mife_mat_clr_t clr;
+    int ***partitions;
+} encrypt_job;
+
+/* Fills in pp from <public>/template.json and <public>/mife.pub, and the keys
+ * and seed from private_location. Returns 0 on success; otherwise describes
+ * the problem on stderr and returns a positive error code for bad input or -1
+ * for internal failures. */
+int  encryptor_load(const_mmap_vtable mmap, encryptor *const enc, const location public_location);
+/* frees everything encryptor_load allocated; the locations are left to the
+ * caller */
+void encryptor_clear(const_mmap_vtable mmap, encryptor *const enc);
+
+/* checks that pt has a symbol the template knows at each step, reporting any
+ * mismatch on stderr; returns 0 on success or a usage code on failure */
+int  encryptor_check_plaintext(const encryptor *const enc, const mbp_plaintext *const pt);
+/* picks an unused uid in the database and initializes record_location to the
+ * record's directory; *out_uid points into record_location.path */
+bool encryptor_fresh_location(const location database_location, const int L, location *const record_location, char **const out_uid);
+/* the partition a record stored under uid gets when none is specified */
+bool encryptor_random_partition(encryptor *const enc, const char *const uid, fmpz_t partition);
+
+/* Prepares a single record for encryption: picks its uid and partition, and
+ * lays out its cleartext matrices. Returns 0 on success, a positive usage code
+ * if the record itself was bad, and -1 on internal errors (out of memory and
+ * so on). On failure, job needs no cleanup. */
+int  encryptor_job_init(encryptor *const enc, mbp_plaintext_record *const record, bool always_print_uid, encrypt_job *const job);
+void encryptor_job_clear(encryptor *const enc, encrypt_job *const job);
+/* Encrypts and writes every step of every job, setting job_success[j] to
+ * whether jobs[j] was written; returns true iff every one was. Not safe to
+ * call from several threads at once, since encoding progress is tracked in
+ * globals; batch jobs up instead. */
+bool encryptor_run(const_mmap_vtable mmap, encryptor *const enc, encrypt_job *const jobs, const unsigned int num_jobs, bool *const job_success);
+
+#endif /* ifndef _MIFE_ENCRYPTOR_H */
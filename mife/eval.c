@@ -7,6 +7,7 @@
 #include <sys/resource.h>
 
 #include "cmdline.h"
+#include "evaluator.h"
 #include "mbp_types.h"
 #include "mbp_glue.h"
 #include "mife.h"
@@ -14,22 +15,26 @@
 #include "util.h"
 
 typedef struct {
-	mife_pp_t pp;
-	location database_location;
+	evaluator ev;
+	/* the mapping given on the command line; unused in batch mode */
 	ciphertext_mapping mapping;
+	/* in batch mode, where to read mappings from, one per line; else NULL */
+	FILE *batch;
+	/* in batch mode, how many mappings to evaluate at a time */
+	unsigned int group_size;
+	/* in batch mode, how much memory to spend caching step matrices */
+	size_t cache_budget;
 } eval_inputs;
 
-static const mbp_template_stats *mbp_template_stats_from_eval_inputs(const eval_inputs ins) { return ins.pp->mbp_params; }
-static const mbp_template       *mbp_template_from_eval_inputs      (const eval_inputs ins) { return mbp_template_stats_from_eval_inputs(ins)->template; }
-
 void mife_eval_parse_cmdline(int argc, char **argv, eval_inputs *const ins, bool *use_clt);
-f2_matrix mife_eval_evaluate(const_mmap_vtable mmap, const eval_inputs ins);
+bool mife_eval_batch(const_mmap_vtable mmap, eval_inputs *const ins);
 void mife_eval_print_outputs(const mbp_template t, const f2_matrix m);
+void mife_eval_print_outputs_line(const mbp_template t, const f2_matrix m);
 void mife_eval_cleanup(const_mmap_vtable mmap, eval_inputs ins, f2_matrix m);
 
 int main(int argc, char **argv) {
 	eval_inputs ins;
-	f2_matrix m;
+	f2_matrix m = { .num_rows = 0, .num_cols = 0, .elems = NULL };
 	bool success;
     bool use_clt = false;
 
@@ -42,15 +47,23 @@ int main(int argc, char **argv) {
         mmap = &gghlite_vtable;
     }
 
-	m = mife_eval_evaluate(mmap, ins);
-	success = NULL != m.elems;
-	if(success) mife_eval_print_outputs(*mbp_template_from_eval_inputs(ins), m);
+	const bool batch = NULL != ins.batch;
+	if(batch)
+		success = mife_eval_batch(mmap, &ins);
+	else {
+		m = evaluator_evaluate(mmap, &ins.ev, ins.mapping);
+		success = NULL != m.elems;
+		if(success) mife_eval_print_outputs(*evaluator_template(&ins.ev), m);
+	}
+	if(NULL != ins.ev.results)
+		result_cache_print_stats(ins.ev.results, stderr);
 	mife_eval_cleanup(mmap, ins, m);
 
     {
         struct rusage usage;
         (void) getrusage(RUSAGE_SELF, &usage);
-        (void) printf("Max memory usage: %ld\n", usage.ru_maxrss);
+        /* keep batch mode's stdout to the result lines */
+        (void) fprintf(batch ? stderr : stdout, "Max memory usage: %ld\n", usage.ru_maxrss);
     }
 
 	return success ? 0 : -1;
@@ -61,6 +74,7 @@ static void mife_eval_usage(const int code) {
 	if(0 != code) printf("\n\n");
 	printf(
 		"USAGE: eval [OPTIONS] MAPPING\n"
+		"       eval [OPTIONS] --batch FILE\n"
 		"The evaluation operation plugs individual database records into each position\n"
 		"of the function being computed. The mapping should be a JSON object whose\n"
 		"field names should be positions from the public function template, and whose\n"
@@ -68,6 +82,13 @@ static void mife_eval_usage(const int code) {
 		"\n"
 		"Prints one line for each non-zero in the result matrix. The line will contain\n"
 		"the appropriate string from the `outputs` field of the function template.\n"
+		"Entries whose string is empty are never computed, and if the template sets\n"
+		"`single_output`, evaluation stops at the first non-zero.\n"
+		"\n"
+		"In batch mode, FILE (or stdin, for -) holds one mapping per line. Mappings are\n"
+		"evaluated in parallel, sharing the public parameters and a cache of step\n"
+		"matrices, and for each one a single line is printed: its line number, a tab,\n"
+		"and the strings for the non-zeros in the result, separated by spaces.\n"
 		"\n"
 		"Brackets indicate default values for each argument.\n"
 		"\n"
@@ -79,11 +100,28 @@ static void mife_eval_usage(const int code) {
         "  -s, --sequential         Disable parallelism\n"
 
 		"\n"
-		"Evaluation-specific options: (none)\n"
+		"Evaluation-specific options:\n"
+		"  -p, --prefetch           Load up to this many step matrices in the\n"
+		"                           background while multiplying; 0 loads each\n"
+		"                           one only when it is needed [2]\n"
+		"  -T, --tree               Load every step matrix up front and multiply\n"
+		"                           them in the cheapest order, with independent\n"
+		"                           products in parallel\n"
+		"  -b, --batch              Read mappings from this file instead\n"
+		"  -g, --group              In batch mode, evaluate this many mappings\n"
+		"                           at a time [64]\n"
+		"  -m, --cache              In batch mode, keep up to this many MiB of\n"
+		"                           step matrices in memory; 0 disables the\n"
+		"                           cache [1024]\n"
+		"  -R, --results            Remember results in <database>/results and\n"
+		"                           reuse them, in this run and later ones\n"
 		"\n"
 		"Files used:\n"
 		"  <database>/<uid>/<position>/*.bin\n"
 		"                            R  binary  the encrypted records\n"
+		"  <database>/packed/*/*     R  binary  the encrypted records, if they were\n"
+		"                                       encrypted with --packed\n"
+		"  <database>/results       RW  binary  remembered results, with --results\n"
 		"  <public>/template.json    R  JSON    a description of the function being\n"
 		"                                       evaluated\n"
 		"  <public>/mife.pub         R  custom  public parameters for evaluating\n"
@@ -92,18 +130,26 @@ static void mife_eval_usage(const int code) {
 }
 
 void mife_eval_parse_cmdline(int argc, char **argv, eval_inputs *const ins, bool *use_clt) {
-	unsigned int i;
-
 	/* set defaults */
 	location public_location = { "public", true };
-	/* since ins->database_location gets returned to the caller, we can't
+	/* since ins->ev.database_location gets returned to the caller, we can't
 	 * allocate it on our stack */
-	if(ALLOC_FAILS(ins->database_location.path, strlen("database")+1)) {
+	if(ALLOC_FAILS(ins->ev.database_location.path, strlen("database")+1)) {
 		fprintf(stderr, "%s: out of memory when setting default database location\n", *argv);
 		exit(-1);
 	}
-	strcpy(ins->database_location.path, "database");
-	ins->database_location.stack_allocated = false;
+	strcpy(ins->ev.database_location.path, "database");
+	ins->ev.database_location.stack_allocated = false;
+	ins->ev.prefetch = 2;
+	ins->ev.cache = NULL;
+	ins->ev.results = NULL;
+	ins->ev.tree = false;
+	ins->batch = NULL;
+	ins->group_size = 64;
+	ins->cache_budget = (size_t)1024 << 20;
+	ins->mapping.positions_len = 0;
+	const char *batch_path = NULL;
+	bool use_results = false;
 
 	bool done = false;
 	struct option long_opts[] =
@@ -113,22 +159,53 @@ void mife_eval_parse_cmdline(int argc, char **argv, eval_inputs *const ins, bool
 		, {"public"  , required_argument, NULL, 'u'}
         , {"clt"     ,       no_argument, NULL, 'C'}
         , {"sequential",     no_argument, NULL, 's'}
+		, {"prefetch", required_argument, NULL, 'p'}
+		, {"batch"   , required_argument, NULL, 'b'}
+		, {"group"   , required_argument, NULL, 'g'}
+		, {"cache"   , required_argument, NULL, 'm'}
+		, {"tree"    ,       no_argument, NULL, 'T'}
+		, {"results" ,       no_argument, NULL, 'R'}
+		, {NULL, 0, NULL, 0}
 		};
 
     g_parallel = 1;
 
 	while(!done) {
-		int c = getopt_long(argc, argv, "d:hsu:C", long_opts, NULL);
+		int c = getopt_long(argc, argv, "b:d:g:hm:p:su:CRT", long_opts, NULL);
 		switch(c) {
 			case  -1: done = true; break;
 			case   0: break; /* a long option with non-NULL flag; should never happen */
 			case '?': mife_eval_usage(1); break; /* braking is good defensive driving */
+			case 'b':
+				batch_path = optarg;
+				break;
 			case 'd':
-				location_free(ins->database_location);
-				ins->database_location.path = optarg;
-				ins->database_location.stack_allocated = true;
+				location_free(ins->ev.database_location);
+				ins->ev.database_location.path = optarg;
+				ins->ev.database_location.stack_allocated = true;
+				break;
+			case 'g':
+				if(atoi(optarg) < 1) {
+					fprintf(stderr, "%s: unparseable group size '%s', should be a positive number\n", *argv, optarg);
+					mife_eval_usage(2);
+				}
+				ins->group_size = atoi(optarg);
 				break;
 			case 'h': mife_eval_usage(0); break;
+			case 'm':
+				if(atoi(optarg) < 0) {
+					fprintf(stderr, "%s: unparseable cache size '%s', should be a non-negative number\n", *argv, optarg);
+					mife_eval_usage(2);
+				}
+				ins->cache_budget = (size_t)atoi(optarg) << 20;
+				break;
+			case 'p':
+				if(atoi(optarg) < 0) {
+					fprintf(stderr, "%s: unparseable prefetch depth '%s', should be a non-negative number\n", *argv, optarg);
+					mife_eval_usage(2);
+				}
+				ins->ev.prefetch = atoi(optarg);
+				break;
 			case 'u':
 				location_free(public_location);
 				public_location = (location) { optarg, true };
@@ -139,6 +216,12 @@ void mife_eval_parse_cmdline(int argc, char **argv, eval_inputs *const ins, bool
             case 'C':
                 *use_clt = true;
                 break;
+			case 'R':
+				use_results = true;
+				break;
+			case 'T':
+				ins->ev.tree = true;
+				break;
 			default:
 				fprintf(stderr, "The impossible happened! getopt returned %d (%c)\n", c, c);
 				exit(-1);
@@ -153,126 +236,140 @@ void mife_eval_parse_cmdline(int argc, char **argv, eval_inputs *const ins, bool
         mmap = &gghlite_vtable;
     }
 
-	/* read the mapping */
-	if(optind != argc-1) {
-		fprintf(stderr, "%s: specify exactly one mapping (found %d)\n", *argv, argc-optind);
-		mife_eval_usage(2);
-	}
-	if(!jsmn_parse_ciphertext_mapping_string(argv[optind], &ins->mapping)) {
-		fprintf(stderr, "%s: could not parse mapping as JSON object with string values\n", *argv);
-		mife_eval_usage(3);
+	/* read the mapping, or find where the mappings will come from */
+	if(NULL != batch_path) {
+		if(optind != argc) {
+			fprintf(stderr, "%s: a mapping may not be given with --batch (found %d)\n", *argv, argc-optind);
+			mife_eval_usage(2);
+		}
+		ins->batch = strcmp(batch_path, "-") ? fopen(batch_path, "r") : stdin;
+		if(NULL == ins->batch) {
+			fprintf(stderr, "%s: could not open batch file '%s'\n", *argv, batch_path);
+			mife_eval_usage(3);
+		}
+	} else {
+		if(optind != argc-1) {
+			fprintf(stderr, "%s: specify exactly one mapping (found %d)\n", *argv, argc-optind);
+			mife_eval_usage(2);
+		}
+		if(!jsmn_parse_ciphertext_mapping_string(argv[optind], &ins->mapping)) {
+			fprintf(stderr, "%s: could not parse mapping as JSON object with string values\n", *argv);
+			mife_eval_usage(3);
+		}
 	}
 
-	/* read the template */
-	location template_location = location_append(public_location, "template.json");
-	mbp_template *template = NULL;
-	mbp_template_stats *stats = NULL;
-	if(template_location.path == NULL || ALLOC_FAILS(template, 1) || ALLOC_FAILS(stats, 1)) {
-		fprintf(stderr, "%s: out of memory while loading template\n", *argv);
-		exit(-1);
-	}
-	if(!jsmn_parse_mbp_template_location(template_location, template)) {
-		fprintf(stderr, "%s: could not parse '%s' as a\nJSON representation of a matrix branching program template over the field F_2\n", *argv, template_location.path);
-		mife_eval_usage(4);
-	}
-	if(!mbp_template_to_mife_pp(ins->pp, template, stats)) {
-		fprintf(stderr, "%s: internal error while computing statistics for template\n", *argv);
-		exit(-1);
+	/* read the template and public parameters */
+	int code = evaluator_load(mmap, &ins->ev, public_location);
+	if(code > 0) mife_eval_usage(code);
+	if(code < 0) exit(-1);
+
+	if(NULL == ins->batch) {
+		code = evaluator_check_mapping(&ins->ev, ins->mapping);
+		if(0 != code) mife_eval_usage(code);
 	}
-	location_free(template_location);
 
-	/* read the public parameters */
-	location pp_location = location_append(public_location, "mife.pub");
-	if(pp_location.path == NULL) {
-		fprintf(stderr, "%s: out of memory while loading public parameters\n", *argv);
+	if(use_results && NULL == (ins->ev.results = result_cache_open(ins->ev.database_location, public_location)))
 		exit(-1);
-	}
-	/* TODO: some error-checking would be nice here */
-	fread_mife_pp(mmap, ins->pp, pp_location.path);
-	location_free(pp_location);
-
-	/* sanity check: are all and only the necessary positions specified in the
-	 * mapping? */
-	if(stats->positions_len != ins->mapping.positions_len) {
-		fprintf(stderr, "arity mismatch:\n"
-		                "\tfunction template from public parameters expects %u arguments,\n"
-		                "\tmapping provided on the command line specifies %u arguments\n"
-		              , stats->positions_len, ins->mapping.positions_len);
-		mife_eval_usage(5);
-	}
-	bool position_missing = false;
-	for(i = 0; i < stats->positions_len; i++) {
-		if(NULL == uid_from_position(ins->mapping, stats->positions[i])) {
-			fprintf(stderr, "no mapping for position %s\n", stats->positions[i]);
-			position_missing = true;
+
+	if(NULL != ins->batch) {
+		/* the mappings themselves are evaluated in parallel, so each one gets a
+		 * single thread */
+		ins->ev.parallel = false;
+		ins->ev.prefetch = 0;
+		if(ins->cache_budget > 0 && NULL == (ins->ev.cache = enc_cache_new(mmap, ins->cache_budget))) {
+			fprintf(stderr, "%s: out of memory while creating the matrix cache\n", *argv);
+			exit(-1);
 		}
-	}
-	if(position_missing) mife_eval_usage(6);
+	} else
+		ins->ev.parallel = g_parallel;
 }
 
-static bool mife_eval_load_matrix(const_mmap_vtable mmap, const eval_inputs ins, unsigned int global_index, mmap_enc_mat_t out_m) {
-	const mbp_template_stats *const stats    = ins.pp->mbp_params;
-	/* const mbp_template       *const template = stats->template; */
-	const int local_index      = stats->local_index[global_index];
-	const char *const position = stats->positions[stats->position_index[global_index]];
-	const char *const uid      = uid_from_position(ins.mapping, position);
-	const char *const db_path  = ins.database_location.path;
-	const int path_len  = snprintf(NULL, 0, "%s/%s/%s/%d.bin", db_path, uid, position, local_index);
-	const int path_size = path_len+1;
-	bool result = false;
-	char *path;
-
-	if(ALLOC_FAILS(path, path_size)) {
-		fprintf(stderr, "out of memory trying to construct path:\n\t%s/%s/%s/%d.bin\n", db_path, uid, position, local_index);
-		goto done;
-	}
-
-	int tmp = snprintf(path, path_size, "%s/%s/%s/%d.bin", db_path, uid, position, local_index);
-	if(tmp != path_len) {
-		fprintf(stderr, "The impossible happened: snprintf produced strings of two different lengths on two calls with all the same arguments.\n\t(%d first time, %d second)\n", path_len, tmp);
-		goto free_path;
+/* one mapping read from the batch file */
+typedef struct {
+	unsigned long line;
+	ciphertext_mapping mapping;
+	bool parsed;
+	f2_matrix result;
+} eval_batch_entry;
+
+/* reads up to group_size mappings into entries, reporting unparseable ones;
+ * returns how many lines were consumed */
+static unsigned int mife_eval_batch_read(eval_inputs *const ins, eval_batch_entry *const entries, unsigned long *const line, char **const buf, size_t *const buf_size) {
+	unsigned int n = 0;
+	ssize_t len;
+
+	while(n < ins->group_size && (len = getline(buf, buf_size, ins->batch)) >= 0) {
+		eval_batch_entry *const e = entries + n;
+		(*line)++;
+		while(len > 0 && ('\n' == (*buf)[len-1] || '\r' == (*buf)[len-1]))
+			(*buf)[--len] = '\0';
+		if(0 == len) continue;
+
+		e->line = *line;
+		e->result.elems = NULL;
+		e->parsed = jsmn_parse_ciphertext_mapping_string(*buf, &e->mapping);
+		if(!e->parsed)
+			fprintf(stderr, "line %lu: could not parse mapping as JSON object with string values\n", *line);
+		else if(0 != evaluator_check_mapping(&ins->ev, e->mapping)) {
+			fprintf(stderr, "line %lu: mapping does not match the template\n", *line);
+			ciphertext_mapping_free(e->mapping);
+			e->parsed = false;
+		}
+		n++;
 	}
+	return n;
+}
 
-	FILE *file = fopen(path, "rb");
-	if(NULL == file) {
-		fprintf(stderr, "Could not open ciphertext chunk at location\n\t%s\n", path);
-		goto free_path;
+/* Evaluates each mapping in the batch file, group_size at a time. Results are
+ * printed in the order the mappings appear; a mapping that can't be parsed or
+ * evaluated is reported on stderr and gets no line. */
+bool mife_eval_batch(const_mmap_vtable mmap, eval_inputs *const ins) {
+	const mbp_template *const template = evaluator_template(&ins->ev);
+	eval_batch_entry *entries;
+	unsigned long line = 0;
+	unsigned int n;
+	char *buf = NULL;
+	size_t buf_size = 0;
+	bool success = true;
+
+	if(ALLOC_FAILS(entries, ins->group_size)) {
+		fprintf(stderr, "out of memory while reading batch\n");
+		return false;
 	}
 
-	/* TODO: would be nice to have some error checking here */
-	fread_mmap_enc_mat(mmap, out_m, file);
-	result = true;
-
-	fclose(file);
-free_path:
-	free(path);
-done:
-	return result;
-}
+	while((n = mife_eval_batch_read(ins, entries, &line, &buf, &buf_size)) > 0) {
+#pragma omp parallel for schedule(dynamic,1) if(g_parallel)
+		for(unsigned int i = 0; i < n; i++)
+			if(entries[i].parsed)
+				entries[i].result = evaluator_evaluate(mmap, &ins->ev, entries[i].mapping);
 
-f2_matrix mife_eval_evaluate(const_mmap_vtable mmap, const eval_inputs ins) {
-	f2_matrix result = { .num_rows = 0, .num_cols = 0, .elems = NULL };
-	const mbp_template *const template = mbp_template_from_eval_inputs(ins);
-	mmap_enc_mat_t product, multiplicand;
-	unsigned int i;
-
-	/* if there are no steps to evaluate, I guess we're done */
-	if(template->steps_len < 1) goto done;
-	if(!mife_eval_load_matrix(mmap, ins, 0, product)) goto done;
-	for(i = 1; i < template->steps_len; i++) {
-		if(!mife_eval_load_matrix(mmap, ins, i, multiplicand)) goto clear_product;
-        if (g_parallel)
-          mmap_enc_mat_mul_par(mmap, ins.pp->params_ref, product, product, multiplicand);
-        else
-          mmap_enc_mat_mul(mmap, ins.pp->params_ref, product, product, multiplicand);
-		mmap_enc_mat_clear(mmap, multiplicand);
+		for(unsigned int i = 0; i < n; i++) {
+			if(!entries[i].parsed) {
+				success = false;
+				continue;
+			}
+			if(NULL == entries[i].result.elems) {
+				fprintf(stderr, "line %lu: evaluation failed\n", entries[i].line);
+				success = false;
+			} else {
+				printf("%lu\t", entries[i].line);
+				mife_eval_print_outputs_line(*template, entries[i].result);
+				f2_matrix_free(entries[i].result);
+			}
+			ciphertext_mapping_free(entries[i].mapping);
+		}
+		fflush(stdout);
+	}
+	if(ferror(ins->batch)) {
+		fprintf(stderr, "error while reading batch\n");
+		success = false;
 	}
 
-	result = mife_zt_all(mmap, ins.pp, product);
-clear_product:
-	mmap_enc_mat_clear(mmap, product);
-done:
-	return result;
+	if(NULL != ins->ev.cache)
+		enc_cache_print_stats(ins->ev.cache, stderr);
+	free(buf);
+	free(entries);
+	return success;
 }
 
 static unsigned int minui(const unsigned int l, const unsigned int r) {
@@ -291,13 +388,26 @@ void mife_eval_print_outputs(const mbp_template t, const f2_matrix m) {
 	}
 }
 
+/* like mife_eval_print_outputs, but all on one line */
+void mife_eval_print_outputs_line(const mbp_template t, const f2_matrix m) {
+	const unsigned int num_rows = minui(m.num_rows, t.outputs.num_rows);
+	const unsigned int num_cols = minui(m.num_cols, t.outputs.num_cols);
+	bool first = true;
+	for(unsigned int i = 0; i < num_rows; i++) {
+		for(unsigned int j = 0; j < num_cols; j++) {
+			if(m.elems[i][j]) {
+				printf(first ? "%s" : " %s", t.outputs.elems[i][j]);
+				first = false;
+			}
+		}
+	}
+	printf("\n");
+}
+
 void mife_eval_cleanup(const_mmap_vtable mmap, eval_inputs ins, f2_matrix m) {
-	mbp_template_stats *stats = ins.pp->mbp_params;
-	mbp_template *templ = (mbp_template *)stats->template;
-	mbp_template_stats_free(*stats); free(stats);
-	mbp_template_free(*templ); free(templ);
-	mife_clear_pp_read(mmap, ins.pp);
-	location_free(ins.database_location);
-	ciphertext_mapping_free(ins.mapping);
+	if(NULL != ins.batch && stdin != ins.batch) fclose(ins.batch);
+	evaluator_clear(mmap, &ins.ev);
+	location_free(ins.ev.database_location);
+	if(NULL == ins.batch) ciphertext_mapping_free(ins.mapping);
 	f2_matrix_free(m);
 }
@@ -0,0 +1,353 @@
+#include <getopt.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mife/mife.h>
+#include <gghlite/misc.h>
+
+#include "evaluator.h"
+#include "parse.h"
+#include "queue.h"
+#include "server.h"
+#include "util.h"
+
+/* how many of the most recent requests the latency percentiles cover */
+#define EVALD_LATENCY_WINDOW 4096
+
+typedef struct {
+	evaluator ev;
+	const char *socket_path;
+	unsigned int workers;
+	/* how many parsed requests may wait for a worker before readers block */
+	unsigned int backlog;
+} evald_inputs;
+
+/* a request waiting for, or being evaluated by, a worker */
+typedef struct {
+	server_conn *conn;
+	/* the request's line number on its connection, which tags the reply */
+	unsigned long id;
+	ciphertext_mapping mapping;
+	uint64_t received;
+} evald_job;
+
+typedef struct {
+	const mmap_vtable *mmap;
+	const evald_inputs *ins;
+	queue jobs;
+	pthread_mutex_t lock;
+	unsigned long served, failed;
+	uint64_t start;
+	/* a ring of the latest latencies, in microseconds */
+	uint64_t latencies[EVALD_LATENCY_WINDOW];
+	size_t latencies_len, latencies_next;
+} evald_server;
+
+void mife_evald_parse_cmdline(int argc, char **argv, evald_inputs *const ins, const mmap_vtable **mmap);
+bool mife_evald_serve(evald_server *const server);
+void mife_evald_print_stats(evald_server *const server, FILE *fp);
+
+int main(int argc, char **argv) {
+	evald_inputs ins;
+	evald_server server;
+	bool success;
+
+	const mmap_vtable *mmap;
+	mife_evald_parse_cmdline(argc, argv, &ins, &mmap);
+
+	server.mmap = mmap;
+	server.ins = &ins;
+	server.served = server.failed = 0;
+	server.latencies_len = server.latencies_next = 0;
+	server.start = ggh_walltime(0);
+	if(!queue_init(&server.jobs, ins.backlog)) {
+		fprintf(stderr, "%s: out of memory while creating the request queue\n", *argv);
+		return -1;
+	}
+	pthread_mutex_init(&server.lock, NULL);
+
+	success = mife_evald_serve(&server);
+
+	/* requests still in flight are dropped; workers may be using the
+	 * evaluator right up until exit, so it is left for the OS to reclaim */
+	mife_evald_print_stats(&server, stderr);
+	if(NULL != ins.ev.cache)
+		enc_cache_print_stats(ins.ev.cache, stderr);
+	if(NULL != ins.ev.results)
+		result_cache_print_stats(ins.ev.results, stderr);
+	return success ? 0 : -1;
+}
+
+static void mife_evald_usage(const int code) {
+	/* separate the diagnostic information from the usage information a little bit */
+	if(0 != code) printf("\n\n");
+	printf(
+		"USAGE: evald [OPTIONS] SOCKET\n"
+		"Loads the template and public parameters once, then answers evaluation\n"
+		"requests on the Unix domain socket SOCKET until interrupted.\n"
+		"\n"
+		"Each request is one line holding a mapping in the same JSON format eval\n"
+		"takes. Clients may send any number of requests without waiting for\n"
+		"replies. A pool of workers evaluates them concurrently, sharing a cache of\n"
+		"step matrices, and each reply is sent as soon as it is ready, so replies\n"
+		"can come back out of order. A reply is the request's line number on its\n"
+		"connection, a tab, and then either the strings for the non-zeros in the\n"
+		"result separated by spaces, or \"error\" and a description. For example,\n"
+		"    nc -U SOCKET < mappings\n"
+		"works like eval --batch mappings.\n"
+		"\n"
+		"The request \"stats\" is answered with the line \"stats\", a tab, and the\n"
+		"requests served and failed so far, the throughput since startup, and the\n"
+		"50th, 90th, and 99th percentile and maximum latency in milliseconds over\n"
+		"the last 4096 requests, measured from when the request was read.\n"
+		"\n"
+		"Brackets indicate default values for each argument.\n"
+		"\n"
+		"Common options:\n"
+		"  -h, --help               Display this usage information\n"
+		"  -u, --public             A directory for public parameters [public]\n"
+		"  -d, --db, --database     A directory to store encrypted values in [database]\n"
+		"  -C, --clt13              Use CLT13 as the underlying multilinear map\n"
+		"  -s, --sequential         Use a single worker\n"
+		"\n"
+		"Server-specific options:\n"
+		"  -w, --workers            How many requests to evaluate at a time [the\n"
+		"                           number of cores]\n"
+		"  -q, --queue              How many requests may wait for a worker before\n"
+		"                           the server stops reading more [256]\n"
+		"  -m, --cache              Keep up to this many MiB of step matrices in\n"
+		"                           memory; 0 disables the cache [1024]\n"
+		"  -R, --results            Remember results in <database>/results and\n"
+		"                           reuse them, in this run and later ones\n"
+		"\n"
+		"Files used:\n"
+		"  SOCKET                   RW  socket  created at startup, removed on exit\n"
+		"  <database>/<uid>/<position>/*.bin\n"
+		"                            R  binary  the encrypted records\n"
+		"  <database>/packed/*/*     R  binary  the encrypted records, if they were\n"
+		"                                       encrypted with --packed\n"
+		"  <database>/results       RW  binary  remembered results, with --results\n"
+		"  <public>/template.json    R  JSON    a description of the function being\n"
+		"                                       evaluated\n"
+		"  <public>/mife.pub         R  custom  public parameters for evaluating\n"
+		);
+	exit(code);
+}
+
+void mife_evald_parse_cmdline(int argc, char **argv, evald_inputs *const ins, const mmap_vtable **mmap) {
+	/* set defaults */
+	const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	evaluator_options opts;
+	evaluator_options_init(&ins->ev, &opts);
+	ins->workers = cores > 0 ? cores : 1;
+	ins->backlog = 256;
+
+	bool done = false;
+	struct option long_opts[] =
+		{ EVALUATOR_LONG_OPTIONS
+		, {"help"      ,       no_argument, NULL, 'h'}
+		, {"workers"   , required_argument, NULL, 'w'}
+		, {"queue"     , required_argument, NULL, 'q'}
+		, {NULL, 0, NULL, 0}
+		};
+
+	while(!done) {
+		int c = getopt_long(argc, argv, EVALUATOR_OPTSTRING "hq:w:", long_opts, NULL);
+		switch(c) {
+			case  -1: done = true; break;
+			case   0: break; /* a long option with non-NULL flag; should never happen */
+			case '?': mife_evald_usage(1); break; /* braking is good defensive driving */
+			case 'h': mife_evald_usage(0); break;
+			case 'q':
+				if(atoi(optarg) < 1) {
+					fprintf(stderr, "%s: unparseable queue length '%s', should be a positive number\n", *argv, optarg);
+					mife_evald_usage(2);
+				}
+				ins->backlog = atoi(optarg);
+				break;
+			case 'w':
+				if(atoi(optarg) < 1) {
+					fprintf(stderr, "%s: unparseable worker count '%s', should be a positive number\n", *argv, optarg);
+					mife_evald_usage(2);
+				}
+				ins->workers = atoi(optarg);
+				break;
+			default:
+				if(!evaluator_parse_option(&ins->ev, &opts, *argv, c, optarg, mife_evald_usage)) {
+					fprintf(stderr, "The impossible happened! getopt returned %d (%c)\n", c, c);
+					exit(-1);
+				}
+				break;
+		}
+	}
+	if(!g_parallel) ins->workers = 1;
+
+	*mmap = opts.mmap;
+
+	if(optind != argc-1) {
+		fprintf(stderr, "%s: specify exactly one socket (found %d)\n", *argv, argc-optind);
+		mife_evald_usage(2);
+	}
+	ins->socket_path = argv[optind];
+
+	/* read the template and public parameters */
+	int code = evaluator_load(opts.mmap, &ins->ev, opts.public_location);
+	if(code > 0) mife_evald_usage(code);
+	if(code < 0) exit(-1);
+
+	if(!evaluator_open_caches(&ins->ev, &opts)) exit(-1);
+}
+
+/* writes one reply line */
+static void mife_evald_reply(server_conn *const conn, const unsigned long id, const mbp_template *const t, const f2_matrix *const m, const char *const error) {
+	FILE *const out = server_reply_begin(conn);
+	fprintf(out, "%lu\t", id);
+	if(NULL != error)
+		fprintf(out, "error %s", error);
+	else {
+		bool first = true;
+		for(unsigned int i = 0; i < m->num_rows && i < t->outputs.num_rows; i++)
+			for(unsigned int j = 0; j < m->num_cols && j < t->outputs.num_cols; j++)
+				if(m->elems[i][j]) {
+					fprintf(out, first ? "%s" : " %s", t->outputs.elems[i][j]);
+					first = false;
+				}
+	}
+	fprintf(out, "\n");
+	server_reply_end(conn);
+}
+
+static void mife_evald_record(evald_server *const server, const uint64_t latency, const bool failed) {
+	pthread_mutex_lock(&server->lock);
+	if(failed) server->failed++;
+	else server->served++;
+	server->latencies[server->latencies_next] = latency;
+	server->latencies_next = (server->latencies_next + 1) % EVALD_LATENCY_WINDOW;
+	if(server->latencies_len < EVALD_LATENCY_WINDOW) server->latencies_len++;
+	pthread_mutex_unlock(&server->lock);
+}
+
+static int mife_evald_latency_cmp(const void *l, const void *r) {
+	const uint64_t a = *(const uint64_t *)l, b = *(const uint64_t *)r;
+	return a < b ? -1 : a > b;
+}
+
+void mife_evald_print_stats(evald_server *const server, FILE *fp) {
+	const double fractions[3] = { 0.50, 0.90, 0.99 };
+	double percentiles[4] = { 0, 0, 0, 0 };
+	uint64_t *sorted;
+	size_t n = 0;
+
+	/* percentiles are left at zero if there is no room to sort a copy */
+	const bool copied = !ALLOC_FAILS(sorted, EVALD_LATENCY_WINDOW);
+	pthread_mutex_lock(&server->lock);
+	const unsigned long served = server->served, failed = server->failed;
+	if(copied) {
+		n = server->latencies_len;
+		memcpy(sorted, server->latencies, n*sizeof(*sorted));
+	}
+	pthread_mutex_unlock(&server->lock);
+
+	if(n > 0) {
+		qsort(sorted, n, sizeof(*sorted), mife_evald_latency_cmp);
+		for(unsigned int k = 0; k < 3; k++)
+			percentiles[k] = sorted[(size_t)(fractions[k] * (n-1))] / 1000.0;
+		percentiles[3] = sorted[n-1] / 1000.0;
+	}
+	free(sorted);
+
+	const double seconds = ggh_seconds(ggh_walltime(server->start));
+	fprintf(fp, "served %lu failed %lu throughput %.2f/s p50 %.2fms p90 %.2fms p99 %.2fms max %.2fms\n",
+		served, failed, seconds > 0 ? (served + failed) / seconds : 0.0,
+		percentiles[0], percentiles[1], percentiles[2], percentiles[3]);
+}
+
+static void *mife_evald_worker(void *arg) {
+	evald_server *const server = arg;
+	const mbp_template *const template = evaluator_template(&server->ins->ev);
+	evald_job *job;
+
+	while(NULL != (job = queue_pop(&server->jobs))) {
+		f2_matrix result = evaluator_evaluate(server->mmap, &server->ins->ev, job->mapping);
+		const bool failed = NULL == result.elems;
+		mife_evald_reply(job->conn, job->id, template, &result, failed ? "evaluation failed" : NULL);
+		mife_evald_record(server, ggh_walltime(job->received), failed);
+		if(!failed) f2_matrix_free(result);
+		ciphertext_mapping_free(job->mapping);
+		server_conn_release(job->conn);
+		free(job);
+	}
+	return NULL;
+}
+
+/* answers stats requests and bad requests at once; everything else becomes
+ * a job for the workers */
+static void *mife_evald_parse(void *context, server_conn *conn, unsigned long id, char *line) {
+	evald_server *const server = context;
+	const uint64_t received = ggh_walltime(0);
+	evald_job *job;
+
+	if(!strcmp(line, "stats")) {
+		FILE *const out = server_reply_begin(conn);
+		fprintf(out, "stats\t");
+		mife_evald_print_stats(server, out);
+		server_reply_end(conn);
+		return NULL;
+	}
+
+	if(ALLOC_FAILS(job, 1)) {
+		mife_evald_reply(conn, id, NULL, NULL, "out of memory");
+		return NULL;
+	}
+	*job = (evald_job) { conn, id, { 0, NULL, NULL }, received };
+	if(!jsmn_parse_ciphertext_mapping_string(line, &job->mapping)) {
+		mife_evald_reply(conn, id, NULL, NULL, "could not parse mapping as JSON object with string values");
+		mife_evald_record(server, ggh_walltime(received), true);
+		free(job);
+		return NULL;
+	}
+	if(0 != evaluator_check_mapping(&server->ins->ev, job->mapping)) {
+		mife_evald_reply(conn, id, NULL, NULL, "mapping does not match the template");
+		mife_evald_record(server, ggh_walltime(received), true);
+		ciphertext_mapping_free(job->mapping);
+		free(job);
+		return NULL;
+	}
+	return job;
+}
+
+/* blocks when the queue is full, which holds back clients that get too far
+ * ahead */
+static void mife_evald_handle(void *context, void *job) {
+	evald_server *const server = context;
+	queue_push(&server->jobs, job);
+}
+
+/* accepts connections until SIGINT or SIGTERM; returns false if the server
+ * could not be started */
+bool mife_evald_serve(evald_server *const evald) {
+	const evald_inputs *const ins = evald->ins;
+	server s = { mife_evald_parse, mife_evald_handle, evald, ins->socket_path, false, -1 };
+	pthread_attr_t detached;
+	pthread_t worker;
+	unsigned int i;
+
+	if(!server_listen(&s)) return false;
+
+	pthread_attr_init(&detached);
+	pthread_attr_setdetachstate(&detached, PTHREAD_CREATE_DETACHED);
+	for(i = 0; i < ins->workers; i++)
+		if(0 != server_spawn(&worker, &detached, mife_evald_worker, evald)) {
+			fprintf(stderr, "could only start %u of %u workers\n", i, ins->workers);
+			break;
+		}
+	pthread_attr_destroy(&detached);
+	if(0 == i) {
+		server_unlisten(&s);
+		return false;
+	}
+
+	fprintf(stderr, "listening on %s with %u workers\n", ins->socket_path, i);
+	server_run(&s);
+	return true;
+}
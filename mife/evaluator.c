@@ -0,0 +1,601 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <mmap/mmap_clt.h>
+#include <mmap/mmap_gghlite.h>
+
+#include "cmdline.h"
+#include "evaluator.h"
+#include "parse.h"
+#include "queue.h"
+#include "store.h"
+
+/* a single evaluation in progress */
+typedef struct {
+	const_mmap_vtable mmap;
+	const evaluator *ev;
+	ciphertext_mapping mapping;
+	/* with a packed store, each position's record (indexed like
+	 * stats->positions), opened the first time it is needed */
+	store_view *views;
+	bool *views_opened;
+} evaluation;
+
+/* a step matrix, either owned by this evaluation or borrowed from the cache */
+typedef struct {
+	mmap_enc_mat_struct *m;
+	mmap_enc_mat_t own;
+	bool loaded;
+} eval_slot;
+
+/* state shared with the background thread that loads steps 1, 2, ... in
+ * order while the product so far is being computed */
+typedef struct {
+	evaluation *e;
+	eval_slot *slots;
+	queue ready;
+} eval_prefetcher;
+
+/* what the cache needs to load a step on a miss */
+typedef struct {
+	evaluation *e;
+	unsigned int global_index;
+} eval_miss;
+
+const mbp_template_stats *evaluator_stats   (const evaluator *const ev) { return ev->pp->mbp_params; }
+const mbp_template       *evaluator_template(const evaluator *const ev) { return evaluator_stats(ev)->template; }
+
+void evaluator_options_init(evaluator *const ev, evaluator_options *const opts) {
+	opts->public_location = (location) { "public", true };
+	opts->mmap = &gghlite_vtable;
+	opts->cache_budget = (size_t)1024 << 20;
+	opts->use_results = false;
+	ev->database_location = (location) { "database", true };
+	ev->prefetch = 0;
+	ev->parallel = false;
+	ev->tree = false;
+	ev->cache = NULL;
+	ev->results = NULL;
+	g_parallel = 1;
+}
+
+bool evaluator_parse_option(evaluator *const ev, evaluator_options *const opts, const char *const program, const int c, char *const arg, void (*usage)(int)) {
+	switch(c) {
+		case 'C': opts->mmap = &clt_vtable; break;
+		case 'd': ev->database_location = (location) { arg, true }; break;
+		case 'm':
+			if(atoi(arg) < 0) {
+				fprintf(stderr, "%s: unparseable cache size '%s', should be a non-negative number\n", program, arg);
+				usage(2);
+			}
+			opts->cache_budget = (size_t)atoi(arg) << 20;
+			break;
+		case 'R': opts->use_results = true; break;
+		case 's': g_parallel = 0; break;
+		case 'u': opts->public_location = (location) { arg, true }; break;
+		default: return false;
+	}
+	return true;
+}
+
+bool evaluator_open_caches(evaluator *const ev, const evaluator_options *const opts) {
+	if(opts->cache_budget > 0 && NULL == (ev->cache = enc_cache_new(opts->mmap, opts->cache_budget))) {
+		fprintf(stderr, "out of memory while creating the matrix cache\n");
+		return false;
+	}
+	if(opts->use_results && NULL == (ev->results = result_cache_open(ev->database_location, opts->public_location)))
+		return false;
+	return true;
+}
+
+int evaluator_load(const_mmap_vtable mmap, evaluator *const ev, const location public_location) {
+	/* read the template */
+	location template_location = location_append(public_location, "template.json");
+	mbp_template *template = NULL;
+	mbp_template_stats *stats = NULL;
+	if(template_location.path == NULL || ALLOC_FAILS(template, 1) || ALLOC_FAILS(stats, 1)) {
+		fprintf(stderr, "out of memory while loading template\n");
+		return -1;
+	}
+	if(!jsmn_parse_mbp_template_location(template_location, template)) {
+		fprintf(stderr, "could not parse '%s' as a\nJSON representation of a matrix branching program template over the field F_2\n", template_location.path);
+		return 4;
+	}
+	if(!mbp_template_to_mife_pp(ev->pp, template, stats)) {
+		fprintf(stderr, "internal error while computing statistics for template\n");
+		return -1;
+	}
+	location_free(template_location);
+
+	/* read the public parameters */
+	location pp_location = location_append(public_location, "mife.pub");
+	if(pp_location.path == NULL) {
+		fprintf(stderr, "out of memory while loading public parameters\n");
+		return -1;
+	}
+	/* TODO: some error-checking would be nice here */
+	fread_mife_pp(mmap, ev->pp, pp_location.path);
+	location_free(pp_location);
+
+	if(!evaluator_plan_outputs(ev)) {
+		fprintf(stderr, "out of memory while planning outputs\n");
+		return -1;
+	}
+	ev->packed = store_exists(ev->database_location);
+	return 0;
+}
+
+void evaluator_clear(const_mmap_vtable mmap, evaluator *const ev) {
+	mbp_template_stats *stats = ev->pp->mbp_params;
+	mbp_template *templ = (mbp_template *)stats->template;
+	if(NULL != ev->cache) enc_cache_free(ev->cache);
+	ev->cache = NULL;
+	if(NULL != ev->results) result_cache_free(ev->results);
+	ev->results = NULL;
+	evaluator_clear_outputs(ev);
+	mbp_template_stats_free(*stats); free(stats);
+	mbp_template_free(*templ); free(templ);
+	mife_clear_pp_read(mmap, ev->pp);
+}
+
+int evaluator_check_mapping(const evaluator *const ev, const ciphertext_mapping mapping) {
+	const mbp_template_stats *const stats = evaluator_stats(ev);
+
+	/* sanity check: are all and only the necessary positions specified in the
+	 * mapping? */
+	if(stats->positions_len != mapping.positions_len) {
+		fprintf(stderr, "arity mismatch:\n"
+		                "\tfunction template from public parameters expects %u arguments,\n"
+		                "\tmapping specifies %u arguments\n"
+		              , stats->positions_len, mapping.positions_len);
+		return 5;
+	}
+	bool position_missing = false;
+	for(unsigned int i = 0; i < stats->positions_len; i++) {
+		if(NULL == uid_from_position(mapping, stats->positions[i])) {
+			fprintf(stderr, "no mapping for position %s\n", stats->positions[i]);
+			position_missing = true;
+		}
+	}
+	return position_missing ? 6 : 0;
+}
+
+/* Everything downstream indexes steps by the template's dimensions, so a
+ * record encrypted for another template, or a damaged one, is caught here,
+ * before it is cached or multiplied. */
+static bool evaluation_check_step(const evaluator *const ev, const unsigned int global_index, const mmap_enc_mat_struct *const m) {
+	const mbp_template *const template = evaluator_template(ev);
+	const mbp_step *const step = template->steps + global_index;
+
+	if(step->symbols_len > 0 &&
+	   (m->nrows != (int)step->matrix[0].num_rows || m->ncols != (int)step->matrix[0].num_cols)) {
+		fprintf(stderr, "step %u is %dx%d, but the template's is %ux%u\n",
+		        global_index, m->nrows, m->ncols, step->matrix[0].num_rows, step->matrix[0].num_cols);
+		return false;
+	}
+	if(0 == global_index && ev->rows_len > 0 && (int)ev->rows[ev->rows_len-1] >= m->nrows) {
+		fprintf(stderr, "step 0 has %d rows, but the template labels row %u\n", m->nrows, ev->rows[ev->rows_len-1]);
+		return false;
+	}
+	if(global_index+1 == template->steps_len && ev->cols_len > 0 && (int)ev->cols[ev->cols_len-1] >= m->ncols) {
+		fprintf(stderr, "step %u has %d columns, but the template labels column %u\n", global_index, m->ncols, ev->cols[ev->cols_len-1]);
+		return false;
+	}
+	return true;
+}
+
+static bool evaluation_read_matrix(evaluation *const e, const unsigned int global_index, mmap_enc_mat_t out_m, size_t *const bytes) {
+	const mbp_template_stats *const stats = evaluator_stats(e->ev);
+	const int local_index      = stats->local_index[global_index];
+	const int position_index   = stats->position_index[global_index];
+	const char *const position = stats->positions[position_index];
+	const char *const uid      = uid_from_position(e->mapping, position);
+	const char *const db_path  = e->ev->database_location.path;
+	bool result = false;
+	struct stat st;
+	char *path;
+
+	if(NULL != e->views) {
+		if(!e->views_opened[position_index]) {
+			store_open(e->ev->database_location, uid, e->views + position_index);
+			e->views_opened[position_index] = true;
+		}
+		if(NULL != e->views[position_index].data) {
+			*bytes = store_view_step_size(e->views + position_index, global_index);
+			if(!store_view_load(e->mmap, e->views + position_index, global_index, out_m)) return false;
+			if(evaluation_check_step(e->ev, global_index, out_m)) return true;
+			fprintf(stderr, "\tin the packed record %s\n", uid);
+			mmap_enc_mat_clear(e->mmap, out_m);
+			return false;
+		}
+	}
+
+	const int path_len  = snprintf(NULL, 0, "%s/%s/%s/%d.bin", db_path, uid, position, local_index);
+	const int path_size = path_len+1;
+	if(ALLOC_FAILS(path, path_size)) {
+		fprintf(stderr, "out of memory trying to construct path:\n\t%s/%s/%s/%d.bin\n", db_path, uid, position, local_index);
+		goto done;
+	}
+
+	int tmp = snprintf(path, path_size, "%s/%s/%s/%d.bin", db_path, uid, position, local_index);
+	if(tmp != path_len) {
+		fprintf(stderr, "The impossible happened: snprintf produced strings of two different lengths on two calls with all the same arguments.\n\t(%d first time, %d second)\n", path_len, tmp);
+		goto free_path;
+	}
+
+	/* the size on disk is a fine proxy for the size in memory */
+	*bytes = 0 == stat(path, &st) ? (size_t)st.st_size : 0;
+	result = fread_mmap_enc_mat_path(e->mmap, out_m, global_index, path);
+	if(result && !evaluation_check_step(e->ev, global_index, out_m)) {
+		mmap_enc_mat_clear(e->mmap, out_m);
+		result = false;
+	}
+	if(!result)
+		fprintf(stderr, "Could not load ciphertext chunk at location\n\t%s\n", path);
+
+free_path:
+	free(path);
+done:
+	return result;
+}
+
+static bool evaluation_cache_miss(void *context, mmap_enc_mat_t m, size_t *bytes) {
+	eval_miss *const miss = context;
+	return evaluation_read_matrix(miss->e, miss->global_index, m, bytes);
+}
+
+static void evaluation_load(evaluation *const e, const unsigned int global_index, eval_slot *const slot) {
+	const mbp_template_stats *const stats = evaluator_stats(e->ev);
+	size_t bytes;
+
+	if(NULL == e->ev->cache) {
+		slot->m = slot->own;
+		slot->loaded = evaluation_read_matrix(e, global_index, slot->own, &bytes);
+		return;
+	}
+
+	/* a step is identified by its record, position, and index within the
+	 * position; tabs can't appear in positions */
+	const char *const position = stats->positions[stats->position_index[global_index]];
+	const char *const uid      = uid_from_position(e->mapping, position);
+	const int local_index      = stats->local_index[global_index];
+	const int key_len = snprintf(NULL, 0, "%s\t%s\t%d", uid, position, local_index);
+	eval_miss miss = { e, global_index };
+	char *key;
+
+	slot->m = NULL;
+	if(!ALLOC_FAILS(key, key_len+1)) {
+		snprintf(key, key_len+1, "%s\t%s\t%d", uid, position, local_index);
+		slot->m = enc_cache_acquire(e->ev->cache, key, evaluation_cache_miss, &miss);
+		free(key);
+	}
+	slot->loaded = NULL != slot->m;
+}
+
+static void evaluation_unload(evaluation *const e, eval_slot *const slot) {
+	if(!slot->loaded) return;
+	if(NULL == e->ev->cache)
+		mmap_enc_mat_clear(e->mmap, slot->own);
+	else
+		enc_cache_release(e->ev->cache, slot->m);
+	slot->loaded = false;
+}
+
+/* dest = src restricted to the given rows and columns; NULL means all of them */
+static void mmap_enc_mat_init_select(const_mmap_vtable mmap, const mmap_pp *const params, mmap_enc_mat_t dest, const mmap_enc_mat_struct *const src, const unsigned int *const rows, const int nrows, const unsigned int *const cols, const int ncols) {
+	mmap_enc_mat_init(mmap, params, dest, nrows, ncols);
+	for(int i = 0; i < nrows; i++)
+		for(int j = 0; j < ncols; j++)
+			mmap->enc->set(dest->m[i][j], src->m[NULL == rows ? i : (int)rows[i]][NULL == cols ? j : (int)cols[j]]);
+}
+
+/* whether the first (respectively last) step has rows (columns) that lead only
+ * to unlabelled outputs */
+static bool evaluator_drops_rows(const evaluator *const ev) { return ev->rows_len < ev->wanted.num_rows; }
+static bool evaluator_drops_cols(const evaluator *const ev) { return ev->cols_len < ev->wanted.num_cols; }
+
+bool evaluator_plan_outputs(evaluator *const ev) {
+	const string_matrix outputs = evaluator_template(ev)->outputs;
+	unsigned int i, j;
+
+	ev->rows = ev->cols = NULL;
+	ev->rows_len = ev->cols_len = 0;
+	if(!f2_matrix_zero(&ev->wanted, outputs.num_rows, outputs.num_cols) ||
+	   ALLOC_FAILS(ev->rows, outputs.num_rows) ||
+	   ALLOC_FAILS(ev->cols, outputs.num_cols)) {
+		evaluator_clear_outputs(ev);
+		return false;
+	}
+
+	for(i = 0; i < outputs.num_rows; i++)
+		for(j = 0; j < outputs.num_cols; j++)
+			ev->wanted.elems[i][j] = '\0' != outputs.elems[i][j][0];
+
+	for(i = 0; i < outputs.num_rows; i++) {
+		for(j = 0; j < outputs.num_cols && !ev->wanted.elems[i][j]; j++);
+		if(j < outputs.num_cols) ev->rows[ev->rows_len++] = i;
+	}
+	for(j = 0; j < outputs.num_cols; j++) {
+		for(i = 0; i < outputs.num_rows && !ev->wanted.elems[i][j]; i++);
+		if(i < outputs.num_rows) ev->cols[ev->cols_len++] = j;
+	}
+	return true;
+}
+
+void evaluator_clear_outputs(evaluator *const ev) {
+	f2_matrix_free(ev->wanted);
+	ev->wanted.elems = NULL;
+	free(ev->rows);
+	free(ev->cols);
+	ev->rows = ev->cols = NULL;
+}
+
+static void *evaluation_prefetch_run(void *context) {
+	eval_prefetcher *const p = context;
+	const unsigned int steps_len = evaluator_template(p->e->ev)->steps_len;
+	for(unsigned int i = 1; i < steps_len; i++) {
+		evaluation_load(p->e, i, p->slots + i);
+		queue_push(&p->ready, p->slots + i);
+		if(!p->slots[i].loaded) break;
+	}
+	queue_close(&p->ready);
+	return NULL;
+}
+
+/* evaluator_evaluate for ev->tree */
+static f2_matrix evaluation_tree(evaluation *const e) {
+	f2_matrix result = { .num_rows = 0, .num_cols = 0, .elems = NULL };
+	const mbp_template_stats *const stats = evaluator_stats(e->ev);
+	const unsigned int steps_len = stats->template->steps_len;
+	eval_slot *slots = NULL;
+	mmap_enc_mat_struct **mats = NULL;
+	int *dims = NULL;
+	mife_chain_plan plan;
+	mmap_enc_mat_t product, first, last;
+	bool loaded = true, have_first = false, have_last = false;
+	unsigned int i;
+
+	if(ALLOC_FAILS(slots, steps_len) || ALLOC_FAILS(mats, steps_len) || ALLOC_FAILS(dims, steps_len+1)) {
+		fprintf(stderr, "out of memory while planning evaluation\n");
+		goto free_arrays;
+	}
+
+	/* with every record opened in advance, the steps can all load at once */
+	if(NULL != e->views)
+		for(i = 0; i < stats->positions_len; i++) {
+			store_open(e->ev->database_location, uid_from_position(e->mapping, stats->positions[i]), e->views + i);
+			e->views_opened[i] = true;
+		}
+
+#pragma omp parallel for schedule(dynamic,1) if(e->ev->parallel)
+	for(i = 0; i < steps_len; i++)
+		evaluation_load(e, i, slots + i);
+
+	for(i = 0; i < steps_len; i++) {
+		loaded = loaded && slots[i].loaded;
+		if(!loaded) continue;
+		mats[i] = slots[i].m;
+		dims[i] = mats[i]->nrows;
+		if(i > 0 && mats[i-1]->ncols != dims[i]) {
+			fprintf(stderr, "step %u is %dx%d, which does not follow a step with %d columns\n", i, mats[i]->nrows, mats[i]->ncols, mats[i-1]->ncols);
+			loaded = false;
+		}
+	}
+	if(!loaded) goto unload;
+
+	/* rows and columns that can't reach a labelled output are dropped before
+	 * planning, which also makes the plan cheaper */
+	if(evaluator_drops_rows(e->ev) || (1 == steps_len && evaluator_drops_cols(e->ev))) {
+		mmap_enc_mat_init_select(e->mmap, e->ev->pp->params_ref, first, mats[0],
+			e->ev->rows, e->ev->rows_len,
+			1 == steps_len ? e->ev->cols : NULL, 1 == steps_len ? (int)e->ev->cols_len : mats[0]->ncols);
+		mats[0] = first;
+		have_first = true;
+	}
+	if(steps_len > 1 && evaluator_drops_cols(e->ev)) {
+		mmap_enc_mat_init_select(e->mmap, e->ev->pp->params_ref, last, mats[steps_len-1],
+			NULL, mats[steps_len-1]->nrows, e->ev->cols, e->ev->cols_len);
+		mats[steps_len-1] = last;
+		have_last = true;
+	}
+	dims[0] = mats[0]->nrows;
+	dims[steps_len] = mats[steps_len-1]->ncols;
+
+	if(!mife_chain_plan_init(&plan, steps_len, dims)) {
+		fprintf(stderr, "out of memory while planning evaluation\n");
+		goto unload;
+	}
+	mife_chain_mul(e->mmap, e->ev->pp->params_ref, &plan, mats, product);
+	mife_chain_plan_clear(&plan);
+
+	result = mife_zt_select(e->mmap, e->ev->pp, product, e->ev->wanted, e->ev->rows, e->ev->cols, stats->template->single_output);
+	mmap_enc_mat_clear(e->mmap, product);
+unload:
+	if(have_first) mmap_enc_mat_clear(e->mmap, first);
+	if(have_last) mmap_enc_mat_clear(e->mmap, last);
+	for(i = 0; i < steps_len; i++)
+		evaluation_unload(e, slots + i);
+free_arrays:
+	free(slots);
+	free(mats);
+	free(dims);
+	return result;
+}
+
+static f2_matrix evaluation_run(const_mmap_vtable mmap, const evaluator *const ev, const ciphertext_mapping mapping) {
+	f2_matrix result = { .num_rows = 0, .num_cols = 0, .elems = NULL };
+	const mbp_template_stats *const stats = evaluator_stats(ev);
+	const mbp_template *const template = stats->template;
+	evaluation e = { mmap, ev, mapping, NULL, NULL };
+	eval_prefetcher prefetcher = { .e = &e, .slots = NULL };
+	eval_slot first, inline_slot, *slot;
+	pthread_t prefetch_thread;
+	bool prefetching = false;
+	mmap_enc_mat_t product;
+	unsigned int i;
+
+	/* if there are no steps to evaluate, I guess we're done */
+	if(template->steps_len < 1) goto done;
+
+	if(ev->packed &&
+	   (NULL == (e.views        = calloc(stats->positions_len, sizeof(*e.views       ))) ||
+	    NULL == (e.views_opened = calloc(stats->positions_len, sizeof(*e.views_opened))))) {
+		fprintf(stderr, "out of memory while opening records\n");
+		goto close_views;
+	}
+
+	if(ev->tree) {
+		result = evaluation_tree(&e);
+		goto close_views;
+	}
+
+	/* a cached matrix must not be clobbered by the in-place products, so
+	 * start from a copy of it; the copy also drops any rows that can't reach
+	 * a labelled output */
+	evaluation_load(&e, 0, &first);
+	if(!first.loaded) goto close_views;
+	if(NULL == ev->cache && !evaluator_drops_rows(ev) && (template->steps_len > 1 || !evaluator_drops_cols(ev)))
+		*product = *first.own;
+	else {
+		mmap_enc_mat_init_select(mmap, ev->pp->params_ref, product, first.m,
+			ev->rows, ev->rows_len,
+			template->steps_len > 1 ? NULL : ev->cols, template->steps_len > 1 ? first.m->ncols : (int)ev->cols_len);
+		evaluation_unload(&e, &first);
+	}
+
+	/* step 0 is loaded before the prefetcher starts, so that only one thread
+	 * at a time ever loads; the queue's capacity is what bounds how far ahead
+	 * the prefetcher gets; if any of this fails, just load everything inline */
+	if(ev->prefetch > 0 && template->steps_len > 1 &&
+	   !ALLOC_FAILS(prefetcher.slots, template->steps_len) &&
+	   queue_init(&prefetcher.ready, ev->prefetch)) {
+		prefetching = 0 == pthread_create(&prefetch_thread, NULL, evaluation_prefetch_run, &prefetcher);
+		if(!prefetching) queue_clear(&prefetcher.ready);
+	}
+
+	for(i = 1; i < template->steps_len; i++) {
+		if(prefetching)
+			slot = queue_pop(&prefetcher.ready);
+		else {
+			slot = &inline_slot;
+			evaluation_load(&e, i, slot);
+		}
+		if(!slot->loaded) goto clear_product;
+		if(product->ncols != slot->m->nrows) {
+			fprintf(stderr, "step %u is %dx%d, which does not follow a product with %d columns\n", i, slot->m->nrows, slot->m->ncols, product->ncols);
+			evaluation_unload(&e, slot);
+			goto clear_product;
+		}
+		if(i+1 == template->steps_len && evaluator_drops_cols(ev)) {
+			/* the last product needs only the labelled columns */
+			mmap_enc_mat_t last, next;
+			mmap_enc_mat_init_select(mmap, ev->pp->params_ref, last, slot->m, NULL, slot->m->nrows, ev->cols, ev->cols_len);
+			mmap_enc_mat_init(mmap, ev->pp->params_ref, next, product->nrows, last->ncols);
+			if(ev->parallel)
+				mmap_enc_mat_mul_par(mmap, ev->pp->params_ref, next, product, last);
+			else
+				mmap_enc_mat_mul(mmap, ev->pp->params_ref, next, product, last);
+			mmap_enc_mat_clear(mmap, last);
+			mmap_enc_mat_clear(mmap, product);
+			*product = *next;
+		}
+		else if(ev->parallel)
+			mmap_enc_mat_mul_par(mmap, ev->pp->params_ref, product, product, slot->m);
+		else
+			mmap_enc_mat_mul(mmap, ev->pp->params_ref, product, product, slot->m);
+		evaluation_unload(&e, slot);
+	}
+
+	result = mife_zt_select(mmap, ev->pp, product, ev->wanted, ev->rows, ev->cols, template->single_output);
+clear_product:
+	mmap_enc_mat_clear(mmap, product);
+	if(prefetching) {
+		/* after a failure, there may be loaded matrices nobody will use */
+		while(NULL != (slot = queue_pop(&prefetcher.ready)))
+			evaluation_unload(&e, slot);
+		pthread_join(prefetch_thread, NULL);
+		queue_clear(&prefetcher.ready);
+	}
+	free(prefetcher.slots);
+close_views:
+	if(NULL != e.views)
+		for(i = 0; i < stats->positions_len; i++)
+			store_close(e.views + i);
+	free(e.views);
+	free(e.views_opened);
+done:
+	return result;
+}
+
+f2_matrix evaluator_evaluate(const_mmap_vtable mmap, const evaluator *const ev, const ciphertext_mapping mapping) {
+	result_cache_key key;
+	f2_matrix result;
+
+	/* a record missing from the database has no key, and can't be evaluated
+	 * anyway */
+	if(NULL == ev->results || !result_cache_key_of(ev->results, ev->database_location, mapping, &key))
+		return evaluation_run(mmap, ev, mapping);
+	if(result_cache_lookup(ev->results, &key, &result))
+		return result;
+	result = evaluation_run(mmap, ev, mapping);
+	if(NULL != result.elems)
+		result_cache_insert(ev->results, &key, result);
+	return result;
+}
+
+struct evaluator_pin {
+	const mmap_vtable *mmap;
+	unsigned int slots_len;
+	eval_slot *slots;
+};
+
+evaluator_pin *evaluator_pin_record(const_mmap_vtable mmap, const evaluator *const ev, const char *const position, const char *const uid) {
+	const mbp_template_stats *const stats = evaluator_stats(ev);
+	const unsigned int steps_len = stats->template->steps_len;
+	char *positions[1] = { (char *)position }, *uids[1] = { (char *)uid };
+	evaluation e = { mmap, ev, { 1, positions, uids }, NULL, NULL };
+	evaluator_pin *pin;
+	bool success = true;
+	unsigned int i;
+
+	if(NULL == (pin = calloc(1, sizeof(*pin)))) return NULL;
+	pin->mmap = mmap;
+	if(NULL == ev->cache) return pin;
+
+	pin->slots_len = steps_len;
+	if(NULL == (pin->slots = calloc(steps_len, sizeof(*pin->slots))) ||
+	   (ev->packed &&
+	    (NULL == (e.views        = calloc(stats->positions_len, sizeof(*e.views       ))) ||
+	     NULL == (e.views_opened = calloc(stats->positions_len, sizeof(*e.views_opened)))))) {
+		fprintf(stderr, "out of memory while pinning record %s\n", uid);
+		success = false;
+	}
+
+	for(i = 0; success && i < steps_len; i++) {
+		if(strcmp(stats->positions[stats->position_index[i]], position)) continue;
+		evaluation_load(&e, i, pin->slots + i);
+		success = pin->slots[i].loaded;
+	}
+
+	if(NULL != e.views)
+		for(i = 0; i < stats->positions_len; i++)
+			store_close(e.views + i);
+	free(e.views);
+	free(e.views_opened);
+	if(!success) {
+		evaluator_unpin_record(ev, pin);
+		pin = NULL;
+	}
+	return pin;
+}
+
+void evaluator_unpin_record(const evaluator *const ev, evaluator_pin *const pin) {
+	evaluation e = { pin->mmap, ev, { 0, NULL, NULL }, NULL, NULL };
+	if(NULL != pin->slots)
+		for(unsigned int i = 0; i < pin->slots_len; i++)
+			evaluation_unload(&e, pin->slots + i);
+	free(pin->slots);
+	free(pin);
+}
@@ -0,0 +1,106 @@
+#ifndef _MIFE_EVALUATOR_H
+#define _MIFE_EVALUATOR_H
+
+#include "enc_cache.h"
+#include "mbp_glue.h"
+#include "mbp_types.h"
+#include "mife.h"
+#include "result_cache.h"
+#include "util.h"
+
+/* everything about evaluation that can be shared across mappings; nothing in
+ * here is modified by evaluating, so one evaluator can serve many threads */
+typedef struct {
+	mife_pp_t pp;
+	location database_location;
+	/* how many step matrices to load ahead of the multiplication; 0 loads
+	 * each one only when it is needed */
+	unsigned int prefetch;
+	/* whether to parallelize each matrix multiplication */
+	bool parallel;
+	/* whether to load every step up front and multiply them in the cheapest
+	 * association order, concurrently where possible, instead of streaming
+	 * them through a left-to-right product; prefetch is ignored if so */
+	bool tree;
+	/* whether the database has a packed store (see store.h) */
+	bool packed;
+	/* step matrices shared across evaluations, or NULL for no caching */
+	enc_cache *cache;
+	/* results remembered across evaluations and runs, or NULL to always
+	 * evaluate */
+	result_cache *results;
+	/* which entries of the product have labels (see mbp_types.h), and the
+	 * rows and columns of the product they lie in, in increasing order;
+	 * filled in by evaluator_plan_outputs */
+	f2_matrix wanted;
+	unsigned int *rows, rows_len, *cols, cols_len;
+} evaluator;
+
+/* The options shared by the tools that run many evaluations at once against
+ * one evaluator: -C, -d, -m, -R, -s and -u, with the long forms listed in
+ * EVALUATOR_LONG_OPTIONS. */
+typedef struct {
+	location public_location;
+	const mmap_vtable *mmap;
+	/* how much memory to spend caching step matrices */
+	size_t cache_budget;
+	bool use_results;
+} evaluator_options;
+
+#define EVALUATOR_OPTSTRING "Cd:m:Rsu:"
+#define EVALUATOR_LONG_OPTIONS \
+	  {"db"        , required_argument, NULL, 'd'} \
+	, {"database"  , required_argument, NULL, 'd'} \
+	, {"public"    , required_argument, NULL, 'u'} \
+	, {"clt"       ,       no_argument, NULL, 'C'} \
+	, {"sequential",       no_argument, NULL, 's'} \
+	, {"cache"     , required_argument, NULL, 'm'} \
+	, {"results"   ,       no_argument, NULL, 'R'}
+
+/* sets the defaults for the shared options, and readies ev for
+ * evaluator_load with neither caches nor parallelism within an evaluation */
+void evaluator_options_init(evaluator *const ev, evaluator_options *const opts);
+/* handles c if it is one of the shared options, calling usage(2) if its
+ * argument is bad; returns false if c is some other option */
+bool evaluator_parse_option(evaluator *const ev, evaluator_options *const opts, const char *const program, const int c, char *const arg, void (*usage)(int));
+/* Sets up the caches the options ask for, once evaluator_load has succeeded.
+ * These tools run their evaluations concurrently, so each evaluation gets a
+ * single thread and they all share the caches. Returns false (after saying
+ * why on stderr) on failure. */
+bool evaluator_open_caches(evaluator *const ev, const evaluator_options *const opts);
+
+const mbp_template_stats *evaluator_stats   (const evaluator *const ev);
+const mbp_template       *evaluator_template(const evaluator *const ev);
+
+/* Fills in pp from <public>/template.json and <public>/mife.pub, and packed
+ * and the output plan from those and database_location. Returns 0 on success;
+ * otherwise describes the problem on stderr and returns a positive error code
+ * for bad input or -1 for internal failures. */
+int  evaluator_load(const_mmap_vtable mmap, evaluator *const ev, const location public_location);
+/* frees everything evaluator_load allocated, and the caches if there are any;
+ * database_location is left to the caller */
+void evaluator_clear(const_mmap_vtable mmap, evaluator *const ev);
+
+/* work out which parts of the product are worth computing from the template
+ * in pp; returns false if out of memory */
+bool evaluator_plan_outputs(evaluator *const ev);
+void evaluator_clear_outputs(evaluator *const ev);
+
+/* returns 0 if all and only the template's positions are mapped, or (after
+ * describing the problem on stderr) a positive error code otherwise */
+int evaluator_check_mapping(const evaluator *const ev, const ciphertext_mapping mapping);
+/* the zero-test of the product of the mapped step matrices, restricted to the
+ * labelled entries (and to the first non-zero among them, for single-output
+ * templates), or the same answer from ev->results; on failure, the elems field
+ * of the result is NULL */
+f2_matrix evaluator_evaluate(const_mmap_vtable mmap, const evaluator *const ev, const ciphertext_mapping mapping);
+
+/* Loads every step of the record uid in the given position into ev->cache and
+ * holds it there, so that evaluations sharing that record never reload it,
+ * however busy the cache gets. Does nothing without a cache. Returns NULL if
+ * the record could not be loaded. */
+typedef struct evaluator_pin evaluator_pin;
+evaluator_pin *evaluator_pin_record(const_mmap_vtable mmap, const evaluator *const ev, const char *const position, const char *const uid);
+void evaluator_unpin_record(const evaluator *const ev, evaluator_pin *const pin);
+
+#endif /* ifndef _MIFE_EVALUATOR_H */
@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "f2_bitmat.h"
+#include "util.h"
+
+#define F2_WORD_BITS 64
+
+bool f2_bitmat_init(f2_bitmat *const m, const unsigned int num_rows, const unsigned int num_cols) {
+  m->num_rows = num_rows;
+  m->num_cols = num_cols;
+  m->row_words = (num_cols + F2_WORD_BITS - 1) / F2_WORD_BITS;
+  /* calloc(0, ...) may return NULL, so always ask for at least a word */
+  m->bits = calloc((size_t)num_rows * m->row_words + 1, sizeof(*m->bits));
+  return NULL != m->bits;
+}
+
+void f2_bitmat_free(f2_bitmat m) {
+  free(m.bits);
+}
+
+bool f2_bitmat_from_matrix(f2_bitmat *const dest, const f2_matrix src) {
+  if(!f2_bitmat_init(dest, src.num_rows, src.num_cols)) return false;
+  for(unsigned int i = 0; i < src.num_rows; i++)
+    for(unsigned int j = 0; j < src.num_cols; j++)
+      if(src.elems[i][j]) f2_bitmat_set(dest, i, j, true);
+  return true;
+}
+
+bool f2_bitmat_to_matrix(f2_matrix *const dest, const f2_bitmat src) {
+  if(!f2_matrix_zero(dest, src.num_rows, src.num_cols)) return false;
+  for(unsigned int i = 0; i < src.num_rows; i++)
+    for(unsigned int j = 0; j < src.num_cols; j++)
+      dest->elems[i][j] = f2_bitmat_get(&src, i, j);
+  return true;
+}
+
+bool f2_bitmat_get(const f2_bitmat *const m, const unsigned int i, const unsigned int j) {
+  return (m->bits[(size_t)i*m->row_words + j/F2_WORD_BITS] >> (j%F2_WORD_BITS)) & 1;
+}
+
+void f2_bitmat_set(f2_bitmat *const m, const unsigned int i, const unsigned int j, const bool b) {
+  uint64_t *const word = m->bits + (size_t)i*m->row_words + j/F2_WORD_BITS;
+  const uint64_t bit = (uint64_t)1 << (j%F2_WORD_BITS);
+  *word = b ? *word | bit : *word & ~bit;
+}
+
+bool f2_bitmat_is_zero(const f2_bitmat *const m) {
+  const size_t len = (size_t)m->num_rows * m->row_words;
+  uint64_t acc = 0;
+  for(size_t k = 0; k < len; k++)
+    acc |= m->bits[k];
+  return 0 == acc;
+}
+
+/* row ^= src, over whole words; restrict lets the compiler use vector
+ * registers for this */
+static void f2_bitmat_row_xor(uint64_t *restrict row, const uint64_t *restrict src, const unsigned int words) {
+  for(unsigned int w = 0; w < words; w++)
+    row[w] ^= src[w];
+}
+
+void f2_bitmat_mul(f2_bitmat *const dest, const f2_bitmat *const a, const f2_bitmat *const b) {
+  memset(dest->bits, 0, (size_t)dest->num_rows * dest->row_words * sizeof(*dest->bits));
+  for(unsigned int i = 0; i < a->num_rows; i++) {
+    uint64_t *const row = dest->bits + (size_t)i*dest->row_words;
+    const uint64_t *const a_row = a->bits + (size_t)i*a->row_words;
+    /* visit only the set bits of a's row; branching programs' matrices are
+     * mostly zeros */
+    for(unsigned int w = 0; w < a->row_words; w++) {
+      uint64_t word = a_row[w];
+      while(0 != word) {
+        const unsigned int k = w*F2_WORD_BITS + __builtin_ctzll(word);
+        f2_bitmat_row_xor(row, b->bits + (size_t)k*b->row_words, b->row_words);
+        word &= word - 1;
+      }
+    }
+  }
+}
@@ -0,0 +1,33 @@
+#ifndef _MIFE_F2_BITMAT_H
+#define _MIFE_F2_BITMAT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mbp_types.h"
+
+/* A bit-packed matrix over F_2, for when f2_matrix is too slow: each row is
+ * row_words 64-bit words, bit j%64 of word j/64 holding column j, and all the
+ * rows sit in one allocation. Bits past num_cols are always zero. */
+typedef struct {
+  unsigned int num_rows, num_cols, row_words;
+  uint64_t *bits;
+} f2_bitmat;
+
+/* all zeros */
+bool f2_bitmat_init(f2_bitmat *const m, const unsigned int num_rows, const unsigned int num_cols);
+void f2_bitmat_free(f2_bitmat m);
+bool f2_bitmat_from_matrix(f2_bitmat *const dest, const f2_matrix src);
+bool f2_bitmat_to_matrix(f2_matrix *const dest, const f2_bitmat src);
+
+bool f2_bitmat_get(const f2_bitmat *const m, const unsigned int i, const unsigned int j);
+void f2_bitmat_set(f2_bitmat *const m, const unsigned int i, const unsigned int j, const bool b);
+bool f2_bitmat_is_zero(const f2_bitmat *const m);
+
+/* dest = a * b, where dest is already initialized to a->num_rows by
+ * b->num_cols and is neither a nor b. Each set bit of a adds a whole row of
+ * b, a word at a time, in a loop simple enough for the compiler to
+ * vectorize; no allocation happens. */
+void f2_bitmat_mul(f2_bitmat *const dest, const f2_bitmat *const a, const f2_bitmat *const b);
+
+#endif /* ifndef _MIFE_F2_BITMAT_H */
@@ -0,0 +1,245 @@
+#include <getopt.h>
+#include <string.h>
+
+#include <mife/mife.h>
+
+#include "compare.h"
+#include "evaluator.h"
+#include "order_index.h"
+#include "util.h"
+
+typedef enum { INDEX_ADD, INDEX_RANGE, INDEX_LIST } index_command;
+
+typedef struct {
+	evaluator ev;
+	index_command command;
+	/* which index under <database>/index to use */
+	const char *name;
+	/* the positions the two sides of a comparison go in; NULL for default */
+	const char *left, *right;
+	/* the output label that means the left record sorts first */
+	const char *less;
+	/* for add, where to read new uids from; for range, the two bounds */
+	FILE *input;
+	const char *lo, *hi;
+} index_inputs;
+
+void mife_index_parse_cmdline(int argc, char **argv, index_inputs *const ins, const mmap_vtable **mmap);
+bool mife_index_add(const index_inputs *const ins, comparator *const c);
+bool mife_index_range(const index_inputs *const ins, comparator *const c);
+bool mife_index_list(const index_inputs *const ins, comparator *const c);
+void mife_index_cleanup(const_mmap_vtable mmap, index_inputs ins);
+
+int main(int argc, char **argv) {
+	index_inputs ins;
+	comparator *c;
+	bool success = false;
+
+	const mmap_vtable *mmap;
+	mife_index_parse_cmdline(argc, argv, &ins, &mmap);
+
+	if(NULL != (c = comparator_new(mmap, &ins.ev, ins.left, ins.right, ins.less))) {
+		switch(ins.command) {
+			case INDEX_ADD:   success = mife_index_add  (&ins, c); break;
+			case INDEX_RANGE: success = mife_index_range(&ins, c); break;
+			case INDEX_LIST:  success = mife_index_list (&ins, c); break;
+		}
+		if(INDEX_LIST != ins.command)
+			comparator_print_stats(c, stderr);
+		if(NULL != ins.ev.results)
+			result_cache_print_stats(ins.ev.results, stderr);
+		comparator_free(c);
+	}
+
+	mife_index_cleanup(mmap, ins);
+	return success ? 0 : -1;
+}
+
+static void mife_index_usage(const int code) {
+	/* separate the diagnostic information from the usage information a little bit */
+	if(0 != code) printf("\n\n");
+	printf(
+		"USAGE: mife-index [OPTIONS] add [FILE]\n"
+		"       mife-index [OPTIONS] range LO HI\n"
+		"       mife-index [OPTIONS] list\n"
+		"Maintains a persistent index of encrypted records in the order given by a\n"
+		"two-position comparison template, such as the ORE templates in samples/.\n"
+		"\n"
+		"add inserts the uids in FILE (or stdin, if it is missing or -), one per line,\n"
+		"skipping any that are indexed already; for example, the output of encrypt\n"
+		"can be piped straight in. The new uids are sorted among themselves and then\n"
+		"placed in the index, using O(log N + log M) comparisons each for M new\n"
+		"uids. range prints, in order, the indexed uids of records\n"
+		"between the records LO and HI (inclusive), which need not be indexed\n"
+		"themselves, using O(log N) comparisons. list prints the whole index.\n"
+		"\n"
+		"Brackets indicate default values for each argument.\n"
+		"\n"
+		"Common options:\n"
+		"  -h, --help               Display this usage information\n"
+		"  -u, --public             A directory for public parameters [public]\n"
+		"  -d, --db, --database     A directory to store encrypted values in [database]\n"
+		"  -C, --clt13              Use CLT13 as the underlying multilinear map\n"
+		"  -s, --sequential         Disable parallelism\n"
+		"\n"
+		"Index-specific options:\n"
+		"  -n, --name               Which index to use [order]\n"
+		"  -l, --left               The position for the left side of a comparison\n"
+		"                           [the template's first position]\n"
+		"  -r, --right              The position for the right side [the other one]\n"
+		"  -L, --less               The output meaning that the left side sorts\n"
+		"                           first [<]\n"
+		"  -m, --cache              Keep up to this many MiB of step matrices in\n"
+		"                           memory; 0 disables the cache [1024]\n"
+		"  -R, --results            Remember results in <database>/results and\n"
+		"                           reuse them, in this run and later ones\n"
+		"\n"
+		"Files used:\n"
+		"  <database>/<uid>/<position>/*.bin\n"
+		"                            R  binary  the encrypted records\n"
+		"  <database>/packed/*/*     R  binary  the encrypted records, if they were\n"
+		"                                       encrypted with --packed\n"
+		"  <database>/results       RW  binary  remembered results, with --results\n"
+		"  <database>/index/<name>   RW text    the index\n"
+		"  <database>/index/<name>.lock\n"
+		"                            RW         held while adding\n"
+		"  <public>/template.json    R  JSON    a description of the comparison\n"
+		"  <public>/mife.pub         R  custom  public parameters for evaluating\n"
+		);
+	exit(code);
+}
+
+void mife_index_parse_cmdline(int argc, char **argv, index_inputs *const ins, const mmap_vtable **mmap) {
+	/* set defaults */
+	evaluator_options opts;
+	evaluator_options_init(&ins->ev, &opts);
+	ins->name = "order";
+	ins->left = ins->right = NULL;
+	ins->less = "<";
+	ins->input = NULL;
+	ins->lo = ins->hi = NULL;
+
+	bool done = false;
+	struct option long_opts[] =
+		{ EVALUATOR_LONG_OPTIONS
+		, {"help"      ,       no_argument, NULL, 'h'}
+		, {"name"      , required_argument, NULL, 'n'}
+		, {"left"      , required_argument, NULL, 'l'}
+		, {"right"     , required_argument, NULL, 'r'}
+		, {"less"      , required_argument, NULL, 'L'}
+		, {NULL, 0, NULL, 0}
+		};
+
+	while(!done) {
+		int c = getopt_long(argc, argv, EVALUATOR_OPTSTRING "hl:L:n:r:", long_opts, NULL);
+		switch(c) {
+			case  -1: done = true; break;
+			case   0: break; /* a long option with non-NULL flag; should never happen */
+			case '?': mife_index_usage(1); break; /* braking is good defensive driving */
+			case 'h': mife_index_usage(0); break;
+			case 'l': ins->left = optarg; break;
+			case 'L': ins->less = optarg; break;
+			case 'n':
+				if('\0' == optarg[0] || NULL != strchr(optarg, '/')) {
+					fprintf(stderr, "%s: index name '%s' should be a non-empty file name\n", *argv, optarg);
+					mife_index_usage(2);
+				}
+				ins->name = optarg;
+				break;
+			case 'r': ins->right = optarg; break;
+			default:
+				if(!evaluator_parse_option(&ins->ev, &opts, *argv, c, optarg, mife_index_usage)) {
+					fprintf(stderr, "The impossible happened! getopt returned %d (%c)\n", c, c);
+					exit(-1);
+				}
+				break;
+		}
+	}
+
+	*mmap = opts.mmap;
+
+	/* read the command */
+	const int args = argc - optind;
+	const char *const command = args > 0 ? argv[optind] : "";
+	if(!strcmp(command, "add") && args <= 2) {
+		ins->command = INDEX_ADD;
+		ins->input = stdin;
+		if(2 == args && strcmp(argv[optind+1], "-") && NULL == (ins->input = fopen(argv[optind+1], "r"))) {
+			fprintf(stderr, "%s: could not open '%s'\n", *argv, argv[optind+1]);
+			mife_index_usage(3);
+		}
+	} else if(!strcmp(command, "range") && 3 == args) {
+		ins->command = INDEX_RANGE;
+		ins->lo = argv[optind+1];
+		ins->hi = argv[optind+2];
+	} else if(!strcmp(command, "list") && 1 == args) {
+		ins->command = INDEX_LIST;
+	} else {
+		fprintf(stderr, "%s: expected add [FILE], range LO HI, or list\n", *argv);
+		mife_index_usage(2);
+	}
+
+	/* read the template and public parameters */
+	int code = evaluator_load(opts.mmap, &ins->ev, opts.public_location);
+	if(code > 0) mife_index_usage(code);
+	if(code < 0) exit(-1);
+
+	if(!evaluator_open_caches(&ins->ev, &opts)) exit(-1);
+}
+
+bool mife_index_add(const index_inputs *const ins, comparator *const c) {
+	order_index idx;
+	char **uids = NULL;
+	size_t uids_len = 0, added;
+	bool success = false;
+
+	if(!read_lines(ins->input, &uids, &uids_len)) {
+		fprintf(stderr, "out of memory while reading uids\n");
+		goto free_uids;
+	}
+	if(!order_index_lock(ins->ev.database_location, ins->name, c, &idx))
+		goto free_uids;
+
+	if(!order_index_insert(&idx, c, uids, uids_len, &added))
+		fprintf(stderr, "could not place the new uids; index %s left unchanged\n", ins->name);
+	else if(order_index_save(ins->ev.database_location, ins->name, c, &idx)) {
+		fprintf(stderr, "added %zu uids (%zu were indexed already); index %s now has %zu\n", added, uids_len - added, ins->name, idx.len);
+		success = true;
+	}
+	order_index_clear(&idx);
+
+free_uids:
+	lines_free(uids, uids_len);
+	return success;
+}
+
+bool mife_index_range(const index_inputs *const ins, comparator *const c) {
+	order_index idx;
+	size_t begin, end;
+
+	if(!order_index_load(ins->ev.database_location, ins->name, c, &idx))
+		return false;
+	const bool success = order_index_range(&idx, c, ins->lo, ins->hi, &begin, &end);
+	if(success)
+		for(size_t i = begin; i < end; i++)
+			printf("%s\n", idx.uids[i]);
+	else
+		fprintf(stderr, "could not compare the bounds against index %s\n", ins->name);
+	order_index_clear(&idx);
+	return success;
+}
+
+bool mife_index_list(const index_inputs *const ins, comparator *const c) {
+	order_index idx;
+	if(!order_index_load(ins->ev.database_location, ins->name, c, &idx))
+		return false;
+	for(size_t i = 0; i < idx.len; i++)
+		printf("%s\n", idx.uids[i]);
+	order_index_clear(&idx);
+	return true;
+}
+
+void mife_index_cleanup(const_mmap_vtable mmap, index_inputs ins) {
+	if(NULL != ins.input && stdin != ins.input) fclose(ins.input);
+	evaluator_clear(mmap, &ins.ev);
+}
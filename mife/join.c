@@ -0,0 +1,344 @@
+#include <getopt.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <mife/mife.h>
+
+#include "compare.h"
+#include "evaluator.h"
+#include "util.h"
+
+/* the merge is split into independent pieces of this many left records */
+#define JOIN_CHUNK 64
+
+typedef struct {
+	evaluator ev;
+	/* the positions the two sides of a comparison go in; NULL for default */
+	const char *left, *right;
+	/* the output labels that mean the left record sorts first, and that the
+	 * two records are equal */
+	const char *less, *equal;
+	/* where to read each table's uids from, one per line */
+	FILE *inputs[2];
+} join_inputs;
+
+typedef struct {
+	unsigned int a, b;
+} join_pair;
+
+/* the matches found in one piece of the merge */
+typedef struct {
+	join_pair *pairs;
+	size_t len, capacity;
+} join_chunk;
+
+typedef struct {
+	comparator *cmp;
+	/* both tables, in sorted order */
+	char **a, **b;
+	size_t a_len, b_len;
+	/* set if any comparison could not be evaluated, or if out of memory */
+	bool failed;
+} join_state;
+
+void mife_join_parse_cmdline(int argc, char **argv, join_inputs *const ins, const mmap_vtable **mmap);
+bool mife_join(join_state *const s, join_chunk *const chunks, const size_t chunks_len);
+void mife_join_cleanup(const_mmap_vtable mmap, join_inputs ins, char **uids[2], size_t uids_len[2]);
+
+/* sorts uids in place */
+static bool mife_join_sort(comparator *cmp, char **uids, const size_t uids_len) {
+	char **sorted;
+	unsigned int *order;
+	bool success = false;
+
+	if(ALLOC_FAILS(order, uids_len+1) || ALLOC_FAILS(sorted, uids_len+1)) {
+		fprintf(stderr, "out of memory while sorting\n");
+		free(order);
+		return false;
+	}
+	for(size_t i = 0; i < uids_len; i++) order[i] = i;
+	if(comparator_sort(cmp, uids, order, uids_len)) {
+		for(size_t i = 0; i < uids_len; i++) sorted[i] = uids[order[i]];
+		memcpy(uids, sorted, uids_len*sizeof(*uids));
+		success = true;
+	}
+	free(sorted);
+	free(order);
+	return success;
+}
+
+int main(int argc, char **argv) {
+	join_inputs ins;
+	join_state s;
+	join_chunk *chunks = NULL;
+	char **uids[2] = { NULL, NULL };
+	size_t uids_len[2] = { 0, 0 }, chunks_len = 0, pairs = 0;
+	bool success = false;
+
+	const mmap_vtable *mmap;
+	mife_join_parse_cmdline(argc, argv, &ins, &mmap);
+
+	if(!read_lines(ins.inputs[0], &uids[0], &uids_len[0]) || !read_lines(ins.inputs[1], &uids[1], &uids_len[1])) {
+		fprintf(stderr, "%s: out of memory while reading uids\n", *argv);
+		goto cleanup;
+	}
+	if(NULL == (s.cmp = comparator_new(mmap, &ins.ev, ins.left, ins.right, ins.less)))
+		goto cleanup;
+	if(!comparator_set_equal(s.cmp, ins.equal))
+		goto free_cmp;
+
+	/* sort both sides, each with every core; then the merge only needs a
+	 * linear number of comparisons */
+	if(!mife_join_sort(s.cmp, uids[0], uids_len[0]) || !mife_join_sort(s.cmp, uids[1], uids_len[1])) {
+		fprintf(stderr, "%s: some comparisons could not be evaluated\n", *argv);
+		goto free_cmp;
+	}
+	fprintf(stderr, "sorted %zu and %zu records; ", uids_len[0], uids_len[1]);
+	comparator_print_stats(s.cmp, stderr);
+
+	s.a = uids[0];
+	s.b = uids[1];
+	s.a_len = uids_len[0];
+	s.b_len = uids_len[1];
+	s.failed = false;
+	chunks_len = (s.a_len + JOIN_CHUNK - 1) / JOIN_CHUNK;
+	if(NULL == (chunks = calloc(chunks_len+1, sizeof(*chunks)))) {
+		fprintf(stderr, "%s: out of memory while joining\n", *argv);
+		goto free_cmp;
+	}
+
+	success = mife_join(&s, chunks, chunks_len);
+	if(success) {
+		for(size_t c = 0; c < chunks_len; c++) {
+			for(size_t p = 0; p < chunks[c].len; p++)
+				printf("%s\t%s\n", s.a[chunks[c].pairs[p].a], s.b[chunks[c].pairs[p].b]);
+			pairs += chunks[c].len;
+		}
+	} else
+		fprintf(stderr, "%s: some comparisons could not be evaluated\n", *argv);
+
+	fprintf(stderr, "joined into %zu pairs; ", pairs);
+	comparator_print_stats(s.cmp, stderr);
+	if(NULL != ins.ev.cache)
+		enc_cache_print_stats(ins.ev.cache, stderr);
+	if(NULL != ins.ev.results)
+		result_cache_print_stats(ins.ev.results, stderr);
+
+	for(size_t c = 0; c < chunks_len; c++)
+		free(chunks[c].pairs);
+	free(chunks);
+free_cmp:
+	comparator_free(s.cmp);
+cleanup:
+	mife_join_cleanup(mmap, ins, uids, uids_len);
+
+	{
+		struct rusage usage;
+		(void) getrusage(RUSAGE_SELF, &usage);
+		(void) fprintf(stderr, "Max memory usage: %ld\n", usage.ru_maxrss);
+	}
+
+	return success ? 0 : -1;
+}
+
+static void mife_join_usage(const int code) {
+	/* separate the diagnostic information from the usage information a little bit */
+	if(0 != code) printf("\n\n");
+	printf(
+		"USAGE: mife-join [OPTIONS] LEFT RIGHT\n"
+		"Joins two tables of encrypted records on equality, using a two-position\n"
+		"template that tells less, equal, and greater apart, such as\n"
+		"samples/base-4-length-17-3-output-compressed-ore.json. LEFT and RIGHT (either\n"
+		"of which may be - for stdin) hold one uid per line. Each pair of equal\n"
+		"records is printed as the left uid and the right uid separated by a tab,\n"
+		"in sorted order.\n"
+		"\n"
+		"Both tables are sorted with parallel, memoized comparisons and then merged,\n"
+		"which takes O(N log N + M log M) evaluations instead of the O(N*M) it takes\n"
+		"to compare every pair. The evaluations done are reported on stderr.\n"
+		"\n"
+		"Brackets indicate default values for each argument.\n"
+		"\n"
+		"Common options:\n"
+		"  -h, --help               Display this usage information\n"
+		"  -u, --public             A directory for public parameters [public]\n"
+		"  -d, --db, --database     A directory to store encrypted values in [database]\n"
+		"  -C, --clt13              Use CLT13 as the underlying multilinear map\n"
+		"  -s, --sequential         Disable parallelism\n"
+		"\n"
+		"Join-specific options:\n"
+		"  -l, --left               The position for the left side of a comparison\n"
+		"                           [the template's first position]\n"
+		"  -r, --right              The position for the right side [the other one]\n"
+		"  -L, --less               The output meaning that the left side sorts\n"
+		"                           first [<]\n"
+		"  -E, --equal              The output meaning that both sides are equal [=]\n"
+		"  -m, --cache              Keep up to this many MiB of step matrices in\n"
+		"                           memory; 0 disables the cache [1024]\n"
+		"  -R, --results            Remember results in <database>/results and\n"
+		"                           reuse them, in this run and later ones\n"
+		"\n"
+		"Files used:\n"
+		"  <database>/<uid>/<position>/*.bin\n"
+		"                            R  binary  the encrypted records\n"
+		"  <database>/packed/*/*     R  binary  the encrypted records, if they were\n"
+		"                                       encrypted with --packed\n"
+		"  <database>/results       RW  binary  remembered results, with --results\n"
+		"  <public>/template.json    R  JSON    a description of the comparison\n"
+		"  <public>/mife.pub         R  custom  public parameters for evaluating\n"
+		);
+	exit(code);
+}
+
+void mife_join_parse_cmdline(int argc, char **argv, join_inputs *const ins, const mmap_vtable **mmap) {
+	/* set defaults */
+	evaluator_options opts;
+	evaluator_options_init(&ins->ev, &opts);
+	ins->left = ins->right = NULL;
+	ins->less = "<";
+	ins->equal = "=";
+	ins->inputs[0] = ins->inputs[1] = stdin;
+
+	bool done = false;
+	struct option long_opts[] =
+		{ EVALUATOR_LONG_OPTIONS
+		, {"help"      ,       no_argument, NULL, 'h'}
+		, {"left"      , required_argument, NULL, 'l'}
+		, {"right"     , required_argument, NULL, 'r'}
+		, {"less"      , required_argument, NULL, 'L'}
+		, {"equal"     , required_argument, NULL, 'E'}
+		, {NULL, 0, NULL, 0}
+		};
+
+	while(!done) {
+		int c = getopt_long(argc, argv, EVALUATOR_OPTSTRING "E:hl:L:r:", long_opts, NULL);
+		switch(c) {
+			case  -1: done = true; break;
+			case   0: break; /* a long option with non-NULL flag; should never happen */
+			case '?': mife_join_usage(1); break; /* braking is good defensive driving */
+			case 'E': ins->equal = optarg; break;
+			case 'h': mife_join_usage(0); break;
+			case 'l': ins->left = optarg; break;
+			case 'L': ins->less = optarg; break;
+			case 'r': ins->right = optarg; break;
+			default:
+				if(!evaluator_parse_option(&ins->ev, &opts, *argv, c, optarg, mife_join_usage)) {
+					fprintf(stderr, "The impossible happened! getopt returned %d (%c)\n", c, c);
+					exit(-1);
+				}
+				break;
+		}
+	}
+
+	*mmap = opts.mmap;
+
+	if(optind != argc-2) {
+		fprintf(stderr, "%s: specify exactly two files of uids (found %d)\n", *argv, argc-optind);
+		mife_join_usage(2);
+	}
+	if(!strcmp(argv[optind], "-") && !strcmp(argv[optind+1], "-")) {
+		fprintf(stderr, "%s: only one of the tables can come from stdin\n", *argv);
+		mife_join_usage(2);
+	}
+	for(int i = 0; i < 2; i++) {
+		if(strcmp(argv[optind+i], "-") && NULL == (ins->inputs[i] = fopen(argv[optind+i], "r"))) {
+			fprintf(stderr, "%s: could not open '%s'\n", *argv, argv[optind+i]);
+			mife_join_usage(3);
+		}
+	}
+
+	/* read the template and public parameters */
+	int code = evaluator_load(opts.mmap, &ins->ev, opts.public_location);
+	if(code > 0) mife_join_usage(code);
+	if(code < 0) exit(-1);
+
+	if(!evaluator_open_caches(&ins->ev, &opts)) exit(-1);
+}
+
+/* compares a left record with a right one; a failed comparison says "after",
+ * which moves the merge along, and is reported at the end */
+static int mife_join_compare(join_state *const s, const size_t a, const size_t b) {
+	int order;
+	if(comparator_compare(s->cmp, s->a[a], s->b[b], &order)) return order;
+#pragma omp atomic write
+	s->failed = true;
+	return 1;
+}
+
+/* the first right record that left record a does not sort after, or (with
+ * strict) that a sorts strictly before */
+static size_t mife_join_bound(join_state *const s, const size_t a, const bool strict) {
+	size_t lo = 0, hi = s->b_len;
+	while(lo < hi) {
+		const size_t mid = lo + (hi-lo)/2;
+		const int order = mife_join_compare(s, a, mid);
+		if(order > 0 || (strict && 0 == order)) lo = mid+1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+static bool mife_join_emit(join_chunk *const chunk, const size_t a, const size_t b) {
+	if(chunk->len == chunk->capacity) {
+		const size_t capacity = 0 == chunk->capacity ? 16 : 2*chunk->capacity;
+		join_pair *pairs = realloc(chunk->pairs, capacity*sizeof(*pairs));
+		if(NULL == pairs) return false;
+		chunk->pairs = pairs;
+		chunk->capacity = capacity;
+	}
+	chunk->pairs[chunk->len++] = (join_pair) { a, b };
+	return true;
+}
+
+/* Merge-joins left records [a_lo, a_hi) with right records [b_lo, b_hi),
+ * which together hold every right record equal to one of those left ones.
+ * Each run of equal right records is found once, by comparing it against the
+ * first left record it matches; the rest of that left record's run matches it
+ * as soon as it compares equal to the run's first record. */
+static void mife_join_merge(join_state *const s, join_chunk *const chunk, size_t a, const size_t a_hi, size_t b, const size_t b_hi) {
+	bool ok = true;
+	while(ok && !s->failed && a < a_hi && b < b_hi) {
+		const int order = mife_join_compare(s, a, b);
+		if(order < 0) { a++; continue; }
+		if(order > 0) { b++; continue; }
+
+		size_t run = b+1;
+		while(run < b_hi && 0 == mife_join_compare(s, a, run)) run++;
+		do {
+			for(size_t k = b; ok && k < run; k++)
+				ok = mife_join_emit(chunk, a, k);
+			a++;
+		} while(ok && a < a_hi && 0 == mife_join_compare(s, a, b));
+		b = run;
+	}
+	if(!ok) {
+		fprintf(stderr, "out of memory while joining\n");
+#pragma omp atomic write
+		s->failed = true;
+	}
+}
+
+/* finds every equal pair, with the matches for left records
+ * [JOIN_CHUNK*c, JOIN_CHUNK*(c+1)) going in chunks[c]; returns false if some
+ * comparison failed */
+bool mife_join(join_state *const s, join_chunk *const chunks, const size_t chunks_len) {
+	/* each piece binary searches for the right records it could match, and
+	 * merges just those */
+#pragma omp parallel for schedule(dynamic,1) if(g_parallel)
+	for(size_t c = 0; c < chunks_len; c++) {
+		const size_t a_lo = c*JOIN_CHUNK;
+		const size_t a_hi = a_lo + JOIN_CHUNK < s->a_len ? a_lo + JOIN_CHUNK : s->a_len;
+		const size_t b_lo = mife_join_bound(s, a_lo, false);
+		const size_t b_hi = mife_join_bound(s, a_hi-1, true);
+		mife_join_merge(s, chunks + c, a_lo, a_hi, b_lo, b_hi);
+	}
+	return !s->failed;
+}
+
+void mife_join_cleanup(const_mmap_vtable mmap, join_inputs ins, char **uids[2], size_t uids_len[2]) {
+	for(int i = 0; i < 2; i++) {
+		lines_free(uids[i], uids_len[i]);
+		if(stdin != ins.inputs[i]) fclose(ins.inputs[i]);
+	}
+	evaluator_clear(mmap, &ins.ev);
+}
@@ -2,6 +2,7 @@
 #include <getopt.h>
 #include <sys/stat.h>
 #include <sys/resource.h>
+#include <unistd.h>
 
 #include <mife/mife.h>
 #include <mmap/mmap_gghlite.h>
@@ -16,7 +17,9 @@
 
 typedef struct {
   int sec_param, log_db_size;
+  bool precompute_kilian, triangular_kilian, stream, resume;
   aes_randstate_t seed;
+  mife_master_seed master;
   mbp_template template;
 } keygen_inputs;
 
@@ -25,7 +28,10 @@ typedef struct {
 } keygen_locations;
 
 void mife_keygen_parse_cmdline(int argc, char **argv, keygen_inputs *const ins, keygen_locations *const outs, bool *use_clt, int *ncores);
+bool mife_keygen_precompute(mife_pp_t pp, mife_sk_t sk, mbp_template_stats *const stats);
+bool mife_keygen_stream(const_mmap_vtable mmap, keygen_inputs *const ins, keygen_locations outs, mife_pp_t pp, mife_sk_t sk, mbp_template_stats *const stats, int ncores);
 bool mife_keygen_print_outputs(const_mmap_vtable mmap, keygen_locations outs, mife_pp_t pp, mife_sk_t sk);
+bool mife_keygen_print_kilian_cache(keygen_locations outs, mife_sk_t sk);
 void mife_keygen_cleanup(const_mmap_vtable mmap, keygen_inputs *const ins, keygen_locations *const outs, mife_pp_t pp, mife_sk_t sk);
 
 int main(int argc, char **argv) {
@@ -50,15 +56,28 @@ int main(int argc, char **argv) {
 
   if (!mbp_template_to_mife_pp(pp, &ins.template, &stats))
       return -1;
+  if(ins.triangular_kilian)
+    pp->flags |= MIFE_TRIANGULAR_KILIAN;
 
-  mife_setup(mmap, pp, sk, ins.log_db_size, ins.sec_param, ncores, ins.seed);
-  timer_printf("Finished calling mife_setup. Starting to write outputs...\n");
-  start_timer();
+  if(ins.stream) {
+    /* writes its own outputs as it goes */
+    if(!mife_keygen_stream(mmap, &ins, outs, pp, sk, &stats, ncores))
+      return -1;
+    success = true;
+  } else {
+    mife_setup(mmap, pp, sk, ins.log_db_size, ins.sec_param, ncores, ins.seed);
 
-  success = mife_keygen_print_outputs(mmap, outs, pp, sk);
-  timer_printf("Finished writing outputs");
-  print_timer();
-  timer_printf("\n");
+    if(ins.precompute_kilian && !mife_keygen_precompute(pp, sk, &stats))
+      return -1;
+
+    timer_printf("Finished calling mife_setup. Starting to write outputs...\n");
+    start_timer();
+
+    success = mife_keygen_print_outputs(mmap, outs, pp, sk);
+    timer_printf("Finished writing outputs");
+    print_timer();
+    timer_printf("\n");
+  }
 
   timer_printf("Starting cleanup...\n");
   start_timer();
@@ -93,12 +112,25 @@ static void mife_keygen_usage(const int code) {
     "Keygen-specific options:\n"
     "  -s, --secparam     Security parameter [80]\n"
     "  -n, --dbsize       Allow up to 2^n records [80]\n"
+    "  -k, --precompute   Also store the Kilian-randomized matrix of every\n"
+    "                     symbol at every step, so that encryption needs no\n"
+    "                     matrix multiplications\n"
+    "  -t, --triangular   Build each Kilian randomizer from random triangular\n"
+    "                     factors, so that its inverse needs no matrix\n"
+    "                     inversion\n"
+    "  -S, --stream       Write each Kilian pair to disk as soon as it is\n"
+    "                     generated, keeping only one pair per core in memory\n"
+    "  -R, --resume       Continue an interrupted --stream run (implies\n"
+    "                     --stream); pass the same template and options\n"
     "\n"
     "Files used:\n"
     "  <public>/template.json  R  JSON    a description of the function being\n"
     "                                     encrypted\n"
     "  <public>/mife.pub        W custom  public parameters for evaluating\n"
     "  <private>/mife.priv      W custom  private parameters for encrypting\n"
+    "  <private>/kilian.pre     W custom  precomputed matrices (with -k only)\n"
+    "  <private>/mife.priv.*   RW custom  checkpoints while streaming (with -S\n"
+    "                                     only; removed when done)\n"
     "  <private>/seed.bin      R  binary  %d-byte seed for PRNG\n"
     "  /dev/urandom            R  binary  used in case above file is missing\n"
     , AES_SEED_BYTE_SIZE
@@ -114,6 +146,10 @@ void mife_keygen_parse_cmdline(int argc, char **argv, keygen_inputs *const ins,
   /* set defaults */
   ins->sec_param = 80;
   ins->log_db_size = 80;
+  ins->precompute_kilian = false;
+  ins->triangular_kilian = false;
+  ins->stream = false;
+  ins->resume = false;
   *ncores = 0;
   *outs = (keygen_locations) { { "public", true }, { "private", true } };
 
@@ -125,11 +161,15 @@ void mife_keygen_parse_cmdline(int argc, char **argv, keygen_inputs *const ins,
     , {"public"   , required_argument, NULL, 'u'}
     , {"clt"      ,       no_argument, NULL, 'C'}
     , {"ncores"   , required_argument, NULL, 'c'}
+    , {"precompute",      no_argument, NULL, 'k'}
+    , {"triangular",      no_argument, NULL, 't'}
+    , {"stream"   ,       no_argument, NULL, 'S'}
+    , {"resume"   ,       no_argument, NULL, 'R'}
     , {NULL, 0, NULL, 0}
     };
 
   while(!done) {
-    int c = getopt_long(argc, argv, "hn:c:Cr:s:u:", long_opts, NULL);
+    int c = getopt_long(argc, argv, "hkn:c:Cr:Rs:Stu:", long_opts, NULL);
     switch(c) {
       case  -1: done = true; break;
       case   0: break; /* a long option with non-NULL flag; should never happen */
@@ -138,6 +178,9 @@ void mife_keygen_parse_cmdline(int argc, char **argv, keygen_inputs *const ins,
     case 'c':
         *ncores = atoi(optarg);
         break;
+      case 'k':
+        ins->precompute_kilian = true;
+        break;
       case 'n':
         if((ins->log_db_size = atoi(optarg)) < 1) {
           fprintf(stderr, "%s: unparseable database size '%s', should be positive number\n", *argv, optarg);
@@ -147,12 +190,21 @@ void mife_keygen_parse_cmdline(int argc, char **argv, keygen_inputs *const ins,
       case 'r':
         outs->private.path = optarg;
         break;
+      case 'R':
+        ins->resume = true;
+        /* fall through */
+      case 'S':
+        ins->stream = true;
+        break;
       case 's':
         if((ins->sec_param = atoi(optarg)) < 1) {
           fprintf(stderr, "%s: unparseable security parameter '%s', should be positive number\n", *argv, optarg);
           mife_keygen_usage(3);
         }
         break;
+      case 't':
+        ins->triangular_kilian = true;
+        break;
       case 'u':
         outs->public.path = optarg;
         break;
@@ -185,6 +237,7 @@ void mife_keygen_parse_cmdline(int argc, char **argv, keygen_inputs *const ins,
 
   /* read seed */
   check_parse_result(load_seed(outs->private, "keygen", ins->seed), mife_keygen_usage, 8);
+  check_parse_result(load_master_seed(outs->private, &ins->master), mife_keygen_usage, 8);
 }
 
 /* for now, use the mife library's custom format; would be good to upgrade this
@@ -200,11 +253,12 @@ bool mife_keygen_print_outputs(const_mmap_vtable mmap, keygen_locations outs, mi
     return false;
   }
 
-  location  public_location = location_append(outs.public , "mife.pub" );
-  location private_location = location_append(outs.private, "mife.priv");
+  location  public_location = location_append(outs.public , "mife.pub"  );
+  location private_location = location_append(outs.private, "mife.priv" );
   if( public_location.path == NULL ||
      private_location.path == NULL) {
-    location_free(public_location);
+    location_free( public_location);
+    location_free(private_location);
     fprintf(stderr, "out of memory when generating output paths\n");
     return false;
   }
@@ -214,9 +268,323 @@ bool mife_keygen_print_outputs(const_mmap_vtable mmap, keygen_locations outs, mi
 
   location_free( public_location);
   location_free(private_location);
+  return mife_keygen_print_kilian_cache(outs, sk);
+}
+
+bool mife_keygen_print_kilian_cache(keygen_locations outs, mife_sk_t sk) {
+  location kilian_location = location_append(outs.private, "kilian.pre");
+  if(kilian_location.path == NULL) {
+    fprintf(stderr, "out of memory when generating output paths\n");
+    return false;
+  }
+
+  /* a cache left over from an earlier key would silently produce garbage */
+  if(NULL != sk->kilian_cache)
+    fwrite_mife_kilian_cache(sk->kilian_cache, kilian_location.path);
+  else if(0 != unlink(kilian_location.path) && ENOENT != errno)
+    fprintf(stderr, "warning: could not remove stale %s\n", kilian_location.path);
+
+  location_free(kilian_location);
+  return true;
+}
+
+bool mife_keygen_precompute(mife_pp_t pp, mife_sk_t sk, mbp_template_stats *const stats) {
+  timer_printf("Starting precomputing Kilian-conjugated symbol matrices...\n");
+  start_timer();
+  for(int k = 0; k < pp->kappa; k++) {
+    int len;
+    fmpz_mat_t *clr = mbp_template_stats_to_symbol_cleartexts(stats, k, &len);
+    if(NULL == clr) {
+      fprintf(stderr, "out of memory while precomputing Kilian conjugates\n");
+      return false;
+    }
+    mife_kilian_cache_set(pp, sk, k, len, clr);
+    mbp_template_stats_symbol_cleartexts_clear(clr, len);
+  }
+  timer_printf("Finished precomputing Kilian-conjugated symbol matrices");
+  print_timer();
+  timer_printf("\n");
   return true;
 }
 
+/* Finds the last complete checkpoint in a progress file written by
+ * mife_keygen_stream: the number of pairs already in mife.priv, the length of
+ * the file up to the end of the last of them, and the length of kilian.pre up
+ * to the end of the matching step (or -1 if it isn't being written). */
+static bool mife_keygen_read_progress(const char *const path, const int numR, int *const done, long *const offset, long *const kilian_offset) {
+  FILE *fp = fopen(path, "rb");
+  int file_numR, k, fields;
+  long o, ko;
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t line_len;
+  bool found = false;
+
+  if(NULL == fp) return false;
+  if(1 != fscanf(fp, "%d\n", &file_numR) || file_numR != numR) {
+    fprintf(stderr, "%s was written for a different template\n", path);
+    fclose(fp);
+    return false;
+  }
+  /* the last line may have been cut off mid-write; ignore it if so */
+  while((line_len = getline(&line, &line_size, fp)) > 0 && '\n' == line[line_len-1] &&
+        (fields = sscanf(line, "%d %ld %ld", &k, &o, &ko)) >= 2) {
+    *done = k;
+    *offset = o;
+    *kilian_offset = 3 == fields ? ko : -1;
+    found = true;
+  }
+  free(line);
+  fclose(fp);
+  return found;
+}
+
+/* Appends step k to kilian.pre: every cleartext that can appear there, with
+ * the Kilian randomizers on either side of it applied. R_inv is NULL for the
+ * first step and R for the last, and these two are all the step needs. */
+static bool mife_keygen_stream_step(mife_pp_t pp, mbp_template_stats *const stats, FILE *kilian, int k, const fmpz_mat_struct *R_inv, const fmpz_mat_struct *R) {
+  fmpz_mat_t *clr, *conj;
+  int len;
+
+  if(NULL == (clr = mbp_template_stats_to_symbol_cleartexts(stats, k, &len)) || ALLOC_FAILS(conj, len)) {
+    if(NULL != clr) mbp_template_stats_symbol_cleartexts_clear(clr, len);
+    fprintf(stderr, "out of memory while precomputing Kilian conjugates\n");
+    return false;
+  }
+  for(int i = 0; i < len; i++) {
+    fmpz_mat_init_set(conj[i], clr[i]);
+    mife_kilian_conjugate(pp, R_inv, R, conj[i]);
+  }
+  fwrite_mife_kilian_cache_step(kilian, len, clr, conj);
+  mbp_template_stats_symbol_cleartexts_clear(clr, len);
+  mbp_template_stats_symbol_cleartexts_clear(conj, len);
+  return 0 == fflush(kilian) && 0 == fsync(fileno(kilian));
+}
+
+/* Like mife_setup followed by mife_keygen_print_outputs, but each Kilian pair
+ * is written to mife.priv as soon as it has been generated, so at most one
+ * pair per thread is in memory at a time. Each pair is sampled from its own
+ * substream of the seed, which lets the pairs be generated in parallel.
+ *
+ * The multilinear map key is saved to mife.priv.mmap before any pairs, and
+ * mife.priv.progress records how much of mife.priv is complete after every
+ * pair; with ins->resume, an interrupted run picks up from there. Both files
+ * are removed once mife.priv is finished.
+ *
+ * With ins->precompute_kilian, step k of kilian.pre is appended as soon as
+ * pair k is written, since it needs only that pair's R and the previous
+ * pair's R_inv; so the precomputation, too, never holds the whole key. */
+bool mife_keygen_stream(const_mmap_vtable mmap, keygen_inputs *const ins, keygen_locations outs, mife_pp_t pp, mife_sk_t sk, mbp_template_stats *const stats, int ncores) {
+  FILE *priv = NULL, *progress = NULL, *kilian = NULL, *fp;
+  int start = 0, *dims = NULL;
+  long offset = 0, kilian_offset = -1;
+  bool success = false, failed = false, have_prev = false;
+  /* the R_inv of the last pair written, for precomputing the next step */
+  fmpz_mat_t prev_R_inv;
+
+  if(!create_directory_if_missing(outs.private.path)) {
+    fprintf(stderr, "could not create output directory %s\n", outs.private.path);
+    return false;
+  }
+
+  location   public_location = location_append(outs.public , "mife.pub"          );
+  location  private_location = location_append(outs.private, "mife.priv"         );
+  location     mmap_location = location_append(outs.private, "mife.priv.mmap"    );
+  location progress_location = location_append(outs.private, "mife.priv.progress");
+  location   kilian_location = location_append(outs.private, "kilian.pre"        );
+  if(  public_location.path == NULL ||
+      private_location.path == NULL ||
+         mmap_location.path == NULL ||
+     progress_location.path == NULL ||
+       kilian_location.path == NULL) {
+    fprintf(stderr, "out of memory when generating output paths\n");
+    goto free_locations;
+  }
+
+  mife_setup_params(pp, ins->log_db_size);
+  /* the pairs never all live in sk at once */
+  sk->numR = 0;
+  sk->R = NULL;
+  sk->R_inv = NULL;
+  sk->kilian_cache = NULL;
+
+  if(ins->resume && mife_keygen_read_progress(progress_location.path, pp->numR, &start, &offset, &kilian_offset)) {
+    if(ins->precompute_kilian && kilian_offset < 0) {
+      fprintf(stderr, "the run in %s did not precompute; resume it without -k\n", outs.private.path);
+      goto free_locations;
+    }
+    if(NULL == (fp = fopen(mmap_location.path, "rb"))) {
+      fprintf(stderr, "could not open %s to resume\n", mmap_location.path);
+      goto free_locations;
+    }
+    sk->self = malloc(mmap->sk->size);
+    mmap->sk->fread(sk->self, fp);
+    fclose(fp);
+
+    if(NULL == (priv = fopen(private_location.path, "r+b")) ||
+       0 != ftruncate(fileno(priv), offset) ||
+       0 != fseek(priv, 0, SEEK_END)) {
+      fprintf(stderr, "could not truncate %s to resume\n", private_location.path);
+      goto close_files;
+    }
+    if(ins->precompute_kilian &&
+       (NULL == (kilian = fopen(kilian_location.path, "r+b")) ||
+        0 != ftruncate(fileno(kilian), kilian_offset) ||
+        0 != fseek(kilian, 0, SEEK_END))) {
+      fprintf(stderr, "could not truncate %s to resume\n", kilian_location.path);
+      goto close_files;
+    }
+    timer_printf("Resuming after %d of %d Kilian pairs\n", start, pp->numR);
+  } else {
+    if(ins->resume)
+      fprintf(stderr, "warning: nothing to resume in %s; starting from scratch\n", outs.private.path);
+    mife_setup_mmap(mmap, pp, sk, ins->sec_param, ncores, ins->seed);
+
+    /* without this, the pairs written so far would be worthless */
+    if(NULL == (fp = fopen(mmap_location.path, "wb"))) {
+      fprintf(stderr, "could not open %s for writing\n", mmap_location.path);
+      goto free_locations;
+    }
+    mmap->sk->fwrite(sk->self, fp);
+    fclose(fp);
+
+    if(NULL == (priv     = fopen( private_location.path, "wb")) ||
+       NULL == (progress = fopen(progress_location.path, "wb"))) {
+      fprintf(stderr, "could not open %s for writing\n", private_location.path);
+      goto close_files;
+    }
+    fprintf(priv, "%d\n", pp->numR);
+    fflush(priv);
+    if(ins->precompute_kilian) {
+      if(NULL == (kilian = fopen(kilian_location.path, "wb"))) {
+        fprintf(stderr, "could not open %s for writing\n", kilian_location.path);
+        goto close_files;
+      }
+      fprintf(kilian, "%d\n", pp->kappa);
+      fflush(kilian);
+      fprintf(progress, "%d\n%d %ld %ld\n", pp->numR, 0, ftell(priv), ftell(kilian));
+    } else
+      fprintf(progress, "%d\n%d %ld\n", pp->numR, 0, ftell(priv));
+    fclose(progress);
+    progress = NULL;
+  }
+  mife_setup_attach_mmap(mmap, pp, sk);
+
+  if(NULL == (progress = fopen(progress_location.path, "ab")) ||
+     ALLOC_FAILS(dims, pp->numR)) {
+    fprintf(stderr, "could not open %s for writing\n", progress_location.path);
+    goto close_files;
+  }
+  pp->kilianfn(pp, dims);
+
+  /* pairs come from their own substreams, so the one before a resumed run's
+   * first is cheaper to draw again than to parse out of mife.priv */
+  if(ins->precompute_kilian && start > 0) {
+    fmpz_mat_t R;
+    aes_randstate_t randstate;
+    if(!mife_substream_init(randstate, &ins->master, "keygen", "kilian", start-1, MIFE_SUBSTREAM_ALL)) {
+      fprintf(stderr, "could not redraw Kilian pair %d to resume\n", start-1);
+      goto close_files;
+    }
+    mife_kilian_pair_init(pp, dims[start-1], R, prev_R_inv, randstate);
+    aes_randclear(randstate);
+    fmpz_mat_clear(R);
+    have_prev = true;
+  }
+
+  timer_printf("Starting streaming Kilian matrices...\n");
+  start_timer();
+  uint64_t t = ggh_walltime(0);
+
+  /* threads that finish early wait their turn to write, which is what bounds
+   * the number of pairs in flight */
+#pragma omp parallel for ordered schedule(dynamic,1)
+  for(int k = start; k < pp->numR; k++) {
+    fmpz_mat_t R, R_inv;
+    aes_randstate_t randstate;
+    const bool have_stream = mife_substream_init(randstate, &ins->master, "keygen", "kilian", k, MIFE_SUBSTREAM_ALL);
+
+    if(have_stream) {
+      mife_kilian_pair_init(pp, dims[k], R, R_inv, randstate);
+      aes_randclear(randstate);
+    }
+
+#pragma omp ordered
+    {
+      if(!have_stream) failed = true;
+      if(!failed) {
+        fwrite_mife_kilian_pair(priv, R, R_inv);
+        if(0 != fflush(priv) || 0 != fsync(fileno(priv)))
+          failed = true;
+        else if(NULL == kilian) {
+          fprintf(progress, "%d %ld\n", k+1, ftell(priv));
+          fflush(progress);
+        } else if(!mife_keygen_stream_step(pp, stats, kilian, k, have_prev ? prev_R_inv : NULL, R))
+          failed = true;
+        else {
+          fprintf(progress, "%d %ld %ld\n", k+1, ftell(priv), ftell(kilian));
+          fflush(progress);
+          if(have_prev) fmpz_mat_clear(prev_R_inv);
+          fmpz_mat_init_set(prev_R_inv, R_inv);
+          have_prev = true;
+        }
+      }
+      timer_printf("\r    Progress: [%d / %d] %8.2fs",
+        k+1, pp->numR, ggh_seconds(ggh_walltime(t)));
+    }
+
+    if(have_stream) {
+      fmpz_mat_clear(R);
+      fmpz_mat_clear(R_inv);
+    }
+  }
+  timer_printf("\n");
+  timer_printf("Finished streaming Kilian matrices");
+  print_timer();
+  timer_printf("\n");
+
+  /* the last step needs only the last pair's R_inv */
+  if(!failed && NULL != kilian) {
+    failed = !mife_keygen_stream_step(pp, stats, kilian, pp->kappa-1, prev_R_inv, NULL);
+    failed = 0 != fclose(kilian) || failed;
+    kilian = NULL;
+  }
+  if(failed) {
+    fprintf(stderr, "could not write %s; rerun with --resume to continue\n", private_location.path);
+    goto close_files;
+  }
+
+  mmap->sk->fwrite(sk->self, priv);
+  if(0 != fclose(priv)) {
+    priv = NULL;
+    fprintf(stderr, "could not finish writing %s\n", private_location.path);
+    goto close_files;
+  }
+  priv = NULL;
+  fwrite_mife_pp(mmap, pp, public_location.path);
+
+  /* without -k, this removes any stale kilian.pre */
+  if(!ins->precompute_kilian && !mife_keygen_print_kilian_cache(outs, sk)) goto close_files;
+
+  if(0 != unlink(progress_location.path) || 0 != unlink(mmap_location.path))
+    fprintf(stderr, "warning: could not remove checkpoints from %s\n", outs.private.path);
+  success = true;
+
+close_files:
+  if(NULL != priv) fclose(priv);
+  if(NULL != progress) fclose(progress);
+  if(NULL != kilian) fclose(kilian);
+  if(have_prev) fmpz_mat_clear(prev_R_inv);
+  free(dims);
+free_locations:
+  location_free(  public_location);
+  location_free( private_location);
+  location_free(    mmap_location);
+  location_free(progress_location);
+  location_free(  kilian_location);
+  return success;
+}
+
 void mife_keygen_cleanup(const_mmap_vtable mmap, keygen_inputs *const ins, keygen_locations *const outs, mife_pp_t pp, mife_sk_t sk) {
   aes_randclear(ins->seed);
   mbp_template_stats_free(*(mbp_template_stats *)pp->mbp_params);
@@ -5,6 +5,15 @@
 #include "util.h"
 
 void mbp_template_stats_free(mbp_template_stats stats) {
+	if(NULL != stats.state_maps) {
+		for(unsigned int i = 0; i < stats.template->steps_len; i++) {
+			if(NULL == stats.state_maps[i]) continue;
+			for(unsigned int j = 0; j < stats.template->steps[i].symbols_len; j++)
+				free(stats.state_maps[i][j]);
+			free(stats.state_maps[i]);
+		}
+		free(stats.state_maps);
+	}
 	free(stats.position_index);
 	free(stats.local_index);
 	free(stats.step_lens);
@@ -13,7 +22,7 @@ void mbp_template_stats_free(mbp_template_stats stats) {
 
 bool mbp_template_to_mbp_template_stats(const mbp_template *const template, mbp_template_stats *stats) {
 	const int len = template->steps_len;
-	*stats = (mbp_template_stats) { 0, NULL, NULL, NULL, NULL, NULL };
+	*stats = (mbp_template_stats) { 0, NULL, NULL, NULL, NULL, template, NULL };
 
 	if(ALLOC_FAILS(stats->positions     , len) ||
 	   ALLOC_FAILS(stats->position_index, len) ||
@@ -38,7 +47,33 @@ bool mbp_template_to_mbp_template_stats(const mbp_template *const template, mbp_
 			stats->positions[stats->positions_len++] = template->steps[i].position;
 	}
 
-	stats->template = template;
+	/* record which matrices are transition functions; the Kilian
+	 * randomization of those can skip a dense matrix multiplication */
+	if(ALLOC_FAILS(stats->state_maps, len)) {
+		mbp_template_stats_free(*stats);
+		return false;
+	}
+	for(int i = 0; i < len; i++) stats->state_maps[i] = NULL;
+	for(int i = 0; i < len; i++) {
+		const mbp_step *const step = template->steps + i;
+		if(ALLOC_FAILS(stats->state_maps[i], step->symbols_len)) {
+			mbp_template_stats_free(*stats);
+			return false;
+		}
+		for(unsigned int j = 0; j < step->symbols_len; j++) stats->state_maps[i][j] = NULL;
+		for(unsigned int j = 0; j < step->symbols_len; j++) {
+			unsigned int *map;
+			if(ALLOC_FAILS(map, step->matrix[j].num_rows)) {
+				mbp_template_stats_free(*stats);
+				return false;
+			}
+			if(f2_matrix_to_state_map(step->matrix[j], map))
+				stats->state_maps[i][j] = map;
+			else
+				free(map);
+		}
+	}
+
 	return true;
 }
 
@@ -61,6 +96,13 @@ void mbp_template_stats_to_position(mife_pp_t pp, int global_index, int *out_pos
 	*out_local    = stats->local_index[global_index];
 }
 
+static void f2_matrix_to_fmpz_mat(fmpz_mat_struct *fmpz_m, const f2_matrix f2_m) {
+	fmpz_mat_init(fmpz_m, f2_m.num_rows, f2_m.num_cols);
+	for(unsigned int j = 0; j < f2_m.num_rows; j++)
+		for(unsigned int k = 0; k < f2_m.num_cols; k++)
+			fmpz_set_ui(fmpz_mat_entry(fmpz_m, j, k), f2_m.elems[j][k]);
+}
+
 /* TODO: it would be good to not call assert */
 void mbp_template_stats_to_cleartext(mife_pp_t pp, mife_mat_clr_t cleartext, void *cleartext_raw_untyped) {
 	const mbp_template_stats *const stats = pp->mbp_params;
@@ -77,25 +119,43 @@ void mbp_template_stats_to_cleartext(mife_pp_t pp, mife_mat_clr_t cleartext, voi
 	assert(mbp.matrices_len == stats->template->steps_len);
 
 	if(ALLOC_FAILS(cleartext->clr, pp->num_inputs)) assert(false);
+	if(ALLOC_FAILS(cleartext->maps, pp->num_inputs)) assert(false);
 	for(unsigned int i = 0; i < stats->positions_len; i++)
-		if(ALLOC_FAILS(cleartext->clr[i], pp->n[i]))
+		if(ALLOC_FAILS(cleartext->clr[i], pp->n[i]) ||
+		   ALLOC_FAILS(cleartext->maps[i], pp->n[i]))
 			assert(false);
 
 	for(unsigned int i = 0; i < mbp.matrices_len; i++) {
 		/* abbreviations */
 		const int position = stats->position_index[i], local = stats->local_index[i];
-		const f2_matrix f2_m = mbp.matrices[i];
-		fmpz_mat_struct *fmpz_m = cleartext->clr[position][local];
+		f2_matrix_to_fmpz_mat(cleartext->clr[position][local], mbp.matrices[i]);
 
-		fmpz_mat_init(fmpz_m, f2_m.num_rows, f2_m.num_cols);
-		for(unsigned int j = 0; j < f2_m.num_rows; j++)
-			for(unsigned int k = 0; k < f2_m.num_cols; k++)
-				fmpz_set_ui(fmpz_mat_entry(fmpz_m, j, k), f2_m.elems[j][k]);
+		const int symbol = mbp_step_symbol_index(stats->template->steps + i, cleartext_raw->symbols[i]);
+		cleartext->maps[position][local] = stats->state_maps[i][symbol];
 	}
 
 	f2_mbp_free(mbp);
 }
 
+/* every cleartext that can appear at the given step, one per symbol, in the
+ * order the template lists the symbols; the caller frees with
+ * mbp_template_stats_symbol_cleartexts_clear */
+fmpz_mat_t *mbp_template_stats_to_symbol_cleartexts(const mbp_template_stats *const stats, int global_index, int *out_len) {
+	const mbp_step *const step = stats->template->steps + global_index;
+	fmpz_mat_t *result;
+	if(ALLOC_FAILS(result, step->symbols_len)) return NULL;
+	for(unsigned int i = 0; i < step->symbols_len; i++)
+		f2_matrix_to_fmpz_mat(result[i], step->matrix[i]);
+	*out_len = step->symbols_len;
+	return result;
+}
+
+void mbp_template_stats_symbol_cleartexts_clear(fmpz_mat_t *clr, int len) {
+	for(int i = 0; i < len; i++)
+		fmpz_mat_clear(clr[i]);
+	free(clr);
+}
+
 /* TODO: are we sure that templates handed to us will produce just one output
  *       every time? */
 int mbp_template_stats_to_result(mife_pp_t pp, f2_matrix raw_result) {
@@ -14,6 +14,7 @@ typedef struct {
 	int *step_lens;                     /* for each function position, how many steps use that position? */
 	const char **positions;             /* a name for each position */
 	const mbp_template *template;       /* a reference to the template in question */
+	unsigned int ***state_maps;         /* for each step and symbol, the matrix as a transition function (see f2_matrix_to_state_map), or NULL if it isn't one */
 } mbp_template_stats;
 void mbp_template_stats_free(mbp_template_stats stats);
 bool mbp_template_to_mbp_template_stats(const mbp_template *const template, mbp_template_stats *stats);
@@ -25,4 +26,7 @@ void mbp_template_stats_to_dimensions(mife_pp_t pp, int *out);
 void mbp_template_stats_to_position  (mife_pp_t pp, int global_index, int *out_position, int *out_local_index);
 void mbp_template_stats_to_cleartext (mife_pp_t pp, mife_mat_clr_t cleartext, void *cleartext_raw_untyped);
 int  mbp_template_stats_to_result    (mife_pp_t pp, f2_matrix raw_result);
+
+fmpz_mat_t *mbp_template_stats_to_symbol_cleartexts(const mbp_template_stats *const stats, int global_index, int *out_len);
+void mbp_template_stats_symbol_cleartexts_clear(fmpz_mat_t *clr, int len);
 #endif /* ifndef _MBP_GLUE_H */
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mbp_plain.h"
+#include "util.h"
+
+/* whether the steps' matrices fit together, reporting the first few problems
+ * on stderr */
+static bool mbp_plain_check(const mbp_template *const t) {
+	bool success = true;
+
+	if(0 == t->steps_len) {
+		fprintf(stderr, "the template has no steps\n");
+		return false;
+	}
+	for(unsigned int i = 0; i < t->steps_len; i++) {
+		const mbp_step *const step = t->steps + i;
+		if(0 == step->symbols_len) {
+			fprintf(stderr, "step %u has no symbols\n", i);
+			success = false;
+			continue;
+		}
+		const f2_matrix *const first = step->matrix;
+		for(unsigned int j = 1; j < step->symbols_len; j++) {
+			if(step->matrix[j].num_rows != first->num_rows || step->matrix[j].num_cols != first->num_cols) {
+				fprintf(stderr, "step %u: the matrix for %s is %ux%u, but the one for %s is %ux%u\n",
+				        i, step->symbols[j], step->matrix[j].num_rows, step->matrix[j].num_cols,
+				        step->symbols[0], first->num_rows, first->num_cols);
+				success = false;
+			}
+		}
+		if(i+1 < t->steps_len && 0 < t->steps[i+1].symbols_len && first->num_cols != t->steps[i+1].matrix->num_rows) {
+			fprintf(stderr, "step %u has %u columns, but step %u has %u rows\n",
+			        i, first->num_cols, i+1, t->steps[i+1].matrix->num_rows);
+			success = false;
+		}
+	}
+	if(!success) return false;
+
+	/* eval copes with this by ignoring entries without labels, so it is only
+	 * worth a warning */
+	const unsigned int num_rows = t->steps[0].matrix->num_rows;
+	const unsigned int num_cols = t->steps[t->steps_len-1].matrix->num_cols;
+	if(t->outputs.num_rows != num_rows || t->outputs.num_cols != num_cols)
+		fprintf(stderr, "warning: the outputs are %ux%u, but the product is %ux%u\n",
+		        t->outputs.num_rows, t->outputs.num_cols, num_rows, num_cols);
+	return true;
+}
+
+bool mbp_plain_init(mbp_plain *const p, const mbp_template *const template) {
+	const unsigned int steps_len = template->steps_len;
+	unsigned int i, j;
+
+	p->template = template;
+	p->matrices = NULL;
+	p->products = NULL;
+	if(!mbp_plain_check(template)) return false;
+
+	/* calloc, so that mbp_plain_clear can tell what was never allocated */
+	if(NULL == (p->matrices = calloc(steps_len, sizeof(*p->matrices))) ||
+	   NULL == (p->products = calloc(steps_len, sizeof(*p->products))))
+		goto fail;
+
+	const unsigned int num_rows = template->steps[0].matrix->num_rows;
+	for(i = 0; i < steps_len; i++) {
+		const mbp_step *const step = template->steps + i;
+		if(NULL == (p->matrices[i] = calloc(step->symbols_len, sizeof(*p->matrices[i]))))
+			goto fail;
+		for(j = 0; j < step->symbols_len; j++)
+			if(!f2_bitmat_from_matrix(p->matrices[i] + j, step->matrix[j]))
+				goto fail;
+		/* the first step's matrix is its own product */
+		if(i > 0 && !f2_bitmat_init(p->products + i, num_rows, step->matrix->num_cols))
+			goto fail;
+	}
+	return true;
+
+fail:
+	fprintf(stderr, "out of memory while compiling template\n");
+	mbp_plain_clear(p);
+	return false;
+}
+
+void mbp_plain_clear(mbp_plain *const p) {
+	if(NULL != p->matrices) {
+		for(unsigned int i = 0; i < p->template->steps_len; i++) {
+			if(NULL == p->matrices[i]) continue;
+			/* calloc left the ones never converted with NULL bits */
+			for(unsigned int j = 0; j < p->template->steps[i].symbols_len; j++)
+				f2_bitmat_free(p->matrices[i][j]);
+			free(p->matrices[i]);
+		}
+		free(p->matrices);
+	}
+	if(NULL != p->products) {
+		for(unsigned int i = 0; i < p->template->steps_len; i++)
+			f2_bitmat_free(p->products[i]);
+		free(p->products);
+	}
+	p->matrices = NULL;
+	p->products = NULL;
+}
+
+bool mbp_plain_symbols(const mbp_plain *const p, const mbp_plaintext *const pt, int *const symbols) {
+	const mbp_template *const t = p->template;
+	bool success = true;
+
+	if(t->steps_len != pt->symbols_len) {
+		fprintf(stderr, "the plaintext has %u symbols, but the template has %u steps\n",
+		        pt->symbols_len, t->steps_len);
+		return false;
+	}
+	for(unsigned int i = 0; i < t->steps_len; i++) {
+		if(0 > (symbols[i] = mbp_step_symbol_index(t->steps + i, pt->symbols[i]))) {
+			fprintf(stderr, "the plaintext symbol %s at index %u is unknown\n", pt->symbols[i], i);
+			success = false;
+		}
+	}
+	return success;
+}
+
+const f2_bitmat *mbp_plain_eval(mbp_plain *const p, const int *const symbols) {
+	const f2_bitmat *product = p->matrices[0] + symbols[0];
+	for(unsigned int i = 1; i < p->template->steps_len; i++) {
+		f2_bitmat_mul(p->products + i, product, p->matrices[i] + symbols[i]);
+		product = p->products + i;
+	}
+	return product;
+}
@@ -0,0 +1,31 @@
+#ifndef _MIFE_MBP_PLAIN_H
+#define _MIFE_MBP_PLAIN_H
+
+#include "f2_bitmat.h"
+#include "mbp_types.h"
+
+/* A template compiled for evaluating directly on plaintexts, with no keys or
+ * encodings involved: every symbol's matrix is bit-packed once up front, and
+ * each evaluation is a chain of f2_bitmat_mul into products allocated once.
+ * Evaluations write into the products, so each thread needs its own. */
+typedef struct {
+	const mbp_template *template;
+	f2_bitmat **matrices; /* for each step, one per symbol */
+	f2_bitmat *products;  /* products[i] is the product of steps 0 through i */
+} mbp_plain;
+
+/* Checks that the template's matrices fit together -- every symbol at a step
+ * has the same shape, and each step's columns match the next step's rows --
+ * describing any problem on stderr, and compiles it if so. The template must
+ * outlive p. */
+bool mbp_plain_init(mbp_plain *const p, const mbp_template *const template);
+void mbp_plain_clear(mbp_plain *const p);
+
+/* sets symbols[i] to the index of pt's symbol at step i; returns false, and
+ * says why on stderr, if pt does not fit the template */
+bool mbp_plain_symbols(const mbp_plain *const p, const mbp_plaintext *const pt, int *const symbols);
+/* the product of the matrices symbols picks; it belongs to p, and is only good
+ * until the next evaluation */
+const f2_bitmat *mbp_plain_eval(mbp_plain *const p, const int *const symbols);
+
+#endif /* ifndef _MIFE_MBP_PLAIN_H */
@@ -47,6 +47,20 @@ void f2_matrix_free(f2_matrix m) {
   }
 }
 
+bool f2_matrix_to_state_map(const f2_matrix m, unsigned int *const map) {
+  for(unsigned int i = 0; i < m.num_rows; i++) {
+    unsigned int ones = 0;
+    for(unsigned int j = 0; j < m.num_cols; j++) {
+      if(m.elems[i][j]) {
+        map[i] = j;
+        ones++;
+      }
+    }
+    if(1 != ones) return false;
+  }
+  return true;
+}
+
 void f2_mbp_free(f2_mbp mbp) {
 	unsigned int i;
 	if(NULL != mbp.matrices) {
@@ -86,6 +100,14 @@ void mbp_step_free(mbp_step s) {
 	if(NULL != s.position) free(s.position);
 }
 
+int mbp_step_symbol_index(const mbp_step *const s, const char *const symbol) {
+	unsigned int i;
+	for(i = 0; i < s->symbols_len; i++)
+		if(!strcmp(s->symbols[i], symbol))
+			return i;
+	return -1;
+}
+
 void mbp_template_free(mbp_template t) {
 	unsigned int i;
 	if(NULL != t.steps) {
@@ -105,6 +127,12 @@ void mbp_plaintext_free(mbp_plaintext pt) {
 	}
 }
 
+void mbp_plaintext_record_free(mbp_plaintext_record r) {
+	mbp_plaintext_free(r.pt);
+	free(r.uid);
+	free(r.partition);
+}
+
 bool mbp_template_instantiate(const mbp_template *const t, const mbp_plaintext *const pt, f2_mbp *const mbp) {
 	if(t->steps_len != pt->symbols_len) return false;
 	if(ALLOC_FAILS(mbp->matrices, t->steps_len))
@@ -13,6 +13,13 @@ bool f2_matrix_copy(f2_matrix *const dest, const f2_matrix src);
 bool f2_matrix_zero(f2_matrix *const dest, const unsigned int num_rows, const unsigned int num_cols);
 void f2_matrix_free(f2_matrix m);
 
+/* Matrices with exactly one 1 in each row are transition functions of a
+ * finite state machine (permutation matrices are the special case where the
+ * function is a bijection). Returns true iff m is one, and if so sets
+ * map[i] to the column of the 1 in row i; map must have room for
+ * m.num_rows entries. */
+bool f2_matrix_to_state_map(const f2_matrix m, unsigned int *const map);
+
 /* an invariant is that `matrices[i].num_cols == matrices[i+1].num_rows` */
 typedef struct {
 	unsigned int matrices_len;
@@ -30,7 +37,9 @@ void string_matrix_free(string_matrix m);
 
 /* A template describes how to choose an MBP from a plaintext. A template has:
  * * a sequence of steps
- * * a description of the result of the computation
+ * * a description of the result of the computation: a label for each entry of
+ *   the product, where the empty string marks an entry nobody cares about
+ * * optionally, a promise that at most one labelled entry is ever non-zero
  *
  * Each step of the computation can be thought of as taking a step in a finite
  * state machine. In the language of finite state machines, a step has:
@@ -52,9 +61,12 @@ typedef struct {
 	unsigned int steps_len;
 	mbp_step *steps;
 	string_matrix outputs;
+	bool single_output;
 } mbp_template;
 
 void mbp_step_free(mbp_step s);
+/* the index of the given symbol in s.symbols, or -1 if it is not there */
+int mbp_step_symbol_index(const mbp_step *const s, const char *const symbol);
 void mbp_template_free(mbp_template t);
 
 /* For our purposes, a plaintext is a sequence of symbols and nothing more.
@@ -86,6 +98,19 @@ typedef struct {
 
 void mbp_plaintext_free(mbp_plaintext pt);
 
+/* A plaintext record is what the encrypt tool consumes: a plaintext, plus
+ * optionally the uid the record should be stored under and the partition
+ * (a base-10 number) it should be encoded with. Missing fields are NULL, and
+ * the tool picks values for them.
+ */
+typedef struct {
+	mbp_plaintext pt;
+	char *uid;
+	char *partition;
+} mbp_plaintext_record;
+
+void mbp_plaintext_record_free(mbp_plaintext_record r);
+
 /* Choose the matrices from a template that correspond to a particular plaintext.
  * Inputs a template t and plaintext pt.
  * Outputs a matrix branching program mbp.
@@ -5,6 +5,23 @@ int NUM_ENCODINGS_GENERATED;
 int PRINT_ENCODING_PROGRESS;
 int NUM_ENCODINGS_TOTAL;
 
+/* gathers the (i, j) entries of ct into one batch of zero-tests */
+static bool
+mife_zt_gather(const mmap_enc_mat_struct *ct, int n, const int *is, const int *js,
+               mmap_enc ***encs, bool **nonzero)
+{
+    *encs = NULL;
+    *nonzero = NULL;
+    /* allocate at least one entry, so that NULL always means failure */
+    if(ALLOC_FAILS(*encs, n+1) || ALLOC_FAILS(*nonzero, n+1)) {
+        free(*encs);
+        return false;
+    }
+    for(int k = 0; k < n; k++)
+        (*encs)[k] = ct->m[is[k]][js[k]];
+    return true;
+}
+
 f2_matrix
 mife_zt_all(const_mmap_vtable mmap, const mife_pp_t pp, mmap_enc_mat_t ct)
 {
@@ -12,12 +29,67 @@ mife_zt_all(const_mmap_vtable mmap, const mife_pp_t pp, mmap_enc_mat_t ct)
     if(!f2_matrix_zero(&pt, ct->nrows, ct->ncols))
         return pt;
 
+    const int n = ct->nrows * ct->ncols;
+    int *is, *js;
+    mmap_enc **encs;
+    bool *nonzero;
+    if(ALLOC_FAILS(is, n+1) || ALLOC_FAILS(js, n+1)) assert(false);
+    for(int k = 0; k < n; k++) {
+        is[k] = k / ct->ncols;
+        js[k] = k % ct->ncols;
+    }
+    if(!mife_zt_gather(ct, n, is, js, &encs, &nonzero)) assert(false);
+
+    mife_zt_batch(mmap, pp, n, encs, nonzero, false);
+    for(int k = 0; k < n; k++)
+        pt.elems[is[k]][js[k]] = nonzero[k];
+
+    free(nonzero);
+    free(encs);
+    free(is);
+    free(js);
+    return pt;
+}
+
+/* Zero-tests just the entries of a product that someone cares about. ct holds
+ * only rows[0..ct->nrows) and cols[0..ct->ncols) of the product, and only the
+ * entries marked in want are tested; the result has want's shape, and every
+ * untested entry reads as zero. With first_only, testing stops once some
+ * entry is non-zero. */
+f2_matrix
+mife_zt_select(const_mmap_vtable mmap, const mife_pp_t pp, mmap_enc_mat_t ct,
+               const f2_matrix want, const unsigned int *rows,
+               const unsigned int *cols, bool first_only)
+{
+    f2_matrix pt;
+    if(!f2_matrix_zero(&pt, want.num_rows, want.num_cols))
+        return pt;
+
+    int n = 0, *is, *js;
+    mmap_enc **encs;
+    bool *nonzero;
+    if(ALLOC_FAILS(is, ct->nrows * ct->ncols + 1) ||
+       ALLOC_FAILS(js, ct->nrows * ct->ncols + 1))
+        assert(false);
     for(int i = 0; i < ct->nrows; i++) {
         for(int j = 0; j < ct->ncols; j++) {
-            pt.elems[i][j] = !mmap->enc->is_zero(ct->m[i][j], pp->params_ref);
+            if(want.elems[rows[i]][cols[j]]) {
+                is[n] = i;
+                js[n] = j;
+                n++;
+            }
         }
     }
+    if(!mife_zt_gather(ct, n, is, js, &encs, &nonzero)) assert(false);
 
+    mife_zt_batch(mmap, pp, n, encs, nonzero, first_only);
+    for(int k = 0; k < n; k++)
+        pt.elems[rows[is[k]]][cols[js[k]]] = nonzero[k];
+
+    free(nonzero);
+    free(encs);
+    free(is);
+    free(js);
     return pt;
 }
 
@@ -55,11 +127,93 @@ static void fmpz_rand_mat_square_aes(fmpz_mat_t m, int dim, aes_randstate_t rand
   }
 }
 
+/**
+ * Draws the LDU decomposition of a Kilian randomizer into the dim x dim
+ * matrix F: the strictly lower part of F is L (with an implicit unit
+ * diagonal), the strictly upper part is U (likewise), and the diagonal is D.
+ * Every entry is uniform, except that D is redrawn until it is invertible.
+ *
+ * Every matrix whose leading principal minors are all nonzero has exactly one
+ * such decomposition, so this makes R = L*D*U uniform on all but roughly a
+ * dim/p fraction of GL_dim(p).
+ */
+static void mife_kilian_sample_ldu(mife_pp_t pp, fmpz_mat_t F,
+    aes_randstate_t randstate) {
+  const int dim = F->r;
+  fmpz_rand_mat_square_aes(F, dim, randstate, pp->p);
+  for(int i = 0; i < dim; i++) {
+    while(fmpz_is_zero(fmpz_mat_entry(F, i, i)))
+      fmpz_randm_aes(fmpz_mat_entry(F, i, i), randstate, pp->p);
+  }
+}
+
+/**
+ * Replaces the decomposition drawn by mife_kilian_sample_ldu in R with the
+ * randomizer itself, R = L*D*U, and sets R_inv = U^-1 * D^-1 * L^-1; the
+ * inverse of each factor is cheap and always exists.
+ */
+static void mife_kilian_pair_from_ldu(const modp_ctx_t ctx, fmpz_mat_t R,
+    fmpz_mat_t R_inv) {
+  const int dim = R->r;
+  fmpz_mat_t F, L, DU;
+  fmpz_t d_inv;
+
+  /* R = L * (D*U) */
+  fmpz_mat_init_set(F, R);
+  fmpz_mat_init(L, dim, dim);
+  fmpz_mat_init(DU, dim, dim);
+  for(int i = 0; i < dim; i++) {
+    fmpz_one(fmpz_mat_entry(L, i, i));
+    fmpz_set(fmpz_mat_entry(DU, i, i), fmpz_mat_entry(F, i, i));
+    for(int j = 0; j < i; j++)
+      fmpz_set(fmpz_mat_entry(L, i, j), fmpz_mat_entry(F, i, j));
+    for(int j = i+1; j < dim; j++)
+      fmpz_mul(fmpz_mat_entry(DU, i, j), fmpz_mat_entry(F, i, i), fmpz_mat_entry(F, i, j));
+  }
+  modp_mat_mul(ctx, R, L, DU);
+
+  /* R_inv = U^-1 * (D^-1 * L^-1); reuse L and DU as scratch space */
+  modp_mat_unit_lower_inv(ctx, L, F);
+  fmpz_init(d_inv);
+  for(int i = 0; i < dim; i++) {
+    fmpz_invmod(d_inv, fmpz_mat_entry(F, i, i), ctx->p);
+    for(int j = 0; j < dim; j++)
+      fmpz_mul(fmpz_mat_entry(L, i, j), fmpz_mat_entry(L, i, j), d_inv);
+  }
+  fmpz_clear(d_inv);
+  modp_mat_unit_upper_inv(ctx, DU, F);
+  modp_mat_mul(ctx, R_inv, DU, L);
+
+  fmpz_mat_clear(F);
+  fmpz_mat_clear(L);
+  fmpz_mat_clear(DU);
+}
+
+void mife_kilian_pair_init(mife_pp_t pp, int dim, fmpz_mat_t R,
+    fmpz_mat_t R_inv, aes_randstate_t randstate) {
+  fmpz_mat_init(R, dim, dim);
+  fmpz_mat_init(R_inv, dim, dim);
+
+  if(pp->flags & MIFE_TRIANGULAR_KILIAN) {
+    mife_kilian_sample_ldu(pp, R, randstate);
+    mife_kilian_pair_from_ldu(pp->modp, R, R_inv);
+  } else {
+    fmpz_rand_mat_square_aes(R, dim, randstate, pp->p);
+    while(modp_mat_inv(pp->modp, R_inv, R))
+      fmpz_rand_mat_square_aes(R, dim, randstate, pp->p);
+  }
+}
+
 void mife_setup(const_mmap_vtable mmap, mife_pp_t pp, mife_sk_t sk, int L, int lambda,
                 int ncores,
     aes_randstate_t randstate) {
+  mife_setup_params(pp, L);
+  mife_setup_mmap(mmap, pp, sk, lambda, ncores, randstate);
+  mife_setup_attach_mmap(mmap, pp, sk);
+  mife_setup_kilian(pp, sk, randstate);
+}
 
-  fmpz_t *tmp;
+void mife_setup_params(mife_pp_t pp, int L) {
   pp->n = malloc(pp->num_inputs * sizeof(int));
   pp->kappa = 0;
   for(int index = 0; index < pp->num_inputs; index++) {
@@ -74,12 +228,20 @@ void mife_setup(const_mmap_vtable mmap, mife_pp_t pp, mife_sk_t sk, int L, int l
     pp->gammas[i] = 1 + (pp->n[i]-1) * (pp->L+1);
     pp->gamma += pp->gammas[i];
   }
+  pp->numR = pp->kappa - 1;
+}
 
+void mife_setup_mmap(const_mmap_vtable mmap, mife_pp_t pp, mife_sk_t sk,
+    int lambda, int ncores, aes_randstate_t randstate) {
   timer_printf("Starting MMAP secret key initialization: %d %d %d...\n",
       lambda, pp->kappa, pp->gamma);
   sk->self = malloc(mmap->sk->size);
   mmap->sk->init(sk->self, lambda, pp->kappa, pp->gamma, NULL, 1, ncores, randstate, false);
   timer_printf("Finished MMAP secret key initialization\n");
+}
+
+void mife_setup_attach_mmap(const_mmap_vtable mmap, mife_pp_t pp, mife_sk_t sk) {
+  fmpz_t *tmp;
 
   /* For const correctness, we should probably have two separate
    * _mife_pp_struct types, one for pp's read from disk and one for pp's
@@ -95,18 +257,21 @@ void mife_setup(const_mmap_vtable mmap, mife_pp_t pp, mife_sk_t sk, int L, int l
   tmp = mmap->sk->plaintext_fields(sk->self);
   fmpz_set(pp->p, tmp[0]);
   free(tmp);
+  modp_ctx_init(pp->modp, pp->p);
   timer_printf("Finished setting p");
   print_timer();
   timer_printf("\n");
+}
 
+void mife_setup_kilian(mife_pp_t pp, mife_sk_t sk, aes_randstate_t randstate) {
   // set the kilian randomizers in sk
-  pp->numR = pp->kappa - 1;
   sk->numR = pp->numR;
   int *dims = malloc(pp->numR * sizeof(int));
   pp->kilianfn(pp, dims);
 
   sk->R = malloc(sk->numR * sizeof(fmpz_mat_t));
   sk->R_inv = malloc(sk->numR * sizeof(fmpz_mat_t));
+  sk->kilian_cache = NULL;
 
   timer_printf("Starting setting Kilian matrices...\n");
   start_timer();
@@ -115,7 +280,11 @@ void mife_setup(const_mmap_vtable mmap, mife_pp_t pp, mife_sk_t sk, int L, int l
   uint64_t t_init = ggh_walltime(0);
   for (int k = 0; k < pp->numR; k++) {
     fmpz_mat_init(sk->R[k], dims[k], dims[k]);
-    fmpz_rand_mat_square_aes(sk->R[k], dims[k], randstate, pp->p);
+    /* with triangular Kilian, R[k] holds an LDU decomposition for now */
+    if(pp->flags & MIFE_TRIANGULAR_KILIAN)
+      mife_kilian_sample_ldu(pp, sk->R[k], randstate);
+    else
+      fmpz_rand_mat_square_aes(sk->R[k], dims[k], randstate, pp->p);
     timer_printf("\r    Init Progress: [%d / %d] %8.2fs", pp->numR,
         k, ggh_seconds(ggh_walltime(t_init)));
   }
@@ -123,23 +292,37 @@ void mife_setup(const_mmap_vtable mmap, mife_pp_t pp, mife_sk_t sk, int L, int l
   
   int progress_count_approx = 0;
   uint64_t t = ggh_walltime(0);
-  int *non_invertible;
-  if(ALLOC_FAILS(non_invertible, pp->numR)) assert(false);
+
+  if(pp->flags & MIFE_TRIANGULAR_KILIAN) {
 #pragma omp parallel for
-  for (int k = 0; k < pp->numR; k++) {
-    fmpz_mat_init(sk->R_inv[k], dims[k], dims[k]);
-    non_invertible[k] = fmpz_modp_matrix_inverse(sk->R_inv[k], sk->R[k], dims[k], pp->p);
-    progress_count_approx++;
-    timer_printf("\r    Inverse Computation Progress (Parallel): \
-        [%lu / %lu] %8.2fs",
-        progress_count_approx, pp->numR, ggh_seconds(ggh_walltime(t)));
-  }
-  for (int k = 0; k < pp->numR; k++) {
-    while(non_invertible[k]) {
-      timer_printf("Retrying matrix %d\n", k);
-      fmpz_rand_mat_square_aes(sk->R[k], dims[k], randstate, pp->p);
-      non_invertible[k] = fmpz_modp_matrix_inverse(sk->R_inv[k], sk->R[k], dims[k], pp->p);
+    for (int k = 0; k < pp->numR; k++) {
+      fmpz_mat_init(sk->R_inv[k], dims[k], dims[k]);
+      mife_kilian_pair_from_ldu(pp->modp, sk->R[k], sk->R_inv[k]);
+      progress_count_approx++;
+      timer_printf("\r    Factored Kilian Progress (Parallel): \
+          [%lu / %lu] %8.2fs",
+          progress_count_approx, pp->numR, ggh_seconds(ggh_walltime(t)));
+    }
+  } else {
+    int *non_invertible;
+    if(ALLOC_FAILS(non_invertible, pp->numR)) assert(false);
+#pragma omp parallel for
+    for (int k = 0; k < pp->numR; k++) {
+      fmpz_mat_init(sk->R_inv[k], dims[k], dims[k]);
+      non_invertible[k] = modp_mat_inv(pp->modp, sk->R_inv[k], sk->R[k]);
+      progress_count_approx++;
+      timer_printf("\r    Inverse Computation Progress (Parallel): \
+          [%lu / %lu] %8.2fs",
+          progress_count_approx, pp->numR, ggh_seconds(ggh_walltime(t)));
+    }
+    for (int k = 0; k < pp->numR; k++) {
+      while(non_invertible[k]) {
+        timer_printf("Retrying matrix %d\n", k);
+        fmpz_rand_mat_square_aes(sk->R[k], dims[k], randstate, pp->p);
+        non_invertible[k] = modp_mat_inv(pp->modp, sk->R_inv[k], sk->R[k]);
+      }
     }
+    free(non_invertible);
   }
   timer_printf("\n");
   timer_printf("Finished setting Kilian matrices");
@@ -179,24 +362,27 @@ int
 mife_evaluate(const_mmap_vtable mmap, mife_pp_t pp, mife_ciphertext_t *cts)
 {
     mmap_enc_mat_t tmp;
+    mmap_enc_mat_struct **mats;
+    mife_chain_plan plan;
+    int *dims;
 
-    for(int index = 1; index < pp->kappa; index++) {
+    if(ALLOC_FAILS(mats, pp->kappa) || ALLOC_FAILS(dims, pp->kappa+1))
+        assert(false);
+    for(int index = 0; index < pp->kappa; index++) {
         int i, j;
         pp->orderfn(pp, index, &i, &j);
-    
-        if(index == 1) {
-            // multiply the 0th index with the 1st index
-            int i0, j0;
-            pp->orderfn(pp, 0, &i0, &j0);
-            mmap_enc_mat_init(mmap, pp->params_ref, tmp,
-                              cts[i0]->enc[i0][j0]->nrows, cts[i]->enc[i][j]->ncols);
-            mmap_enc_mat_mul(mmap, pp->params_ref, tmp,
-                             cts[i0]->enc[i0][j0], cts[i]->enc[i][j]);
-            continue;
-        }
-
-        mmap_enc_mat_mul(mmap, pp->params_ref, tmp, tmp, cts[i]->enc[i][j]);
+        mats[index] = cts[i]->enc[i][j];
+        dims[index] = mats[index]->nrows;
     }
+    dims[pp->kappa] = mats[pp->kappa-1]->ncols;
+
+    // associate the product however is cheapest, rather than left to right
+    if(!mife_chain_plan_init(&plan, pp->kappa, dims))
+        assert(false);
+    mife_chain_mul(mmap, pp->params_ref, &plan, mats, tmp);
+    mife_chain_plan_clear(&plan);
+    free(dims);
+    free(mats);
 
     f2_matrix result = mife_zt_all(mmap, pp, tmp);
     mmap_enc_mat_clear(mmap, tmp);
@@ -218,22 +404,69 @@ void
 mife_encrypt_single(const_mmap_vtable mmap, mife_pp_t pp, mife_sk_t sk,
                     aes_randstate_t randstate, int global_index,
                     mife_mat_clr_t clr, int ***partitions, mmap_enc_mat_t dest)
+{
+    mife_encode_task task;
+    mife_encrypt_task_init(mmap, pp, sk, randstate, global_index, clr,
+                           partitions, dest, &task);
+    mife_encode_tasks(mmap, sk, 1, &task);
+    mife_encrypt_task_clear(&task);
+}
+
+void
+mife_encrypt_task_init(const_mmap_vtable mmap, mife_pp_t pp, mife_sk_t sk,
+                       aes_randstate_t randstate, int global_index,
+                       mife_mat_clr_t clr, int ***partitions,
+                       mmap_enc_mat_t dest, mife_encode_task *task)
+{
+    int position_index, local_index;
+
+    pp->orderfn(pp, global_index, &position_index, &local_index);
+    mife_encrypt_matrix_task_init(mmap, pp, sk, randstate, global_index,
+                                  clr->clr[position_index][local_index],
+                                  NULL == clr->maps ? NULL : clr->maps[position_index][local_index],
+                                  partitions, dest, task);
+}
+
+void
+mife_encrypt_matrix_task_init(const_mmap_vtable mmap, mife_pp_t pp, mife_sk_t sk,
+                              aes_randstate_t randstate, int global_index,
+                              const fmpz_mat_t clr, const unsigned int *map,
+                              int ***partitions, mmap_enc_mat_t dest,
+                              mife_encode_task *task)
 {
     int position_index, local_index;
-    fmpz_mat_t src;
+    fmpz_mat_struct *src;
 
     pp->orderfn(pp, global_index, &position_index, &local_index);
-    fmpz_mat_init_set(src, clr->clr[position_index][local_index]);
+    if(ALLOC_FAILS(src, 1)) assert(false);
+    fmpz_mat_init_set(src, clr);
+
+    /* conjugate first: the cleartext is still a 0/1 template matrix then, so
+     * we can use a precomputed conjugate if there is one, or the cheap path
+     * for transition functions */
+    if(!(pp->flags & MIFE_NO_KILIAN)) {
+        if(mife_kilian_cache_lookup(sk, global_index, src))
+            ;
+        else if(NULL != map)
+            mife_apply_kilian_map(pp, sk, map, src, global_index);
+        else
+            mife_apply_kilian(pp, sk, src, global_index);
+    }
 
+    /* the scalar randomizer commutes with the Kilian matrices, so applying
+     * it afterwards is equivalent */
     if(!(pp->flags & MIFE_NO_RANDOMIZERS))
         mife_apply_randomizer(pp, randstate, src);
 
-    if(!(pp->flags & MIFE_NO_KILIAN))
-        mife_apply_kilian(pp, sk, src, global_index);
-
     mmap_enc_mat_init(mmap, pp->params_ref, dest, src->r, src->c);
-    mife_mat_encode(mmap, pp, sk, dest, src, partitions[position_index][local_index], randstate);
-    fmpz_mat_clear(src);
+    *task = (mife_encode_task) { dest, src, partitions[position_index][local_index] };
+}
+
+void
+mife_encrypt_task_clear(mife_encode_task *task)
+{
+    fmpz_mat_clear(task->clr);
+    free(task->clr);
 }
 
 void
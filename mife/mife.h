@@ -24,6 +24,21 @@ void mife_mbp_set(
 void mife_setup(const_mmap_vtable mmap, mife_pp_t pp, mife_sk_t sk, int L, int lambda,
                 int ncores,
     aes_randstate_t randstate);
+
+/* the phases of mife_setup, for callers that want to produce (or recover)
+ * some of the key material differently: params fills in the dimensions of pp,
+ * mmap creates a fresh multilinear map key in sk, attach_mmap derives the
+ * rest of pp from sk's multilinear map key however it was obtained, and
+ * kilian generates every Kilian pair in memory */
+void mife_setup_params(mife_pp_t pp, int L);
+void mife_setup_mmap(const_mmap_vtable mmap, mife_pp_t pp, mife_sk_t sk,
+    int lambda, int ncores, aes_randstate_t randstate);
+void mife_setup_attach_mmap(const_mmap_vtable mmap, mife_pp_t pp, mife_sk_t sk);
+void mife_setup_kilian(mife_pp_t pp, mife_sk_t sk, aes_randstate_t randstate);
+/* initializes and samples a single dim x dim Kilian pair, honoring
+ * MIFE_TRIANGULAR_KILIAN; needs only the attached pp */
+void mife_kilian_pair_init(mife_pp_t pp, int dim, fmpz_mat_t R,
+    fmpz_mat_t R_inv, aes_randstate_t randstate);
 void mife_encrypt(const_mmap_vtable mmap, mife_ciphertext_t ct, void *message, mife_pp_t pp,
     mife_sk_t sk, aes_randstate_t randstate);
 int mife_evaluate(const_mmap_vtable mmap, mife_pp_t pp, mife_ciphertext_t *cts);
@@ -35,6 +50,25 @@ void mife_encrypt_single(const_mmap_vtable mmap, mife_pp_t pp, mife_sk_t sk, aes
     int global_index, mife_mat_clr_t clr, int ***partitions,
     mmap_enc_mat_t out_ct);
 void mife_encrypt_clear(mife_pp_t pp, mife_mat_clr_t clr, int ***out_partitions);
+
+/* split-phase version of mife_encrypt_single: task_init does the cleartext
+ * work for one step and describes its encodings as a task, so that the
+ * encodings of many steps (or many records) can be scheduled together with
+ * mife_encode_tasks */
+void mife_encrypt_task_init(const_mmap_vtable mmap, mife_pp_t pp, mife_sk_t sk,
+    aes_randstate_t randstate, int global_index, mife_mat_clr_t clr,
+    int ***partitions, mmap_enc_mat_t out_ct, mife_encode_task *out_task);
+/* the same, but for an arbitrary cleartext matrix at the given step rather
+ * than the one a plaintext picked; map is the matrix as a transition function
+ * (see f2_matrix_to_state_map), or NULL */
+void mife_encrypt_matrix_task_init(const_mmap_vtable mmap, mife_pp_t pp, mife_sk_t sk,
+    aes_randstate_t randstate, int global_index, const fmpz_mat_t clr,
+    const unsigned int *map, int ***partitions, mmap_enc_mat_t out_ct,
+    mife_encode_task *out_task);
+void mife_encrypt_task_clear(mife_encode_task *task);
 f2_matrix mife_zt_all(const_mmap_vtable mmap, const mife_pp_t pp, mmap_enc_mat_t m);
+f2_matrix mife_zt_select(const_mmap_vtable mmap, const mife_pp_t pp, mmap_enc_mat_t m,
+    const f2_matrix want, const unsigned int *rows, const unsigned int *cols,
+    bool first_only);
 
 #endif /* _MIFE_H_ */
@@ -3,10 +3,12 @@
 
 #include <aesrand.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <gghlite/misc.h>
 #include "mbp_types.h"
+#include "modp_mat.h"
 
 #include <mmap/mmap.h>
 
@@ -32,10 +34,18 @@ typedef enum {
   //!< pick a simple partitioning (x[0] is encoded at the universe, all others
   //are encoded at the empty set.)
   MIFE_SIMPLE_PARTITIONS  = 0x04,
+
+  //!< sample kilian randomizers in factored form, so that their inverses
+  //come for free instead of from a matrix inversion (affects setup only)
+  MIFE_TRIANGULAR_KILIAN  = 0x08,
 } mife_flag_t;
 
 struct _mife_mat_clr_struct {
   fmpz_mat_t **clr;
+  // optional: maps[i][j] describes clr[i][j] as a transition function (row k
+  // has its only 1 in column maps[i][j][k]), or is NULL. The maps are not
+  // owned by this structure.
+  unsigned int ***maps;
 };
 
 typedef struct _mife_mat_clr_struct mife_mat_clr_t[1];
@@ -46,6 +56,28 @@ struct _mife_ciphertext_struct {
 
 typedef struct _mife_ciphertext_struct mife_ciphertext_t[1];
 
+/* One matrix worth of encoding work: encode every entry of clr into the
+ * (already initialized) enc, at the index set described by group. */
+struct _mife_encode_task_struct {
+  mmap_enc_mat_struct *enc;
+  fmpz_mat_struct *clr;
+  int *group;
+};
+
+typedef struct _mife_encode_task_struct mife_encode_task;
+
+/* An association order for a product of n matrices, where matrix i is
+ * dims[i] x dims[i+1]: the product of matrices i..j (for i < j) is the
+ * product of i..split[i*n+j] with split[i*n+j]+1..j. cost is the total number
+ * of encoding multiplications, and span the number on the critical path. */
+struct _mife_chain_plan_struct {
+  int n;
+  int *split;
+  uint64_t cost, span;
+};
+
+typedef struct _mife_chain_plan_struct mife_chain_plan;
+
 struct _mife_pp_struct {
   int num_inputs; // the arity of the MBP (for comparisons, this is 2).
   int *n; // of length num_inputs
@@ -56,6 +88,7 @@ struct _mife_pp_struct {
   int numR; // number of kilian matrices. should be kappa-1
   mife_flag_t flags;
   fmpz_t p; // the prime, the order of the field
+  modp_ctx_t modp; // arithmetic mod p, in the fastest representation for p
   mmap_pp *params_ref; // the underlying multilinear map's public parameters
 
   // MBP function pointers
@@ -69,11 +102,25 @@ struct _mife_pp_struct {
 
 typedef struct _mife_pp_struct mife_pp_t[1];
 
+/* Keygen-time cache of Kilian-conjugated cleartexts. For each step k, clr[k]
+ * lists every cleartext matrix that can appear at that step (lens[k] of them),
+ * and conj[k][i] is clr[k][i] with the Kilian randomizers for step k applied.
+ */
+struct _mife_kilian_cache_struct {
+  int num_steps;
+  int *lens;
+  fmpz_mat_t **clr;
+  fmpz_mat_t **conj;
+};
+
+typedef struct _mife_kilian_cache_struct mife_kilian_cache;
+
 struct _mife_sk_struct {
   int numR;
   mmap_sk *self;
   fmpz_mat_t *R;
   fmpz_mat_t *R_inv;
+  mife_kilian_cache *kilian_cache; // NULL unless precomputed
 };
 
 typedef struct _mife_sk_struct mife_sk_t[1];
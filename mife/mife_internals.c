@@ -1,4 +1,5 @@
 #include "mife_internals.h"
+#include "util.h"
 
 #include <string.h>
 
@@ -22,6 +23,7 @@ void mife_clear_pp_read(const_mmap_vtable mmap, mife_pp_t pp) {
 
 void mife_clear_pp(mife_pp_t pp) {
   fmpz_clear(pp->p);
+  modp_ctx_clear(pp->modp);
   free(pp->n);
   free(pp->gammas);
 }
@@ -35,6 +37,10 @@ void mife_clear_sk(const_mmap_vtable mmap, mife_sk_t sk) {
   }
   free(sk->R);
   free(sk->R_inv);
+  if(NULL != sk->kilian_cache) {
+    mife_kilian_cache_clear(sk->kilian_cache);
+    free(sk->kilian_cache);
+  }
 }
 
 void mife_mat_clr_clear(mife_pp_t pp, mife_mat_clr_t met) {
@@ -43,8 +49,10 @@ void mife_mat_clr_clear(mife_pp_t pp, mife_mat_clr_t met) {
       fmpz_mat_clear(met->clr[i][j]);
     }
     free(met->clr[i]);
+    if(NULL != met->maps) free(met->maps[i]);
   }
   free(met->clr);
+  free(met->maps);
 }
 
 /* static void print_mife_mat_clr(mife_pp_t pp, mife_mat_clr_t met) { */
@@ -59,22 +67,13 @@ void mife_mat_clr_clear(mife_pp_t pp, mife_mat_clr_t met) {
 /* } */
 
 
-void fmpz_mat_scalar_mul_modp(fmpz_mat_t m, fmpz_t scalar, fmpz_t modp) {
-  for (int i = 0; i < m->r; i++) {
-    for(int j = 0; j < m->c; j++) {
-      fmpz_mul(fmpz_mat_entry(m, i, j), fmpz_mat_entry(m, i, j), scalar);
-      fmpz_mod(fmpz_mat_entry(m, i, j), fmpz_mat_entry(m, i, j), modp);
-    }
-  }
-}
-
 void mife_apply_randomizer(mife_pp_t pp, aes_randstate_t randstate, fmpz_mat_t m) {
   fmpz_t rand;
   fmpz_init(rand);
   do {
     fmpz_randm_aes(rand, randstate, pp->p);
   } while (fmpz_is_zero(rand) || fmpz_is_one(rand));
-  fmpz_mat_scalar_mul_modp(m, rand, pp->p);
+  modp_mat_scalar_mul(pp->modp, m, rand);
   fmpz_clear(rand);
 }
 
@@ -147,36 +146,82 @@ void mife_mat_encode(const_mmap_vtable mmap, mife_pp_t pp, mife_sk_t sk, mmap_en
     fmpz_mat_t m, int *group, aes_randstate_t randstate) {
   (void) pp;
   (void) randstate;
-  if (g_parallel) {
-#pragma omp parallel for schedule(dynamic,1) collapse(2)
-    for(int i = 0; i < enc->nrows; i++) {
-      for(int j = 0; j < enc->ncols; j++) {
-          fmpz_t *plaintext = malloc(sizeof(fmpz_t));
-          memcpy(plaintext, fmpz_mat_entry(m, i, j), sizeof(fmpz_t));
-          mmap->enc->encode(enc->m[i][j], sk->self, 1, plaintext, group);
-          NUM_ENCODINGS_GENERATED++;
-          timer_printf("\r    Generated encoding [%d / %d] (Time elapsed: %8.2f s)",
-              NUM_ENCODINGS_GENERATED,
-              get_NUM_ENC(),
-              get_T());
-          free(plaintext);
-      }
+  mife_encode_task task = { enc, m, group };
+  mife_encode_tasks(mmap, sk, 1, &task);
+}
+
+static void mife_encode_entry(const_mmap_vtable mmap, mife_sk_t sk,
+    mife_encode_task *task, int i, int j) {
+  fmpz_t *plaintext = malloc(sizeof(fmpz_t));
+  memcpy(plaintext, fmpz_mat_entry(task->clr, i, j), sizeof(fmpz_t));
+  mmap->enc->encode(task->enc->m[i][j], sk->self, 1, plaintext, task->group);
+#pragma omp atomic
+  NUM_ENCODINGS_GENERATED++;
+  timer_printf("\r    Generated encoding [%d / %d] (Time elapsed: %8.2f s)",
+      NUM_ENCODINGS_GENERATED,
+      get_NUM_ENC(),
+      get_T());
+  free(plaintext);
+}
+
+/**
+ * Encodes every entry of every task. Rather than parallelizing one matrix at a
+ * time -- which leaves most cores idle for the small matrices typical of
+ * templates -- all (task, row, column) triples are flattened into a single
+ * work queue that is handed out dynamically.
+ */
+void mife_encode_tasks(const_mmap_vtable mmap, mife_sk_t sk, int num_tasks,
+    mife_encode_task *tasks) {
+  mife_encode_tasks_notify(mmap, sk, num_tasks, tasks, NULL, NULL);
+}
+
+/**
+ * Like mife_encode_tasks, but calls done(context, t) as soon as the last entry
+ * of task t is encoded, from whichever thread encoded it. Entries are handed
+ * out in task order, so tasks tend to finish in order too, and the caller can
+ * start consuming early tasks while later ones are still being encoded.
+ */
+void mife_encode_tasks_notify(const_mmap_vtable mmap, mife_sk_t sk,
+    int num_tasks, mife_encode_task *tasks,
+    void (*done)(void *context, int task), void *context) {
+  /* offsets[t] is the flat index of entry (0,0) of task t */
+  int *offsets, *remaining = NULL;
+  if(ALLOC_FAILS(offsets, num_tasks+1)) assert(false);
+  if(NULL != done && ALLOC_FAILS(remaining, num_tasks)) assert(false);
+  offsets[0] = 0;
+  for(int t = 0; t < num_tasks; t++) {
+    offsets[t+1] = offsets[t] + tasks[t].enc->nrows * tasks[t].enc->ncols;
+    if(NULL != done) remaining[t] = offsets[t+1] - offsets[t];
+  }
+  const int total = offsets[num_tasks];
+
+  /* empty tasks never get an entry to finish them off */
+  if(NULL != done)
+    for(int t = 0; t < num_tasks; t++)
+      if(0 == remaining[t]) done(context, t);
+
+#pragma omp parallel for schedule(dynamic,1) if(g_parallel)
+  for(int flat = 0; flat < total; flat++) {
+    /* binary search for the task containing this entry */
+    int lo = 0, hi = num_tasks - 1;
+    while(lo < hi) {
+      const int mid = (lo + hi + 1) / 2;
+      if(offsets[mid] <= flat) lo = mid;
+      else hi = mid - 1;
     }
-  } else {
-    for(int i = 0; i < enc->nrows; i++) {
-      for(int j = 0; j < enc->ncols; j++) {
-          fmpz_t *plaintext = malloc(sizeof(fmpz_t));
-          memcpy(plaintext, fmpz_mat_entry(m, i, j), sizeof(fmpz_t));
-          mmap->enc->encode(enc->m[i][j], sk->self, 1, plaintext, group);
-          NUM_ENCODINGS_GENERATED++;
-          timer_printf("\r    Generated encoding [%d / %d] (Time elapsed: %8.2f s)",
-              NUM_ENCODINGS_GENERATED,
-              get_NUM_ENC(),
-              get_T());
-          free(plaintext);
-      }
+    const int local = flat - offsets[lo], ncols = tasks[lo].enc->ncols;
+    mife_encode_entry(mmap, sk, tasks + lo, local / ncols, local % ncols);
+
+    if(NULL != done) {
+      int left;
+#pragma omp atomic capture
+      left = --remaining[lo];
+      if(0 == left) done(context, lo);
     }
   }
+
+  free(remaining);
+  free(offsets);
 }
 
 int ***mife_partitions(mife_pp_t pp, fmpz_t index) {
@@ -237,37 +282,151 @@ void mife_partitions_clear(mife_pp_t pp, int ***groups) {
   free(groups);
 }
 
-void mife_apply_kilian(mife_pp_t pp, mife_sk_t sk, fmpz_mat_t m, int global_index) {
+/**
+ * m = R_inv * m * R, where R_inv is NULL for the first step and R is NULL for
+ * the last; these two are all a step needs, so keygen --stream can conjugate a
+ * step's matrices without the rest of the key.
+ */
+void mife_kilian_conjugate(mife_pp_t pp, const fmpz_mat_struct *R_inv,
+    const fmpz_mat_struct *R, fmpz_mat_t m) {
   fmpz_mat_t tmp;
 
+  /* the products below reduce all entries mod p as they go */
+
   // first one
-  if(global_index == 0) {
-    fmpz_mat_init(tmp, m->r, sk->R[0]->c);
-    fmpz_mat_mul(tmp, m, sk->R[0]);
+  if(NULL == R_inv) {
+    fmpz_mat_init(tmp, m->r, R->c);
+    modp_mat_mul(pp->modp, tmp, m, R);
   }
 
   // last one
-  else if(global_index == pp->kappa - 1) {
-    fmpz_mat_init(tmp, sk->R_inv[pp->numR-1]->r, m->c);
-    fmpz_mat_mul(tmp, sk->R_inv[pp->numR-1], m);
+  else if(NULL == R) {
+    fmpz_mat_init(tmp, R_inv->r, m->c);
+    modp_mat_mul(pp->modp, tmp, R_inv, m);
   }
 
   // all others
   else {
-    fmpz_mat_init(tmp, sk->R_inv[global_index-1]->r, m->c);
-    fmpz_mat_mul(tmp, sk->R_inv[global_index-1], m);
-    fmpz_mat_mul(tmp, tmp, sk->R[global_index]);
+    fmpz_mat_init(tmp, R_inv->r, m->c);
+    modp_mat_mul(pp->modp, tmp, R_inv, m);
+    modp_mat_mul(pp->modp, tmp, tmp, R);
   }
 
   fmpz_mat_set(m, tmp);
   fmpz_mat_clear(tmp);
-  
-  /* finally, reduce all entries mod p */
-  for(int i = 0; i < m->r; i++) {
-    for(int j = 0; j < m->c; j++) { 
-      fmpz_mod(fmpz_mat_entry(m, i, j), fmpz_mat_entry(m, i, j), pp->p);
-    }     
+}
+
+void mife_apply_kilian(mife_pp_t pp, mife_sk_t sk, fmpz_mat_t m, int global_index) {
+  mife_kilian_conjugate(pp,
+    0 == global_index ? NULL : sk->R_inv[global_index-1],
+    pp->kappa - 1 == global_index ? NULL : sk->R[global_index],
+    m);
+}
+
+/**
+ * Same as mife_apply_kilian, for an m that is a transition function: row k of
+ * m has its only 1 in column map[k]. Then m * R is just a gather of the rows
+ * of R, and R_inv * m just sums columns of R_inv, so at most one dense matrix
+ * multiplication is needed (none at all for the first and last steps).
+ */
+void mife_apply_kilian_map(mife_pp_t pp, mife_sk_t sk, const unsigned int *map,
+    fmpz_mat_t m, int global_index) {
+  fmpz_mat_t tmp;
+
+  // last one: column map[k] of R_inv * m accumulates column k of R_inv
+  if(global_index == pp->kappa - 1) {
+    const fmpz_mat_struct *R_inv = sk->R_inv[pp->numR-1];
+    fmpz_mat_init(tmp, R_inv->r, m->c);
+    for(int k = 0; k < m->r; k++) {
+      for(int i = 0; i < R_inv->r; i++) {
+        fmpz_add(fmpz_mat_entry(tmp, i, map[k]), fmpz_mat_entry(tmp, i, map[k]),
+                 fmpz_mat_entry(R_inv, i, k));
+      }
+    }
   }
+
+  // all others: row k of m * R is row map[k] of R
+  else {
+    const fmpz_mat_struct *R = sk->R[global_index];
+    fmpz_mat_init(tmp, m->r, R->c);
+    for(int k = 0; k < m->r; k++) {
+      for(int j = 0; j < R->c; j++) {
+        fmpz_set(fmpz_mat_entry(tmp, k, j), fmpz_mat_entry(R, map[k], j));
+      }
+    }
+
+    if(global_index != 0)
+      modp_mat_mul(pp->modp, tmp, sk->R_inv[global_index-1], tmp);
+  }
+
+  fmpz_mat_set(m, tmp);
+  fmpz_mat_clear(tmp);
+
+  /* the column sums for the last step may have grown past p */
+  modp_mat_reduce(pp->modp, m);
+}
+
+/**
+ * Precomputes the Kilian conjugates of the len cleartexts in clr, which should
+ * be every matrix that can appear at step global_index. Afterwards,
+ * mife_kilian_cache_lookup can replace mife_apply_kilian for those matrices.
+ */
+void mife_kilian_cache_set(mife_pp_t pp, mife_sk_t sk, int global_index,
+    int len, fmpz_mat_t *clr) {
+  if(NULL == sk->kilian_cache) {
+    if(ALLOC_FAILS(sk->kilian_cache, 1)) assert(false);
+    mife_kilian_cache *cache = sk->kilian_cache;
+    cache->num_steps = pp->kappa;
+    if(ALLOC_FAILS(cache->lens, pp->kappa)) assert(false);
+    if(ALLOC_FAILS(cache->clr, pp->kappa)) assert(false);
+    if(ALLOC_FAILS(cache->conj, pp->kappa)) assert(false);
+    for(int k = 0; k < pp->kappa; k++) {
+      cache->lens[k] = 0;
+      cache->clr[k] = NULL;
+      cache->conj[k] = NULL;
+    }
+  }
+
+  mife_kilian_cache *cache = sk->kilian_cache;
+  assert(global_index < cache->num_steps && 0 == cache->lens[global_index]);
+  if(ALLOC_FAILS(cache->clr[global_index], len)) assert(false);
+  if(ALLOC_FAILS(cache->conj[global_index], len)) assert(false);
+  cache->lens[global_index] = len;
+
+#pragma omp parallel for if(g_parallel)
+  for(int i = 0; i < len; i++) {
+    fmpz_mat_init_set(cache->clr[global_index][i], clr[i]);
+    fmpz_mat_init_set(cache->conj[global_index][i], clr[i]);
+    mife_apply_kilian(pp, sk, cache->conj[global_index][i], global_index);
+  }
+}
+
+/* if m is one of the cached cleartexts for its step, overwrite it with its
+ * Kilian conjugate and return true; otherwise leave it alone */
+bool mife_kilian_cache_lookup(mife_sk_t sk, int global_index, fmpz_mat_t m) {
+  const mife_kilian_cache *const cache = sk->kilian_cache;
+  if(NULL == cache || global_index >= cache->num_steps) return false;
+  for(int i = 0; i < cache->lens[global_index]; i++) {
+    if(fmpz_mat_equal(m, cache->clr[global_index][i])) {
+      fmpz_mat_set(m, cache->conj[global_index][i]);
+      return true;
+    }
+  }
+  return false;
+}
+
+void mife_kilian_cache_clear(mife_kilian_cache *cache) {
+  for(int k = 0; k < cache->num_steps; k++) {
+    for(int i = 0; i < cache->lens[k]; i++) {
+      fmpz_mat_clear(cache->clr[k][i]);
+      fmpz_mat_clear(cache->conj[k][i]);
+    }
+    free(cache->clr[k]);
+    free(cache->conj[k]);
+  }
+  free(cache->lens);
+  free(cache->clr);
+  free(cache->conj);
 }
 
 void mife_set_encodings(const_mmap_vtable mmap, mife_ciphertext_t ct, mife_mat_clr_t met, fmpz_t index,
@@ -284,30 +443,187 @@ void mife_set_encodings(const_mmap_vtable mmap, mife_ciphertext_t ct, mife_mat_c
     }
   }
 
-  // encode
+  // encode, scheduling all matrices' entries together
+  (void) randstate;
+  mife_encode_task *tasks;
+  if(ALLOC_FAILS(tasks, pp->kappa)) assert(false);
+  int num_tasks = 0;
   ct->enc = malloc(pp->num_inputs * sizeof(mmap_enc_mat_t *));
   for(int i = 0; i < pp->num_inputs; i++) {
     ct->enc[i] = malloc(pp->n[i] * mmap->enc->size);
     for(int j = 0; j < pp->n[i]; j++) {
       mmap_enc_mat_init(mmap, pp->params_ref, ct->enc[i][j],
           met->clr[i][j]->r, met->clr[i][j]->c);
-      mife_mat_encode(mmap, pp, sk, ct->enc[i][j], met->clr[i][j], groups[i][j],
-          randstate);
+      tasks[num_tasks++] = (mife_encode_task) { ct->enc[i][j], met->clr[i][j], groups[i][j] };
     }
   }
+  mife_encode_tasks(mmap, sk, num_tasks, tasks);
+  free(tasks);
 
   // free group arrays
   mife_partitions_clear(pp, groups);
 }
 
+/* Zero-tests n encodings, setting nonzero[i] iff encs[i] is not an encoding of
+ * zero. This is the one place where zero-tests happen, so that a backend that
+ * can share the multiplication by its zero-test parameter across encodings has
+ * somewhere to do it; libmmap only offers is_zero, so for now the tests just
+ * run in parallel (if g_parallel). With first_only, tests that start after a
+ * non-zero has been found are skipped and report zero. */
+void mife_zt_batch(const_mmap_vtable mmap, const mife_pp_t pp, int n,
+    mmap_enc *const *encs, bool *nonzero, bool first_only) {
+  bool found = false;
+#pragma omp parallel for schedule(dynamic,1) if(g_parallel)
+  for(int i = 0; i < n; i++) {
+    bool skip;
+#pragma omp atomic read
+    skip = found;
+    nonzero[i] = !(first_only && skip) && !mmap->enc->is_zero(encs[i], pp->params_ref);
+    if(nonzero[i] && first_only) {
+#pragma omp atomic write
+      found = true;
+    }
+  }
+}
+
 void mmap_enc_mat_zeros_print(const_mmap_vtable mmap, mife_pp_t pp, mmap_enc_mat_t m) {
+  const int n = m->nrows * m->ncols;
+  mmap_enc **encs;
+  bool *nonzero;
+  if(ALLOC_FAILS(encs, n+1) || ALLOC_FAILS(nonzero, n+1)) assert(false);
+  for(int i = 0; i < m->nrows; i++)
+    for(int j = 0; j < m->ncols; j++)
+      encs[i*m->ncols+j] = m->m[i][j];
+  mife_zt_batch(mmap, pp, n, encs, nonzero, false);
+
   for(int i = 0; i < m->nrows; i++) {
     printf("[");
     for(int j = 0; j < m->ncols; j++) {
-      printf(mmap->enc->is_zero(m->m[i][j], pp->params_ref) ? "0 " : "x " );
+      printf(nonzero[i*m->ncols+j] ? "x " : "0 " );
     }
     printf("]\n");
   }
+  free(encs);
+  free(nonzero);
+}
+
+/* The classic matrix-chain-order dynamic program, counting one unit per
+ * product of encodings. Among orders of equal total cost, the one with the
+ * cheapest critical path wins, since independent subproducts can run
+ * concurrently. */
+bool mife_chain_plan_init(mife_chain_plan *plan, int n, const int *dims) {
+  uint64_t *cost = NULL, *span = NULL;
+  plan->n = n;
+  plan->split = NULL;
+  plan->cost = plan->span = 0;
+  if(n < 1) return false;
+  if(ALLOC_FAILS(plan->split, n*n) ||
+     ALLOC_FAILS(cost, n*n) ||
+     ALLOC_FAILS(span, n*n)) {
+    free(plan->split);
+    free(cost);
+    plan->split = NULL;
+    return false;
+  }
+
+  for(int i = 0; i < n; i++) {
+    cost[i*n+i] = span[i*n+i] = 0;
+    plan->split[i*n+i] = i;
+  }
+  for(int len = 2; len <= n; len++) {
+    for(int i = 0; i+len <= n; i++) {
+      const int j = i+len-1;
+      cost[i*n+j] = span[i*n+j] = UINT64_MAX;
+      for(int k = i; k < j; k++) {
+        const uint64_t here = (uint64_t)dims[i] * dims[k+1] * dims[j+1];
+        const uint64_t c = cost[i*n+k] + cost[(k+1)*n+j] + here;
+        const uint64_t s = here +
+          (span[i*n+k] > span[(k+1)*n+j] ? span[i*n+k] : span[(k+1)*n+j]);
+        if(c < cost[i*n+j] || (c == cost[i*n+j] && s < span[i*n+j])) {
+          cost[i*n+j] = c;
+          span[i*n+j] = s;
+          plan->split[i*n+j] = k;
+        }
+      }
+    }
+  }
+
+  plan->cost = cost[n-1];
+  plan->span = span[n-1];
+  free(cost);
+  free(span);
+  return true;
+}
+
+void mife_chain_plan_clear(mife_chain_plan *plan) {
+  free(plan->split);
+  plan->split = NULL;
+}
+
+/* out = a*b, one task per entry of out; out must already be initialized */
+static void mife_chain_mul_node(const_mmap_vtable mmap, const mmap_pp *params,
+    mmap_enc_mat_struct *out, const mmap_enc_mat_struct *a,
+    const mmap_enc_mat_struct *b) {
+  const int entries = out->nrows * out->ncols;
+#pragma omp taskloop grainsize(1)
+  for(int e = 0; e < entries; e++) {
+    const int i = e / out->ncols, j = e % out->ncols;
+    mmap_enc *tmp = malloc(mmap->enc->size);
+    mmap->enc->init(tmp, params);
+    mmap->enc->mul(out->m[i][j], params, a->m[i][0], b->m[0][j]);
+    for(int k = 1; k < a->ncols; k++) {
+      mmap->enc->mul(tmp, params, a->m[i][k], b->m[k][j]);
+      mmap->enc->add(out->m[i][j], params, out->m[i][j], tmp);
+    }
+    mmap->enc->clear(tmp);
+    free(tmp);
+  }
+}
+
+/* initializes out to the product of mats[i..j], for i < j */
+static void mife_chain_mul_range(const_mmap_vtable mmap, const mmap_pp *params,
+    const mife_chain_plan *plan, mmap_enc_mat_struct *const *mats,
+    int i, int j, mmap_enc_mat_t out) {
+  const int k = plan->split[i*plan->n+j];
+  mmap_enc_mat_t left, right;
+  const mmap_enc_mat_struct *l = mats[i], *r = mats[j];
+
+  if(k > i) {
+#pragma omp task shared(left)
+    mife_chain_mul_range(mmap, params, plan, mats, i, k, left);
+    l = left;
+  }
+  if(k+1 < j) {
+#pragma omp task shared(right)
+    mife_chain_mul_range(mmap, params, plan, mats, k+1, j, right);
+    r = right;
+  }
+#pragma omp taskwait
+
+  mmap_enc_mat_init(mmap, params, out, l->nrows, r->ncols);
+  mife_chain_mul_node(mmap, params, out, l, r);
+  if(k > i) mmap_enc_mat_clear(mmap, left);
+  if(k+1 < j) mmap_enc_mat_clear(mmap, right);
+}
+
+/* Initializes out to the product of the plan->n matrices in mats, in the
+ * order given by the plan. Independent subproducts, and the entries of each
+ * product, are computed concurrently (if g_parallel). The inputs are only
+ * read. */
+void mife_chain_mul(const_mmap_vtable mmap, const mmap_pp *params,
+    const mife_chain_plan *plan, mmap_enc_mat_struct *const *mats,
+    mmap_enc_mat_t out) {
+  if(1 == plan->n) {
+    mmap_enc_mat_init(mmap, params, out, mats[0]->nrows, mats[0]->ncols);
+    for(int i = 0; i < out->nrows; i++)
+      for(int j = 0; j < out->ncols; j++)
+        mmap->enc->set(out->m[i][j], mats[0]->m[i][j]);
+    return;
+  }
+
+#pragma omp parallel if(g_parallel)
+#pragma omp single
+  mife_chain_mul_range(mmap, params, plan, mats, 0, plan->n-1, out);
 }
 
 void set_NUM_ENC(int val) {
@@ -25,7 +25,16 @@ int ***mife_partitions(mife_pp_t pp, fmpz_t index);
 
 void mife_partitions_clear(mife_pp_t pp, int ***partitions);
 
+void mife_kilian_conjugate(mife_pp_t pp, const fmpz_mat_struct *R_inv,
+                           const fmpz_mat_struct *R, fmpz_mat_t m);
 void mife_apply_kilian(mife_pp_t pp, mife_sk_t sk, fmpz_mat_t m, int global_index);
+void mife_apply_kilian_map(mife_pp_t pp, mife_sk_t sk, const unsigned int *map,
+                           fmpz_mat_t m, int global_index);
+
+void mife_kilian_cache_set(mife_pp_t pp, mife_sk_t sk, int global_index,
+                           int len, fmpz_mat_t *clr);
+bool mife_kilian_cache_lookup(mife_sk_t sk, int global_index, fmpz_mat_t m);
+void mife_kilian_cache_clear(mife_kilian_cache *cache);
 
 void mife_set_encodings       (const_mmap_vtable mmap, mife_ciphertext_t ct,
                                mife_mat_clr_t met, fmpz_t index, mife_pp_t pp,
@@ -38,8 +47,23 @@ void mife_gen_partitioning    (int *partitioning, fmpz_t index, int L, int nu);
 void mife_mat_encode          (const_mmap_vtable mmap, mife_pp_t pp,
                                mife_sk_t sk, mmap_enc_mat_t enc, fmpz_mat_t m,
                                int *group, aes_randstate_t randstate);
+void mife_encode_tasks        (const_mmap_vtable mmap, mife_sk_t sk,
+                               int num_tasks, mife_encode_task *tasks);
+void mife_encode_tasks_notify (const_mmap_vtable mmap, mife_sk_t sk,
+                               int num_tasks, mife_encode_task *tasks,
+                               void (*done)(void *context, int task),
+                               void *context);
+void mife_zt_batch            (const_mmap_vtable mmap, const mife_pp_t pp,
+                               int n, mmap_enc *const *encs, bool *nonzero,
+                               bool first_only);
 void mmap_enc_mat_zeros_print (const_mmap_vtable mmap, mife_pp_t pp,
                                mmap_enc_mat_t m);
+bool mife_chain_plan_init     (mife_chain_plan *plan, int n, const int *dims);
+void mife_chain_plan_clear    (mife_chain_plan *plan);
+void mife_chain_mul           (const_mmap_vtable mmap, const mmap_pp *params,
+                               const mife_chain_plan *plan,
+                               mmap_enc_mat_struct *const *mats,
+                               mmap_enc_mat_t out);
 void mife_ciphertext_clear    (const_mmap_vtable mmap, mife_pp_t pp, mife_ciphertext_t ct);
 void message_to_dary          (ulong *dary, int bitstring_len, fmpz_t message, int d);
 
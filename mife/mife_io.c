@@ -1,4 +1,13 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <mmap/mmap_clt.h>
+#include <mmap/mmap_gghlite.h>
 #include "mife_io.h"
+#include "util.h"
 
 /**
  *
@@ -57,6 +66,7 @@ void fread_mife_pp(const_mmap_vtable mmap, mife_pp_t pp, char *filepath) {
   pp->flags = flag_int;
   fmpz_init(pp->p);
   fmpz_inp_raw(pp->p, fp);
+  modp_ctx_init(pp->modp, pp->p);
   CHECK(fscanf(fp, "\n"), 0);
 
   pp->params_ref = malloc(mmap->pp->size);
@@ -64,18 +74,22 @@ void fread_mife_pp(const_mmap_vtable mmap, mife_pp_t pp, char *filepath) {
   fclose(fp);
 }
 
+void fwrite_mife_kilian_pair(FILE *fp, fmpz_mat_t R, fmpz_mat_t R_inv) {
+  fprintf(fp, "%ld %ld\n", R->r, R->c);
+  fmpz_mat_fprint_raw(fp, R);
+  fprintf(fp, "\n");
+  fprintf(fp, "%ld %ld\n", R_inv->r, R_inv->c);
+  fmpz_mat_fprint_raw(fp, R_inv);
+  fprintf(fp, "\n");
+}
+
 void fwrite_mife_sk(const_mmap_vtable mmap, mife_sk_t sk, char *filepath) {
   uint64_t t = ggh_walltime(0);
   FILE *fp = fopen(filepath, "wb");
   timer_printf("Starting writing Kilian matrices...\n");
   fprintf(fp, "%d\n", sk->numR);
   for(int i = 0; i < sk->numR; i++) {
-    fprintf(fp, "%ld %ld\n", sk->R[i]->r, sk->R[i]->c);
-    fmpz_mat_fprint_raw(fp, sk->R[i]);
-    fprintf(fp, "\n");
-    fprintf(fp, "%ld %ld\n", sk->R_inv[i]->r, sk->R_inv[i]->c);
-    fmpz_mat_fprint_raw(fp, sk->R_inv[i]);
-    fprintf(fp, "\n");
+    fwrite_mife_kilian_pair(fp, sk->R[i], sk->R_inv[i]);
   timer_printf("\r    Progress: [%lu / %lu] %8.2fs",
     i, sk->numR, ggh_seconds(ggh_walltime(t)));
 
@@ -97,6 +111,7 @@ void fread_mife_sk(const_mmap_vtable mmap, mife_sk_t sk, char *filepath) {
   CHECK(fscanf(fp, "%d\n", &sk->numR), 1);
   sk->R = malloc(sk->numR * sizeof(fmpz_mat_t));
   sk->R_inv = malloc(sk->numR * sizeof(fmpz_mat_t));
+  sk->kilian_cache = NULL;
 
   for(int i = 0; i < sk->numR; i++) {
     unsigned long r1, c1, r2, c2;
@@ -121,6 +136,57 @@ void fread_mife_sk(const_mmap_vtable mmap, mife_sk_t sk, char *filepath) {
   fclose(fp);
 }
 
+void fwrite_mife_kilian_cache_step(FILE *fp, int len, fmpz_mat_t *clr, fmpz_mat_t *conj) {
+  fprintf(fp, "%d\n", len);
+  for(int i = 0; i < len; i++) {
+    fprintf(fp, "%ld %ld\n", clr[i]->r, clr[i]->c);
+    fmpz_mat_fprint_raw(fp, clr[i]);
+    fprintf(fp, "\n");
+    fmpz_mat_fprint_raw(fp, conj[i]);
+    fprintf(fp, "\n");
+  }
+}
+
+void fwrite_mife_kilian_cache(mife_kilian_cache *cache, char *filepath) {
+  FILE *fp = fopen(filepath, "wb");
+  fprintf(fp, "%d\n", cache->num_steps);
+  for(int k = 0; k < cache->num_steps; k++)
+    fwrite_mife_kilian_cache_step(fp, cache->lens[k], cache->clr[k], cache->conj[k]);
+  fclose(fp);
+}
+
+/* the cache is optional, so a missing file is not an error: returns false
+ * and leaves sk->kilian_cache NULL */
+bool fread_mife_kilian_cache(mife_sk_t sk, char *filepath) {
+  FILE *fp = fopen(filepath, "rb");
+  if(NULL == fp) return false;
+
+  mife_kilian_cache *cache = malloc(sizeof(mife_kilian_cache));
+  CHECK(fscanf(fp, "%d\n", &cache->num_steps), 1);
+  cache->lens = malloc(cache->num_steps * sizeof(int));
+  cache->clr  = malloc(cache->num_steps * sizeof(fmpz_mat_t *));
+  cache->conj = malloc(cache->num_steps * sizeof(fmpz_mat_t *));
+  for(int k = 0; k < cache->num_steps; k++) {
+    CHECK(fscanf(fp, "%d\n", &cache->lens[k]), 1);
+    cache->clr[k]  = malloc(cache->lens[k] * sizeof(fmpz_mat_t));
+    cache->conj[k] = malloc(cache->lens[k] * sizeof(fmpz_mat_t));
+    for(int i = 0; i < cache->lens[k]; i++) {
+      unsigned long r, c;
+      CHECK(fscanf(fp, "%lu %lu\n", &r, &c), 2);
+      fmpz_mat_init(cache->clr[k][i], r, c);
+      fmpz_mat_fread_raw(fp, cache->clr[k][i]);
+      CHECK(fscanf(fp, "\n"), 0);
+      fmpz_mat_init(cache->conj[k][i], r, c);
+      fmpz_mat_fread_raw(fp, cache->conj[k][i]);
+      CHECK(fscanf(fp, "\n"), 0);
+    }
+  }
+  fclose(fp);
+
+  sk->kilian_cache = cache;
+  return true;
+}
+
 void fwrite_mife_ciphertext(const_mmap_vtable mmap, mife_pp_t pp, mife_ciphertext_t ct, char *filepath) {
   FILE *fp = fopen(filepath, "wb");
   for(int i = 0; i < pp->num_inputs; i++) {
@@ -173,3 +239,208 @@ void fread_mmap_enc_mat(const_mmap_vtable mmap, mmap_enc_mat_t m, FILE *fp) {
   }
 }
 
+
+mife_backend mife_backend_of(const_mmap_vtable mmap) {
+  if(mmap == &gghlite_vtable) return MIFE_BACKEND_GGHLITE;
+  if(mmap == &clt_vtable) return MIFE_BACKEND_CLT13;
+  return MIFE_BACKEND_UNKNOWN;
+}
+
+/* The offsets aren't known until the entries have been written, so space is
+ * reserved for the header and offset table first and they are filled in at
+ * the end; fp must therefore be seekable. */
+bool fwrite_mmap_enc_mat_bin(const_mmap_vtable mmap, mmap_enc_mat_t m, int step, FILE *fp) {
+  const size_t num_entries = (size_t)m->nrows * m->ncols;
+  const size_t table_size = sizeof(mife_enc_mat_header) + (num_entries+1) * sizeof(uint64_t);
+  mife_enc_mat_header header = {
+    .magic = MIFE_ENC_MAT_MAGIC,
+    .version = MIFE_ENC_MAT_VERSION,
+    .byte_order = MIFE_ENC_MAT_BYTE_ORDER,
+    .backend = mife_backend_of(mmap),
+    .nrows = m->nrows,
+    .ncols = m->ncols,
+    .step = step,
+    .size = 0
+  };
+  uint64_t *offsets;
+  const long start = ftell(fp);
+  bool success = false;
+
+  if(start < 0 || NULL == (offsets = calloc(num_entries+1, sizeof(*offsets)))) return false;
+  if(1 != fwrite(&header, sizeof(header), 1, fp) ||
+     num_entries+1 != fwrite(offsets, sizeof(*offsets), num_entries+1, fp))
+    goto free_offsets;
+
+  offsets[0] = table_size;
+  for(int i = 0; i < m->nrows; i++) {
+    for(int j = 0; j < m->ncols; j++) {
+      mmap->enc->fwrite(m->m[i][j], fp);
+      offsets[i*m->ncols + j + 1] = ftell(fp) - start;
+    }
+  }
+  header.size = offsets[num_entries];
+
+  if(0 != fseek(fp, start, SEEK_SET) ||
+     1 != fwrite(&header, sizeof(header), 1, fp) ||
+     num_entries+1 != fwrite(offsets, sizeof(*offsets), num_entries+1, fp) ||
+     0 != fseek(fp, start + header.size, SEEK_SET))
+    goto free_offsets;
+  success = !ferror(fp);
+
+free_offsets:
+  free(offsets);
+  return success;
+}
+
+/* the k-th entry of the offset table; a matrix inside a packed record can
+ * start at any byte, so nothing in the framing is read in place */
+static uint64_t mmap_enc_mat_bin_offset(const void *data, uint64_t k) {
+  uint64_t offset;
+  memcpy(&offset, (const char *)data + sizeof(mife_enc_mat_header) + k*sizeof(offset), sizeof(offset));
+  return offset;
+}
+
+/* Checks everything about the framing that can be checked without asking the
+ * backend, so that a truncated or mismatched file is rejected before any
+ * allocation happens. On success, the header is copied to *header. */
+static bool mmap_enc_mat_bin_valid(const_mmap_vtable mmap, int step, const void *data, size_t len, mife_enc_mat_header *header) {
+  if(len < sizeof(*header) || 0 != memcmp(data, MIFE_ENC_MAT_MAGIC, sizeof(header->magic))) {
+    fprintf(stderr, "not an encoded matrix (bad magic number)\n");
+    return false;
+  }
+  memcpy(header, data, sizeof(*header));
+  if(MIFE_ENC_MAT_VERSION != header->version || MIFE_ENC_MAT_BYTE_ORDER != header->byte_order) {
+    fprintf(stderr, "unsupported encoded matrix version %u (or byte order)\n", header->version);
+    return false;
+  }
+  if(mife_backend_of(mmap) != header->backend) {
+    fprintf(stderr, "encoded matrix was made with a different multilinear map\n");
+    return false;
+  }
+  if(step >= 0 && step != header->step) {
+    fprintf(stderr, "expected an encoding of step %d, but found step %d\n", step, header->step);
+    return false;
+  }
+
+  /* bound the dimensions by what len could hold before computing anything
+   * from them, so that neither the table size nor an int row count overflows */
+  const uint64_t num_entries = (uint64_t)header->nrows * header->ncols;
+  const uint64_t max_offsets = (len - sizeof(*header)) / sizeof(uint64_t);
+  if(header->nrows > INT_MAX || header->ncols > INT_MAX || 0 == max_offsets || num_entries > max_offsets - 1) {
+    fprintf(stderr, "encoded matrix has impossible dimensions %ux%u\n", header->nrows, header->ncols);
+    return false;
+  }
+  const uint64_t table_size = sizeof(*header) + (num_entries+1) * sizeof(uint64_t);
+  if(header->size > len || table_size > header->size) {
+    fprintf(stderr, "encoded matrix is truncated\n");
+    return false;
+  }
+  uint64_t offset = mmap_enc_mat_bin_offset(data, 0), next;
+  if(offset != table_size || mmap_enc_mat_bin_offset(data, num_entries) != header->size) {
+    fprintf(stderr, "encoded matrix has a corrupt offset table\n");
+    return false;
+  }
+  for(uint64_t k = 0; k < num_entries; k++, offset = next) {
+    if(offset >= (next = mmap_enc_mat_bin_offset(data, k+1))) {
+      fprintf(stderr, "encoded matrix has a corrupt offset table\n");
+      return false;
+    }
+  }
+  return true;
+}
+
+bool mmap_enc_mat_from_bin(const_mmap_vtable mmap, mmap_enc_mat_t m, int step, const void *data, size_t len) {
+  mife_enc_mat_header header;
+  const char *const base = data;
+  int i, j;
+
+  if(!mmap_enc_mat_bin_valid(mmap, step, data, len, &header)) return false;
+
+  m->nrows = header.nrows;
+  m->ncols = header.ncols;
+  if(ALLOC_FAILS(m->m, m->nrows)) goto fail;
+  for(i = 0; i < m->nrows; i++) {
+    if(ALLOC_FAILS(m->m[i], m->ncols)) goto fail_rows;
+    for(j = 0; j < m->ncols; j++) {
+      const uint64_t k = (uint64_t)i*m->ncols + j;
+      const uint64_t offset = mmap_enc_mat_bin_offset(data, k);
+      /* fmemopen wants a non-const buffer, but won't write to it in "rb" mode */
+      FILE *entry = fmemopen((void *)(uintptr_t)(base + offset), mmap_enc_mat_bin_offset(data, k+1) - offset, "rb");
+      if(NULL == entry || NULL == (m->m[i][j] = malloc(mmap->enc->size))) {
+        if(NULL != entry) fclose(entry);
+        goto fail_entries;
+      }
+      mmap->enc->fread(m->m[i][j], entry);
+      fclose(entry);
+    }
+  }
+  return true;
+
+  /* undo everything up to entry (i, j), exclusive */
+fail_entries:
+  for(int jj = 0; jj < j; jj++) {
+    mmap->enc->clear(m->m[i][jj]);
+    free(m->m[i][jj]);
+  }
+  free(m->m[i]);
+fail_rows:
+  while(i-- > 0) {
+    for(j = 0; j < m->ncols; j++) {
+      mmap->enc->clear(m->m[i][j]);
+      free(m->m[i][j]);
+    }
+    free(m->m[i]);
+  }
+  free(m->m);
+fail:
+  fprintf(stderr, "out of memory while loading encoded matrix\n");
+  return false;
+}
+
+/* mmap the whole file read-only; a helper only because every other function
+ * in here has a parameter shadowing mmap(2) */
+static void *mife_map_file(int fd, size_t len) {
+  return mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+}
+
+bool fread_mmap_enc_mat_path(const_mmap_vtable mmap, mmap_enc_mat_t m, int step, const char *path) {
+  struct stat st;
+  bool success = false;
+  int fd = open(path, O_RDONLY);
+
+  if(fd < 0) {
+    fprintf(stderr, "could not open encoded matrix %s\n", path);
+    return false;
+  }
+  if(0 != fstat(fd, &st)) {
+    fprintf(stderr, "could not stat encoded matrix %s\n", path);
+    goto close_fd;
+  }
+
+  if((size_t)st.st_size >= sizeof(mife_enc_mat_header)) {
+    void *data = mife_map_file(fd, st.st_size);
+    if(MAP_FAILED != data) {
+      if(0 == memcmp(data, MIFE_ENC_MAT_MAGIC, sizeof(MIFE_ENC_MAT_MAGIC))) {
+        success = mmap_enc_mat_from_bin(mmap, m, step, data, st.st_size);
+        if(!success) fprintf(stderr, "\twhile reading %s\n", path);
+        munmap(data, st.st_size);
+        goto close_fd;
+      }
+      munmap(data, st.st_size);
+    }
+  }
+
+  /* not (recognizably) binary; fall back to the legacy text format */
+  FILE *fp = fdopen(fd, "rb");
+  if(NULL == fp) {
+    fprintf(stderr, "could not open encoded matrix %s\n", path);
+    goto close_fd;
+  }
+  fread_mmap_enc_mat(mmap, m, fp);
+  fclose(fp);
+  return true;
+
+close_fd:
+  close(fd);
+  return success;
+}
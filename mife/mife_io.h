@@ -1,6 +1,7 @@
 #ifndef _MIFE_IO_H_
 #define _MIFE_IO_H_
 
+#include <stdint.h>
 #include <mmap/mmap.h>
 #include "mife_defs.h"
 #include "flint_raw_io.h"
@@ -8,11 +9,49 @@
 void fwrite_mife_pp(const_mmap_vtable mmap, mife_pp_t pp, char *filepath);
 void fread_mife_pp(const_mmap_vtable mmap, mife_pp_t pp, char *filepath);
 void fwrite_mife_sk(const_mmap_vtable mmap, mife_sk_t sk, char *filepath);
+/* one R/R_inv entry of the format used by fwrite_mife_sk */
+void fwrite_mife_kilian_pair(FILE *fp, fmpz_mat_t R, fmpz_mat_t R_inv);
 void fread_mife_sk(const_mmap_vtable mmap, mife_sk_t sk, char *filepath);
+void fwrite_mife_kilian_cache(mife_kilian_cache *cache, char *filepath);
+/* one step's entry of the format used by fwrite_mife_kilian_cache, which
+ * starts with the number of steps */
+void fwrite_mife_kilian_cache_step(FILE *fp, int len, fmpz_mat_t *clr, fmpz_mat_t *conj);
+bool fread_mife_kilian_cache(mife_sk_t sk, char *filepath);
 void fwrite_mife_ciphertext(const_mmap_vtable mmap, mife_pp_t pp, mife_ciphertext_t ct, char *filepath);
 void fwrite_mmap_enc_mat(const_mmap_vtable mmap, mmap_enc_mat_t m, FILE *fp);
 void fread_mife_ciphertext(const_mmap_vtable mmap, mife_pp_t pp, mife_ciphertext_t ct, char *filepath);
 void fread_mmap_enc_mat(const_mmap_vtable mmap, mmap_enc_mat_t m, FILE *fp);
 
+/* Versioned binary container for a single encoded matrix. The header is
+ * followed by nrows*ncols+1 byte offsets (relative to the start of the
+ * header, in row-major order, the last one being the total size), and then by
+ * the entries themselves in the backend's own serialization. All integers are
+ * in host byte order, so that the whole thing can be mmap'd and used as is. */
+#define MIFE_ENC_MAT_MAGIC      "MIFEENC" /* with its terminator, 8 bytes */
+#define MIFE_ENC_MAT_VERSION    1
+#define MIFE_ENC_MAT_BYTE_ORDER 0x01020304
+
+typedef enum {
+  MIFE_BACKEND_UNKNOWN = 0,
+  MIFE_BACKEND_GGHLITE = 1,
+  MIFE_BACKEND_CLT13   = 2
+} mife_backend;
+
+typedef struct {
+  char magic[8];
+  uint32_t version, byte_order, backend;
+  uint32_t nrows, ncols;
+  int32_t step; /* global index of the step this matrix encodes, or -1 */
+  uint64_t size;
+} mife_enc_mat_header;
+
+mife_backend mife_backend_of(const_mmap_vtable mmap);
+bool fwrite_mmap_enc_mat_bin(const_mmap_vtable mmap, mmap_enc_mat_t m, int step, FILE *fp);
+/* step may be -1 to accept any step */
+bool mmap_enc_mat_from_bin(const_mmap_vtable mmap, mmap_enc_mat_t m, int step, const void *data, size_t len);
+/* reads the binary format via mmap, or the text format of fwrite_mmap_enc_mat
+ * if the file does not start with MIFE_ENC_MAT_MAGIC */
+bool fread_mmap_enc_mat_path(const_mmap_vtable mmap, mmap_enc_mat_t m, int step, const char *path);
+
 
 #endif /* _MIFE_IO_H_ */
@@ -0,0 +1,120 @@
+#include "modp_mat.h"
+
+#include "mife_defs.h"
+
+void modp_ctx_init(modp_ctx_t ctx, const fmpz_t p) {
+  fmpz_init_set(ctx->p, p);
+  ctx->word = fmpz_abs_fits_ui(p);
+  if(ctx->word)
+    nmod_init(&ctx->mod, fmpz_get_ui(p));
+}
+
+void modp_ctx_clear(modp_ctx_t ctx) {
+  fmpz_clear(ctx->p);
+}
+
+void modp_mat_mul(const modp_ctx_t ctx, fmpz_mat_t C,
+    const fmpz_mat_t A, const fmpz_mat_t B) {
+  if(ctx->word) {
+    nmod_mat_t a, b, c;
+    nmod_mat_init(a, A->r, A->c, ctx->mod.n);
+    nmod_mat_init(b, B->r, B->c, ctx->mod.n);
+    nmod_mat_init(c, A->r, B->c, ctx->mod.n);
+    fmpz_mat_get_nmod_mat(a, A);
+    fmpz_mat_get_nmod_mat(b, B);
+    nmod_mat_mul(c, a, b);
+    fmpz_mat_set_nmod_mat_unsigned(C, c);
+    nmod_mat_clear(a);
+    nmod_mat_clear(b);
+    nmod_mat_clear(c);
+  } else {
+    /* the entries of the product are sums of A->c products, so reducing
+     * once at the end is much cheaper than reducing every partial product */
+    fmpz_mat_mul(C, A, B);
+    modp_mat_reduce(ctx, C);
+  }
+}
+
+void modp_mat_scalar_mul(const modp_ctx_t ctx, fmpz_mat_t m, const fmpz_t scalar) {
+  if(ctx->word) {
+    const ulong s = fmpz_get_ui(scalar);
+    for(int i = 0; i < m->r; i++) {
+      for(int j = 0; j < m->c; j++) {
+        fmpz *e = fmpz_mat_entry(m, i, j);
+        fmpz_set_ui(e, nmod_mul(fmpz_get_ui(e), s, ctx->mod));
+      }
+    }
+  } else {
+    for(int i = 0; i < m->r; i++) {
+      for(int j = 0; j < m->c; j++) {
+        fmpz_mul(fmpz_mat_entry(m, i, j), fmpz_mat_entry(m, i, j), scalar);
+        fmpz_mod(fmpz_mat_entry(m, i, j), fmpz_mat_entry(m, i, j), ctx->p);
+      }
+    }
+  }
+}
+
+void modp_mat_reduce(const modp_ctx_t ctx, fmpz_mat_t m) {
+  for(int i = 0; i < m->r; i++) {
+    for(int j = 0; j < m->c; j++) {
+      fmpz_mod(fmpz_mat_entry(m, i, j), fmpz_mat_entry(m, i, j), ctx->p);
+    }
+  }
+}
+
+int modp_mat_inv(const modp_ctx_t ctx, fmpz_mat_t inv, const fmpz_mat_t m) {
+  if(ctx->word) {
+    nmod_mat_t a, b;
+    int invertible;
+    nmod_mat_init(a, m->r, m->c, ctx->mod.n);
+    nmod_mat_init(b, m->r, m->c, ctx->mod.n);
+    fmpz_mat_get_nmod_mat(a, m);
+    invertible = nmod_mat_inv(b, a);
+    if(invertible)
+      fmpz_mat_set_nmod_mat_unsigned(inv, b);
+    nmod_mat_clear(a);
+    nmod_mat_clear(b);
+    return !invertible;
+  } else {
+    fmpz_t p;
+    fmpz_mat_t copy;
+    int result;
+    /* fmpz_modp_matrix_inverse is not const-correct */
+    fmpz_init_set(p, ctx->p);
+    fmpz_mat_init_set(copy, m);
+    result = fmpz_modp_matrix_inverse(inv, copy, m->r, p);
+    fmpz_mat_clear(copy);
+    fmpz_clear(p);
+    return result;
+  }
+}
+
+/* forward substitution, one column of the inverse at a time */
+void modp_mat_unit_lower_inv(const modp_ctx_t ctx, fmpz_mat_t inv, const fmpz_mat_t m) {
+  const int n = m->r;
+  fmpz_mat_zero(inv);
+  for(int j = 0; j < n; j++) {
+    fmpz_one(fmpz_mat_entry(inv, j, j));
+    for(int i = j+1; i < n; i++) {
+      fmpz *e = fmpz_mat_entry(inv, i, j);
+      for(int k = j; k < i; k++)
+        fmpz_submul(e, fmpz_mat_entry(m, i, k), fmpz_mat_entry(inv, k, j));
+      fmpz_mod(e, e, ctx->p);
+    }
+  }
+}
+
+/* back substitution, one column of the inverse at a time */
+void modp_mat_unit_upper_inv(const modp_ctx_t ctx, fmpz_mat_t inv, const fmpz_mat_t m) {
+  const int n = m->r;
+  fmpz_mat_zero(inv);
+  for(int j = 0; j < n; j++) {
+    fmpz_one(fmpz_mat_entry(inv, j, j));
+    for(int i = j-1; i >= 0; i--) {
+      fmpz *e = fmpz_mat_entry(inv, i, j);
+      for(int k = i+1; k <= j; k++)
+        fmpz_submul(e, fmpz_mat_entry(m, i, k), fmpz_mat_entry(inv, k, j));
+      fmpz_mod(e, e, ctx->p);
+    }
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef _MODP_MAT_H_
+#define _MODP_MAT_H_
+
+#include <stdbool.h>
+#include <flint/fmpz.h>
+#include <flint/fmpz_mat.h>
+#include <flint/nmod_mat.h>
+
+/* Matrix arithmetic mod the plaintext prime p. The representation is picked
+ * once per p: if p fits in a machine word, operations convert to FLINT's
+ * nmod_mat, whose products use delayed reduction and vectorized dot products;
+ * otherwise they stay in fmpz and reduce each entry once per operation.
+ *
+ * All functions take and return fmpz_mat_t's with entries in [0,p), so
+ * callers need not care which representation was chosen.
+ */
+struct _modp_ctx_struct {
+  fmpz_t p;
+  bool word; // whether p fits in a single limb
+  nmod_t mod; // only valid if word
+};
+
+typedef struct _modp_ctx_struct modp_ctx_t[1];
+
+void modp_ctx_init (modp_ctx_t ctx, const fmpz_t p);
+void modp_ctx_clear(modp_ctx_t ctx);
+
+/* C = A * B mod p; C may alias A or B */
+void modp_mat_mul       (const modp_ctx_t ctx, fmpz_mat_t C,
+                         const fmpz_mat_t A, const fmpz_mat_t B);
+/* m = scalar * m mod p */
+void modp_mat_scalar_mul(const modp_ctx_t ctx, fmpz_mat_t m, const fmpz_t scalar);
+/* reduce every entry of m into [0,p) */
+void modp_mat_reduce    (const modp_ctx_t ctx, fmpz_mat_t m);
+/* inv = m^-1 mod p; like fmpz_modp_matrix_inverse, returns nonzero iff m is
+ * singular (in which case inv is garbage) */
+int  modp_mat_inv       (const modp_ctx_t ctx, fmpz_mat_t inv, const fmpz_mat_t m);
+/* inv = T^-1 mod p, where T is the unit lower (resp. upper) triangular matrix
+ * whose strictly lower (resp. upper) part is that of m; the rest of m is
+ * ignored, so one matrix can hold both factors of an LU decomposition */
+void modp_mat_unit_lower_inv(const modp_ctx_t ctx, fmpz_mat_t inv, const fmpz_mat_t m);
+void modp_mat_unit_upper_inv(const modp_ctx_t ctx, fmpz_mat_t inv, const fmpz_mat_t m);
+
+#endif /* _MODP_MAT_H_ */
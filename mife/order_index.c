@@ -0,0 +1,343 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "order_index.h"
+
+/* <database>/index/<name><suffix>, or just <database>/index if name is NULL */
+static location order_index_path(location database, const char *name, const char *suffix) {
+  location dir = location_append(database, ORDER_INDEX_DIR), result;
+  char *file;
+  if(NULL == dir.path || NULL == name) return dir;
+  if(ALLOC_FAILS(file, strlen(name) + strlen(suffix) + 1)) {
+    location_free(dir);
+    return (location) { NULL, false };
+  }
+  strcpy(file, name);
+  strcat(file, suffix);
+  result = location_append(dir, file);
+  free(file);
+  location_free(dir);
+  return result;
+}
+
+static bool order_index_push(order_index *idx, const char *uid) {
+  char **uids;
+  if(idx->len == idx->capacity) {
+    const size_t capacity = 0 == idx->capacity ? 16 : 2*idx->capacity;
+    if(NULL == (uids = realloc(idx->uids, capacity*sizeof(*uids)))) return false;
+    idx->uids = uids;
+    idx->capacity = capacity;
+  }
+  if(NULL == (idx->uids[idx->len] = strdup(uid))) return false;
+  idx->len++;
+  return true;
+}
+
+static void order_index_strip(char *line) {
+  size_t len = strlen(line);
+  while(len > 0 && ('\n' == line[len-1] || '\r' == line[len-1]))
+    line[--len] = '\0';
+}
+
+bool order_index_load(location database, const char *name, const comparator *c, order_index *idx) {
+  const char *left, *right, *less;
+  char *line = NULL, *header = NULL;
+  size_t line_size = 0;
+  bool success = false;
+  FILE *fp;
+  int header_len;
+
+  idx->uids = NULL;
+  idx->len = idx->capacity = 0;
+  idx->lock_fd = -1;
+
+  location path = order_index_path(database, name, "");
+  if(NULL == path.path) {
+    fprintf(stderr, "out of memory while loading index %s\n", name);
+    return false;
+  }
+  if(NULL == (fp = fopen(path.path, "r"))) {
+    location_free(path);
+    if(ENOENT == errno) return true;
+    fprintf(stderr, "could not open index %s\n", name);
+    return false;
+  }
+
+  /* an index is only meaningful for the comparison that ordered it */
+  comparator_describe(c, &left, &right, &less);
+  header_len = snprintf(NULL, 0, "%s\t1\t%s\t%s\t%s", ORDER_INDEX_MAGIC, left, right, less);
+  if(ALLOC_FAILS(header, header_len+1)) {
+    fprintf(stderr, "out of memory while loading index %s\n", name);
+    goto close_file;
+  }
+  snprintf(header, header_len+1, "%s\t1\t%s\t%s\t%s", ORDER_INDEX_MAGIC, left, right, less);
+  if(getline(&line, &line_size, fp) < 0) {
+    fprintf(stderr, "index %s is empty\n", path.path);
+    goto close_file;
+  }
+  order_index_strip(line);
+  if(strcmp(line, header)) {
+    fprintf(stderr, "index %s was built for a different comparison:\n\t%s\n", path.path, line);
+    goto close_file;
+  }
+
+  while(getline(&line, &line_size, fp) >= 0) {
+    order_index_strip(line);
+    if('\0' == line[0]) continue;
+    if(!order_index_push(idx, line)) {
+      fprintf(stderr, "out of memory while loading index %s\n", name);
+      goto close_file;
+    }
+  }
+  success = !ferror(fp);
+  if(!success) fprintf(stderr, "could not read index %s\n", path.path);
+
+close_file:
+  fclose(fp);
+  free(line);
+  free(header);
+  location_free(path);
+  if(!success) order_index_clear(idx);
+  return success;
+}
+
+bool order_index_lock(location database, const char *name, const comparator *c, order_index *idx) {
+  location dir = order_index_path(database, NULL, "");
+  location lock = order_index_path(database, name, ".lock");
+  int fd = -1;
+
+  if(NULL == dir.path || NULL == lock.path) {
+    fprintf(stderr, "out of memory while locking index %s\n", name);
+    goto fail;
+  }
+  if(!create_directory_if_missing(dir.path)) {
+    fprintf(stderr, "could not create index directory %s\n", dir.path);
+    goto fail;
+  }
+  if((fd = open(lock.path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR)) < 0 || 0 != flock(fd, LOCK_EX)) {
+    fprintf(stderr, "could not lock %s\n", lock.path);
+    goto fail;
+  }
+  location_free(dir);
+  location_free(lock);
+
+  if(!order_index_load(database, name, c, idx)) {
+    close(fd);
+    return false;
+  }
+  idx->lock_fd = fd;
+  return true;
+
+fail:
+  if(fd >= 0) close(fd);
+  location_free(dir);
+  location_free(lock);
+  return false;
+}
+
+bool order_index_save(location database, const char *name, const comparator *c, const order_index *idx) {
+  const char *left, *right, *less;
+  location path = order_index_path(database, name, "");
+  location tmp  = order_index_path(database, name, ".tmp");
+  bool success = false;
+  FILE *fp;
+
+  if(NULL == path.path || NULL == tmp.path) {
+    fprintf(stderr, "out of memory while saving index %s\n", name);
+    goto free_paths;
+  }
+  if(NULL == (fp = fopen(tmp.path, "w"))) {
+    fprintf(stderr, "could not open %s for writing\n", tmp.path);
+    goto free_paths;
+  }
+
+  comparator_describe(c, &left, &right, &less);
+  fprintf(fp, "%s\t1\t%s\t%s\t%s\n", ORDER_INDEX_MAGIC, left, right, less);
+  for(size_t i = 0; i < idx->len; i++)
+    fprintf(fp, "%s\n", idx->uids[i]);
+
+  /* readers see either the old index or the new one, never a partial one */
+  success = 0 == fflush(fp) && 0 == fsync(fileno(fp));
+  success = 0 == fclose(fp) && success;
+  success = success && 0 == rename(tmp.path, path.path);
+  if(!success) {
+    fprintf(stderr, "could not write index %s\n", path.path);
+    unlink(tmp.path);
+  }
+
+free_paths:
+  location_free(path);
+  location_free(tmp);
+  return success;
+}
+
+void order_index_clear(order_index *idx) {
+  for(size_t i = 0; i < idx->len; i++)
+    free(idx->uids[i]);
+  free(idx->uids);
+  idx->uids = NULL;
+  idx->len = idx->capacity = 0;
+  if(idx->lock_fd >= 0) close(idx->lock_fd);
+  idx->lock_fd = -1;
+}
+
+/* the first position in idx whose record uid sorts before, or n if none */
+static bool order_index_upper_bound(const order_index *idx, comparator *c, const char *uid, size_t *pos) {
+  size_t lo = 0, hi = idx->len;
+  bool less;
+  while(lo < hi) {
+    const size_t mid = lo + (hi-lo)/2;
+    if(!comparator_less(c, uid, idx->uids[mid], &less)) return false;
+    if(less) hi = mid;
+    else lo = mid+1;
+  }
+  *pos = lo;
+  return true;
+}
+
+/* the first position in idx whose record does not sort before uid */
+static bool order_index_lower_bound(const order_index *idx, comparator *c, const char *uid, size_t *pos) {
+  size_t lo = 0, hi = idx->len;
+  bool less;
+  while(lo < hi) {
+    const size_t mid = lo + (hi-lo)/2;
+    if(!comparator_less(c, idx->uids[mid], uid, &less)) return false;
+    if(less) lo = mid+1;
+    else hi = mid;
+  }
+  *pos = lo;
+  return true;
+}
+
+static int order_index_strcmp(const void *l, const void *r) {
+  return strcmp(*(char *const *)l, *(char *const *)r);
+}
+
+typedef struct {
+  const char *uid;
+  size_t arrival;
+} order_index_arrival;
+
+static int order_index_arrival_cmp(const void *l, const void *r) {
+  const order_index_arrival *a = l, *b = r;
+  const int order = strcmp(a->uid, b->uid);
+  if(0 != order) return order;
+  return a->arrival < b->arrival ? -1 : a->arrival > b->arrival;
+}
+
+/* marks in skip the uids that are already in idx or come earlier in uids;
+ * string matches cost no evaluations, so these are found by sorting names */
+static bool order_index_find_known(const order_index *idx, char *const *uids, size_t n, bool *skip) {
+  order_index_arrival *arrivals;
+  char **known;
+  size_t i;
+
+  if(ALLOC_FAILS(arrivals, n) || ALLOC_FAILS(known, idx->len+1)) {
+    free(arrivals);
+    return false;
+  }
+  if(idx->len > 0) memcpy(known, idx->uids, idx->len*sizeof(*known));
+  qsort(known, idx->len, sizeof(*known), order_index_strcmp);
+  for(i = 0; i < n; i++)
+    arrivals[i] = (order_index_arrival) { uids[i], i };
+  qsort(arrivals, n, sizeof(*arrivals), order_index_arrival_cmp);
+
+  for(i = 0; i < n; i++)
+    skip[arrivals[i].arrival] =
+      (i > 0 && !strcmp(arrivals[i-1].uid, arrivals[i].uid)) ||
+      NULL != bsearch(&arrivals[i].uid, known, idx->len, sizeof(*known), order_index_strcmp);
+
+  free(arrivals);
+  free(known);
+  return true;
+}
+
+bool order_index_insert(order_index *idx, comparator *c, char *const *uids, size_t n, size_t *added) {
+  char **fresh = NULL, **merged;
+  unsigned int *order = NULL;
+  size_t *pos = NULL, m = 0, i, j, k;
+  bool *skip = NULL, failed = false;
+
+  *added = 0;
+  if(0 == n) return true;
+  if(ALLOC_FAILS(skip, n) || ALLOC_FAILS(fresh, n) || ALLOC_FAILS(order, n) || ALLOC_FAILS(pos, n) ||
+     !order_index_find_known(idx, uids, n, skip)) {
+    failed = true;
+    goto free_scratch;
+  }
+  for(i = 0; i < n; i++)
+    if(!skip[i]) fresh[m++] = uids[i];
+  if(0 == m) goto free_scratch;
+
+  /* the new uids are sorted among themselves with the parallel merge sort,
+   * which keeps equal ones in the order they came in */
+  for(i = 0; i < m; i++) order[i] = i;
+  if(!comparator_sort(c, fresh, order, m)) {
+    failed = true;
+    goto free_scratch;
+  }
+
+  /* then each one is placed against the old list independently */
+#pragma omp parallel for schedule(dynamic,1) if(g_parallel)
+  for(size_t p = 0; p < m; p++) {
+    if(!order_index_upper_bound(idx, c, fresh[order[p]], &pos[p])) {
+#pragma omp atomic write
+      failed = true;
+    }
+  }
+  if(failed) goto free_scratch;
+  /* a consistent comparison gives non-decreasing places already; this only
+   * keeps the merge well-formed if it doesn't */
+  for(i = 1; i < m; i++)
+    if(pos[i] < pos[i-1]) pos[i] = pos[i-1];
+
+  if(ALLOC_FAILS(merged, idx->len + m)) {
+    failed = true;
+    goto free_scratch;
+  }
+  for(k = 0; k < m; k++)
+    if(NULL == (fresh[order[k]] = strdup(fresh[order[k]]))) break;
+  if(k < m) {
+    while(k > 0) free(fresh[order[--k]]);
+    free(merged);
+    failed = true;
+    goto free_scratch;
+  }
+
+  /* new uids go after old ones they are equal to */
+  for(i = 0, j = 0, k = 0; i < idx->len || j < m; )
+    merged[k++] = j < m && pos[j] <= i ? fresh[order[j++]] : idx->uids[i++];
+  free(idx->uids);
+  idx->uids = merged;
+  idx->len += m;
+  idx->capacity = idx->len;
+  *added = m;
+
+free_scratch:
+  free(skip);
+  free(fresh);
+  free(order);
+  free(pos);
+  return !failed;
+}
+
+bool order_index_range(const order_index *idx, comparator *c, const char *lo, const char *hi, size_t *begin, size_t *end) {
+  bool found_begin = false, found_end = false;
+
+  /* the two ends are independent */
+#pragma omp parallel sections if(g_parallel)
+  {
+#pragma omp section
+    found_begin = order_index_lower_bound(idx, c, lo, begin);
+#pragma omp section
+    found_end = order_index_upper_bound(idx, c, hi, end);
+  }
+
+  if(found_begin && found_end && *end < *begin) *end = *begin;
+  return found_begin && found_end;
+}
@@ -0,0 +1,44 @@
+#ifndef _MIFE_ORDER_INDEX_H
+#define _MIFE_ORDER_INDEX_H
+
+#include <stddef.h>
+
+#include "compare.h"
+#include "util.h"
+
+/* A persistent list of uids in comparator order, so that a range lookup costs
+ * O(log N) comparisons instead of a scan. Comparisons are what is expensive
+ * here, not I/O, so the index is simply the sorted list: <database>/index/<name>
+ * holds a header line naming the comparison it was built with, then one uid
+ * per line. Updates rewrite the file and rename it into place, so readers
+ * need no lock; writers serialize on an flock of <name>.lock. */
+
+#define ORDER_INDEX_DIR   "index"
+#define ORDER_INDEX_MAGIC "MIFEIDX"
+
+typedef struct {
+  char **uids;
+  size_t len, capacity;
+  /* held from order_index_lock to order_index_unlock, else -1 */
+  int lock_fd;
+} order_index;
+
+/* loads the named index, or starts an empty one if it doesn't exist yet;
+ * fails if it was built with a different comparison than c's */
+bool order_index_load(location database, const char *name, const comparator *c, order_index *idx);
+/* like order_index_load, but first takes the lock held for an update */
+bool order_index_lock(location database, const char *name, const comparator *c, order_index *idx);
+bool order_index_save(location database, const char *name, const comparator *c, const order_index *idx);
+void order_index_clear(order_index *idx);
+
+/* Adds the n uids (copying them) that are not in idx already, setting *added
+ * to how many that was. They are sorted among themselves with comparator_sort
+ * and each is then placed by binary search in parallel, for O(n log n +
+ * n log N) comparisons in all; records equal to ones already present go after
+ * them. */
+bool order_index_insert(order_index *idx, comparator *c, char *const *uids, size_t n, size_t *added);
+/* finds the records r with lo <= r <= hi, which are idx->uids[*begin] up to
+ * (but not including) idx->uids[*end] */
+bool order_index_range(const order_index *idx, comparator *c, const char *lo, const char *hi, size_t *begin, size_t *end);
+
+#endif /* ifndef _MIFE_ORDER_INDEX_H */
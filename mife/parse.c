@@ -347,44 +347,55 @@ bool jsmn_parse_string(const char *const json_string, const jsmntok_t **const js
 bool jsmn_parse_mbp_template(const char *const json_string, const jsmntok_t **const json_tokens, mbp_template *const template) {
 	int i;
 
-	/* demand an object with exactly two parts */
-	if((*json_tokens)->type != JSMN_OBJECT || (*json_tokens)->size != 2) {
-		fprintf(stderr, "at position %d\nexpecting template (JSON object with keys \"steps\" and \"outputs\"), found non-object\n", (*json_tokens)->start);
+	/* demand an object with two parts, plus optional flags */
+	if((*json_tokens)->type != JSMN_OBJECT || (*json_tokens)->size < 2 || (*json_tokens)->size > 3) {
+		fprintf(stderr, "at position %d\nexpecting template (JSON object with keys \"steps\", \"outputs\", and optionally \"single_output\"), found non-object\n", (*json_tokens)->start);
 		return false;
 	}
 
+	const int num_keys = (*json_tokens)->size;
 	template->steps   = NULL;
 	template->outputs = (string_matrix) { .num_rows = 0, .num_cols = 0, .elems = NULL };
+	template->single_output = false;
 
-	for(i = 0; i < 2; i++) {
+	for(i = 0; i < num_keys; i++) {
 		char *key;
 		++(*json_tokens);
-		switch(json_string[(*json_tokens)->start]) {
-			case 's': /* steps */
-				++(*json_tokens);
-				if(!jsmn_parse_mbp_steps(json_string, json_tokens, template)) {
-					mbp_template_free(*template);
-					return false;
-				}
-				break;
-
-			case 'o': /* outputs */
-				++(*json_tokens);
-				if(!jsmn_parse_string_matrix(json_string, json_tokens, &template->outputs)) {
-					template->outputs.elems = NULL;
-					mbp_template_free(*template);
-					return false;
-				}
-				break;
+		if(!jsmn_parse_string(json_string, json_tokens, &key)) {
+			mbp_template_free(*template);
+			return false;
+		}
 
-			default:
-				if(jsmn_parse_string(json_string, json_tokens, &key)) {
-					fprintf(stderr, "at position %d\nexpecting \"steps\" or \"outputs\", found %s\n", (*json_tokens)->start, key);
-					free(key);
-				}
+		++(*json_tokens);
+		if(!strcmp(key, "steps") && NULL == template->steps) {
+			if(!jsmn_parse_mbp_steps(json_string, json_tokens, template)) {
+				free(key);
+				mbp_template_free(*template);
+				return false;
+			}
+		}
+		else if(!strcmp(key, "outputs") && NULL == template->outputs.elems) {
+			if(!jsmn_parse_string_matrix(json_string, json_tokens, &template->outputs)) {
+				template->outputs.elems = NULL;
+				free(key);
+				mbp_template_free(*template);
+				return false;
+			}
+		}
+		else if(!strcmp(key, "single_output")) {
+			if(!jsmn_parse_f2_elem(json_string, json_tokens, &template->single_output)) {
+				free(key);
 				mbp_template_free(*template);
 				return false;
+			}
+		}
+		else {
+			fprintf(stderr, "at position %d\nexpecting \"steps\", \"outputs\", or \"single_output\", found %s\n", (*json_tokens)->start, key);
+			free(key);
+			mbp_template_free(*template);
+			return false;
 		}
+		free(key);
 	}
 
 	if(NULL == template->steps) {
@@ -439,6 +450,72 @@ bool jsmn_parse_mbp_plaintext(const char *const json_string, const jsmntok_t **c
 	return true;
 }
 
+bool jsmn_parse_mbp_plaintext_record(const char *const json_string, const jsmntok_t **const json_tokens, mbp_plaintext_record *const record) {
+	record->pt        = (mbp_plaintext) { .symbols_len = 0, .symbols = NULL };
+	record->uid       = NULL;
+	record->partition = NULL;
+
+	/* a bare array is a plaintext with no bookkeeping attached */
+	if((*json_tokens)->type == JSMN_ARRAY) {
+		if(jsmn_parse_mbp_plaintext(json_string, json_tokens, &record->pt)) return true;
+		record->pt.symbols = NULL;
+		return false;
+	}
+
+	/* otherwise demand an object */
+	if((*json_tokens)->type != JSMN_OBJECT) {
+		fprintf(stderr, "at position %d\nexpecting plaintext record (JSON array of symbols, or object with keys \"plaintext\", \"uid\", and \"partition\")\n", (*json_tokens)->start);
+		return false;
+	}
+
+	/* parse each key-value pair */
+	const int num_keys = (*json_tokens)->size;
+	int i;
+	for(i = 0; i < num_keys; i++) {
+		char *key;
+		bool ok = false;
+		++(*json_tokens);
+		if(!jsmn_parse_string(json_string, json_tokens, &key)) goto fail;
+
+		++(*json_tokens);
+		if(!strcmp(key, "plaintext") && NULL == record->pt.symbols) {
+			ok = jsmn_parse_mbp_plaintext(json_string, json_tokens, &record->pt);
+			if(!ok) record->pt.symbols = NULL;
+		}
+		else if(!strcmp(key, "uid") && NULL == record->uid)
+			ok = jsmn_parse_string(json_string, json_tokens, &record->uid);
+		else if(!strcmp(key, "partition") && NULL == record->partition) {
+			/* allow both "partition": 12 and "partition": "12", since numbers
+			 * bigger than 2^53 are not representable in many JSON emitters */
+			if((*json_tokens)->type == JSMN_PRIMITIVE) {
+				const unsigned int len = (*json_tokens)->end - (*json_tokens)->start;
+				if(!ALLOC_FAILS(record->partition, len+1)) {
+					memcpy(record->partition, json_string+(*json_tokens)->start, len);
+					record->partition[len] = '\0';
+					ok = true;
+				}
+			}
+			else ok = jsmn_parse_string(json_string, json_tokens, &record->partition);
+		}
+		else fprintf(stderr, "at position %d\nunknown or duplicate key \"%s\" in plaintext record\n", (*json_tokens)->start, key);
+
+		free(key);
+		if(!ok) goto fail;
+	}
+
+	/* make sure we saw a plaintext */
+	if(NULL == record->pt.symbols) {
+		fprintf(stderr, "before position %d\nmissing key \"plaintext\"\n", (*json_tokens)->end);
+		goto fail;
+	}
+
+	return true;
+
+fail:
+	mbp_plaintext_record_free(*record);
+	return false;
+}
+
 bool jsmn_parse_ciphertext_mapping(const char *const json_string, const jsmntok_t **const json_tokens, ciphertext_mapping *const mapping) {
 	unsigned int i;
 
@@ -565,6 +642,17 @@ bool jsmn_parse_mbp_plaintext_string(const char *const json_string, mbp_plaintex
 	return status;
 }
 
+bool jsmn_parse_mbp_plaintext_record_string(const char *const json_string, mbp_plaintext_record *const record) {
+	jsmntok_t *json_tokens;
+	bool status = jsmn_parse_setup(json_string, &json_tokens);
+	if(status) {
+		const jsmntok_t *state = json_tokens;
+		status = jsmn_parse_mbp_plaintext_record(json_string, &state, record);
+		free(json_tokens);
+	}
+	return status;
+}
+
 bool jsmn_parse_ciphertext_mapping_string(const char *const json_string, ciphertext_mapping *const mapping) {
 	jsmntok_t *json_tokens;
 	bool status = jsmn_parse_setup(json_string, &json_tokens);
@@ -27,10 +27,12 @@ bool jsmn_parse_string_matrix     (const char *const json_string, const jsmntok_
 bool jsmn_parse_mbp_step          (const char *const json_string, const jsmntok_t **const json_tokens, mbp_step           *const step    );
 bool jsmn_parse_mbp_template      (const char *const json_string, const jsmntok_t **const json_tokens, mbp_template       *const template);
 bool jsmn_parse_mbp_plaintext     (const char *const json_string, const jsmntok_t **const json_tokens, mbp_plaintext      *const pt      );
+bool jsmn_parse_mbp_plaintext_record(const char *const json_string, const jsmntok_t **const json_tokens, mbp_plaintext_record *const record);
 bool jsmn_parse_ciphertext_mapping(const char *const json_string, const jsmntok_t **const json_tokens, ciphertext_mapping *const mapping );
 
 /* top-level wrappers */
 bool jsmn_parse_mbp_template_location(const location loc, mbp_template *const template);
 bool jsmn_parse_mbp_plaintext_string(const char *const json_string, mbp_plaintext *const plaintext);
+bool jsmn_parse_mbp_plaintext_record_string(const char *const json_string, mbp_plaintext_record *const record);
 bool jsmn_parse_ciphertext_mapping_string(const char *const json_string, ciphertext_mapping *const mapping);
 #endif /* ifndef _MIFE_PARSE_H */
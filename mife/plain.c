@@ -0,0 +1,218 @@
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gghlite/misc.h>
+
+#include "mbp_plain.h"
+#include "mbp_types.h"
+#include "parse.h"
+#include "util.h"
+
+typedef struct {
+	mbp_template template;
+	/* where to read plaintexts from, one per line */
+	FILE *input;
+	/* how many times to evaluate each plaintext */
+	unsigned long repeat;
+} plain_inputs;
+
+void mife_plain_parse_cmdline(int argc, char **argv, plain_inputs *const ins);
+bool mife_plain_run(plain_inputs *const ins, mbp_plain *const p);
+void mife_plain_print_outputs_line(const mbp_template *const t, const f2_bitmat *const m, const unsigned long line);
+
+int main(int argc, char **argv) {
+	plain_inputs ins;
+	mbp_plain p;
+	bool success;
+
+	mife_plain_parse_cmdline(argc, argv, &ins);
+
+	if(!mbp_plain_init(&p, &ins.template)) {
+		fprintf(stderr, "%s: the template is not a valid matrix branching program\n", *argv);
+		mbp_template_free(ins.template);
+		return 4;
+	}
+	success = mife_plain_run(&ins, &p);
+
+	mbp_plain_clear(&p);
+	mbp_template_free(ins.template);
+	if(stdin != ins.input) fclose(ins.input);
+	return success ? 0 : -1;
+}
+
+static void mife_plain_usage(const int code) {
+	/* separate the diagnostic information from the usage information a little bit */
+	if(0 != code) printf("\n\n");
+	printf(
+		"USAGE: mife-plain [OPTIONS] [FILE]\n"
+		"Evaluates the function template directly on plaintexts, with no keys or\n"
+		"encryption involved: as an oracle for what eval should print, or to check\n"
+		"that a template computes what it was meant to. Before anything else, the\n"
+		"template is checked for matrices that do not fit together.\n"
+		"\n"
+		"FILE (or stdin, if FILE is - or missing) holds one plaintext per line, in\n"
+		"any form encrypt --batch accepts; uids and partitions are ignored. For each\n"
+		"one, prints what eval --batch would print for records encrypted with those\n"
+		"symbols in every position: its line number, a tab, and the strings from the\n"
+		"template's `outputs` for the non-zeros of the product, separated by spaces.\n"
+		"Products that break a `single_output` promise are reported on stderr.\n"
+		"\n"
+		"Brackets indicate default values for each argument.\n"
+		"\n"
+		"Common options:\n"
+		"  -h, --help               Display this usage information\n"
+		"  -u, --public             A directory for public parameters [public]\n"
+		"\n"
+		"Evaluation-specific options:\n"
+		"  -n, --repeat             Evaluate each plaintext this many times, and\n"
+		"                           report the rate of evaluation on stderr [1]\n"
+		"\n"
+		"Files used:\n"
+		"  <public>/template.json    R  JSON    a description of the function being\n"
+		"                                       evaluated\n"
+		);
+	exit(code);
+}
+
+void mife_plain_parse_cmdline(int argc, char **argv, plain_inputs *const ins) {
+	location public_location = { "public", true };
+	bool done = false;
+
+	ins->input = stdin;
+	ins->repeat = 1;
+
+	struct option long_opts[] =
+		{ {"help"  ,       no_argument, NULL, 'h'}
+		, {"public", required_argument, NULL, 'u'}
+		, {"repeat", required_argument, NULL, 'n'}
+		, {NULL, 0, NULL, 0}
+		};
+
+	while(!done) {
+		int c = getopt_long(argc, argv, "hn:u:", long_opts, NULL);
+		switch(c) {
+			case  -1: done = true; break;
+			case   0: break; /* a long option with non-NULL flag; should never happen */
+			case '?': mife_plain_usage(1); break; /* braking is good defensive driving */
+			case 'h': mife_plain_usage(0); break;
+			case 'n':
+				if(atol(optarg) < 1) {
+					fprintf(stderr, "%s: unparseable repeat count '%s', should be positive number\n", *argv, optarg);
+					mife_plain_usage(2);
+				}
+				ins->repeat = atol(optarg);
+				break;
+			case 'u':
+				public_location = (location) { optarg, true };
+				break;
+			default:
+				fprintf(stderr, "The impossible happened! getopt returned %d (%c)\n", c, c);
+				exit(-1);
+				break;
+		}
+	}
+
+	if(optind < argc-1) {
+		fprintf(stderr, "%s: specify at most one file of plaintexts (found %d)\n", *argv, argc-optind);
+		mife_plain_usage(2);
+	}
+	if(optind == argc-1 && strcmp(argv[optind], "-")) {
+		if(NULL == (ins->input = fopen(argv[optind], "r"))) {
+			fprintf(stderr, "%s: could not open %s for reading\n", *argv, argv[optind]);
+			mife_plain_usage(3);
+		}
+	}
+
+	location template_location = location_append(public_location, "template.json");
+	if(NULL == template_location.path) {
+		fprintf(stderr, "%s: out of memory while loading template\n", *argv);
+		exit(-1);
+	}
+	if(!jsmn_parse_mbp_template_location(template_location, &ins->template)) {
+		fprintf(stderr, "%s: could not parse '%s' as a\nJSON representation of a matrix branching program template over the field F_2\n", *argv, template_location.path);
+		mife_plain_usage(4);
+	}
+	location_free(template_location);
+}
+
+/* prints the labels eval would: entries with empty labels are never
+ * computed, and with single_output only the first non-zero is found */
+void mife_plain_print_outputs_line(const mbp_template *const t, const f2_bitmat *const m, const unsigned long line) {
+	unsigned int found = 0;
+
+	printf("%lu\t", line);
+	for(unsigned int i = 0; i < m->num_rows && i < t->outputs.num_rows; i++) {
+		for(unsigned int j = 0; j < m->num_cols && j < t->outputs.num_cols; j++) {
+			if('\0' == t->outputs.elems[i][j][0] || !f2_bitmat_get(m, i, j)) continue;
+			if(0 == found || !t->single_output)
+				printf(0 == found ? "%s" : " %s", t->outputs.elems[i][j]);
+			found++;
+		}
+	}
+	printf("\n");
+
+	if(t->single_output && found > 1)
+		fprintf(stderr, "line %lu: %u labelled entries are non-zero, but the template promises at most one\n", line, found);
+}
+
+/* evaluates every plaintext in ins->input; returns true iff every line could
+ * be evaluated */
+bool mife_plain_run(plain_inputs *const ins, mbp_plain *const p) {
+	unsigned long line = 0, evaluated = 0;
+	uint64_t eval_time = 0;
+	char *buf = NULL;
+	size_t buf_size = 0;
+	bool success = true;
+	int *symbols;
+
+	if(ALLOC_FAILS(symbols, ins->template.steps_len)) {
+		fprintf(stderr, "out of memory while reading plaintexts\n");
+		return false;
+	}
+
+	while(getline(&buf, &buf_size, ins->input) >= 0) {
+		mbp_plaintext_record record;
+		const f2_bitmat *result = NULL;
+		line++;
+
+		/* skip blank lines */
+		if(strspn(buf, " \t\r\n") == strlen(buf)) continue;
+
+		if(!jsmn_parse_mbp_plaintext_record_string(buf, &record)) {
+			fprintf(stderr, "line %lu: could not parse plaintext\n", line);
+			success = false;
+			continue;
+		}
+		if(!mbp_plain_symbols(p, &record.pt, symbols)) {
+			fprintf(stderr, "line %lu: plaintext does not fit the template\n", line);
+			mbp_plaintext_record_free(record);
+			success = false;
+			continue;
+		}
+		mbp_plaintext_record_free(record);
+
+		const uint64_t t = ggh_walltime(0);
+		for(unsigned long r = 0; r < ins->repeat; r++)
+			result = mbp_plain_eval(p, symbols);
+		eval_time += ggh_walltime(t);
+		evaluated += ins->repeat;
+
+		mife_plain_print_outputs_line(&ins->template, result, line);
+	}
+	if(ferror(ins->input)) {
+		fprintf(stderr, "error while reading plaintexts\n");
+		success = false;
+	}
+	fflush(stdout);
+
+	if(ins->repeat > 1) {
+		const double seconds = ggh_seconds(eval_time);
+		fprintf(stderr, "%lu evaluations in %.3fs, %.0f evaluations/s\n",
+		        evaluated, seconds, seconds > 0 ? evaluated / seconds : 0.0);
+	}
+
+	free(buf);
+	free(symbols);
+	return success;
+}
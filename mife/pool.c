@@ -0,0 +1,448 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "store.h"
+
+#define INT_STR_LEN (3 * sizeof(int))
+
+/* an entry being filled */
+typedef struct {
+    location tmp_location; /* <pool>/<uid>.tmp */
+    char *uid;
+    fmpz_t partition;
+    int ***partitions;
+    bool success;
+} pool_fill_entry;
+
+static bool pool_is_entry(const char *const name) {
+    return '\0' != name[0] && NULL == strchr(name, '.');
+}
+
+/* <pool>/<name><suffix> */
+static location pool_location(const location pool, const char *const name, const char *const suffix) {
+    location result = { NULL, false };
+    char *file;
+    if(ALLOC_FAILS(file, strlen(name) + strlen(suffix) + 1)) return result;
+    strcpy(file, name);
+    strcat(file, suffix);
+    result = location_append(pool, file);
+    free(file);
+    return result;
+}
+
+/* <base>/<middle>/<index>.bin, setting *dir to a copy of <base>/<middle> if
+ * dir is not NULL; returns NULL if out of memory */
+static char *pool_bin_path(const char *const base, const char *const middle, const int index, char **const dir) {
+    const size_t dir_len = strlen(base) + 1 + strlen(middle);
+    const size_t path_size = dir_len + 1 + INT_STR_LEN + 4 + 1;
+    char *path;
+    if(ALLOC_FAILS(path, path_size)) return NULL;
+    snprintf(path, path_size, "%s/%s/%d.bin", base, middle, index);
+    if(NULL != dir) {
+        if(NULL == (*dir = strndup(path, dir_len))) {
+            free(path);
+            return NULL;
+        }
+    }
+    return path;
+}
+
+/* removes path and, if it is a directory, everything in it */
+static bool pool_remove(const location path) {
+    struct dirent *entry;
+    struct stat st;
+    bool success = true;
+    DIR *dir;
+
+    if(0 != lstat(path.path, &st)) return ENOENT == errno;
+    if(!S_ISDIR(st.st_mode)) return 0 == unlink(path.path);
+    if(NULL == (dir = opendir(path.path))) return false;
+    while(NULL != (entry = readdir(dir))) {
+        if(!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+        location child = location_append(path, entry->d_name);
+        success = NULL != child.path && pool_remove(child) && success;
+        location_free(child);
+    }
+    closedir(dir);
+    return 0 == rmdir(path.path) && success;
+}
+
+static bool pool_count_in(const location pool, unsigned int *const count) {
+    struct dirent *entry;
+    DIR *dir;
+
+    *count = 0;
+    if(NULL == (dir = opendir(pool.path))) {
+        if(ENOENT == errno) return true;
+        fprintf(stderr, "could not open pool %s\n", pool.path);
+        return false;
+    }
+    while(NULL != (entry = readdir(dir)))
+        if(pool_is_entry(entry->d_name)) (*count)++;
+    closedir(dir);
+    return true;
+}
+
+bool pool_count(const encryptor *const enc, unsigned int *const count) {
+    location pool = location_append(enc->private_location, POOL_DIR);
+    if(NULL == pool.path) {
+        fprintf(stderr, "out of memory while counting pool entries\n");
+        return false;
+    }
+    const bool success = pool_count_in(pool, count);
+    location_free(pool);
+    return success;
+}
+
+static bool pool_write(const_mmap_vtable mmap, const location entry, const int global_index, const int symbol, mmap_enc_mat_t ct) {
+    char step_name[INT_STR_LEN + 1], *dir, *path;
+    bool success = false;
+    FILE *dest;
+
+    snprintf(step_name, sizeof(step_name), "%d", global_index);
+    if(NULL == (path = pool_bin_path(entry.path, step_name, symbol, &dir))) {
+        fprintf(stderr, "out of memory while filling pool\n");
+        return false;
+    }
+    if(create_directory_if_missing(dir) && NULL != (dest = fopen(path, "wb"))) {
+        success = fwrite_mmap_enc_mat_bin(mmap, ct, global_index, dest);
+        success = 0 == fclose(dest) && success;
+    }
+    if(!success) fprintf(stderr, "could not write %s\n", path);
+    free(path);
+    free(dir);
+    return success;
+}
+
+/* Starts up to num_entries entries under fresh uids, encodes every symbol of
+ * every step for all of them at once, and moves each into place once it is
+ * complete. Returns the number of entries added. */
+static unsigned int pool_fill_group(const_mmap_vtable mmap, encryptor *const enc, const location pool, fmpz_mat_t *const *const clrs, const unsigned int num_entries) {
+    const mbp_template_stats *const stats    = enc->pp->mbp_params;
+    const mbp_template       *const template = stats->template;
+    const unsigned int steps_len = template->steps_len;
+    unsigned int per_entry = 0, num_ready = 0, added = 0, e, i, s, t;
+    unsigned int *offsets;
+    pool_fill_entry *entries;
+    mmap_enc_mat_t *cts;
+    mife_encode_task *tasks;
+    int encoding_count = 0;
+
+    if(ALLOC_FAILS(entries, num_entries) || ALLOC_FAILS(offsets, steps_len)) {
+        fprintf(stderr, "out of memory while filling pool\n");
+        free(entries);
+        return 0;
+    }
+    for(i = 0; i < steps_len; i++) {
+        const mbp_step *const step = template->steps + i;
+        offsets[i] = per_entry;
+        per_entry += step->symbols_len;
+        encoding_count += step->symbols_len * step->matrix->num_rows * step->matrix->num_cols;
+    }
+
+    /* claim a fresh uid and pick a partition for each entry */
+    for(e = 0; e < num_entries; e++) {
+        pool_fill_entry *const entry = entries + num_ready;
+        location record_location;
+        char *uid;
+
+        if(!encryptor_fresh_location(enc->database_location, enc->pp->L, &record_location, &uid)) break;
+        entry->uid = strdup(uid);
+        location_free(record_location);
+        entry->tmp_location = NULL == entry->uid ? (location) { NULL, false } : pool_location(pool, entry->uid, ".tmp");
+        if(NULL == entry->tmp_location.path || 0 != mkdir(entry->tmp_location.path, S_IRWXU)) {
+            fprintf(stderr, "could not start a pool entry\n");
+            location_free(entry->tmp_location);
+            free(entry->uid);
+            break;
+        }
+        fmpz_init(entry->partition);
+        if(!encryptor_random_partition(enc, entry->uid, entry->partition)) {
+            pool_remove(entry->tmp_location);
+            location_free(entry->tmp_location);
+            fmpz_clear(entry->partition);
+            free(entry->uid);
+            break;
+        }
+        entry->partitions = mife_partitions(enc->pp, entry->partition);
+        entry->success = true;
+        num_ready++;
+    }
+
+    if(0 == num_ready) {
+        free(offsets);
+        free(entries);
+        return 0;
+    }
+
+    const unsigned int num_tasks = num_ready * per_entry;
+    if(ALLOC_FAILS(cts, num_tasks) || ALLOC_FAILS(tasks, num_tasks)) {
+        fprintf(stderr, "out of memory while scheduling encodings\n");
+        exit(-1);
+    }
+
+    set_NUM_ENC(num_ready * encoding_count);
+    NUM_ENCODINGS_GENERATED = 0;
+    reset_T();
+
+    /* every symbol at a step draws from the stream encrypt would use at that
+     * step, so whichever one gets committed is exactly what encrypt would
+     * have produced for the same uid */
+    bool out_of_memory = false;
+#pragma omp parallel for schedule(dynamic,1) if(g_parallel)
+    for(unsigned int k = 0; k < num_ready * steps_len; k++) {
+        const unsigned int j = k / steps_len, step = k % steps_len;
+        for(unsigned int symbol = 0; symbol < template->steps[step].symbols_len; symbol++) {
+            const unsigned int task = j*per_entry + offsets[step] + symbol;
+            aes_randstate_t randstate;
+            if(!mife_substream_init(randstate, &enc->seed, "encrypt", entries[j].uid, step, MIFE_SUBSTREAM_ALL)) {
+                out_of_memory = true;
+                break;
+            }
+            mife_encrypt_matrix_task_init(mmap, enc->pp, enc->sk, randstate, step,
+                                          clrs[step][symbol], stats->state_maps[step][symbol],
+                                          entries[j].partitions, cts[task], tasks + task);
+            aes_randclear(randstate);
+        }
+    }
+    if(out_of_memory) exit(-1);
+
+    mife_encode_tasks(mmap, enc->sk, num_tasks, tasks);
+    timer_printf("\n");
+
+    for(e = 0, t = 0; e < num_ready; e++)
+        for(i = 0; i < steps_len; i++)
+            for(s = 0; s < template->steps[i].symbols_len; s++, t++) {
+                if(entries[e].success)
+                    entries[e].success = pool_write(mmap, entries[e].tmp_location, i, s, cts[t]);
+                mife_encrypt_task_clear(tasks + t);
+                mmap_enc_mat_clear(mmap, cts[t]);
+            }
+
+    /* an entry only appears under its own name once it is complete */
+    for(e = 0; e < num_ready; e++) {
+        pool_fill_entry *const entry = entries + e;
+        location done = pool_location(pool, entry->uid, "");
+        if(entry->success && NULL != done.path && 0 == rename(entry->tmp_location.path, done.path))
+            added++;
+        else
+            pool_remove(entry->tmp_location);
+        location_free(done);
+        location_free(entry->tmp_location);
+        mife_partitions_clear(enc->pp, entry->partitions);
+        fmpz_clear(entry->partition);
+        free(entry->uid);
+    }
+
+    free(tasks);
+    free(cts);
+    free(offsets);
+    free(entries);
+    return added;
+}
+
+bool pool_fill(const_mmap_vtable mmap, encryptor *const enc, const unsigned int target, const unsigned int group_size, unsigned int *const added) {
+    const mbp_template_stats *const stats = enc->pp->mbp_params;
+    const unsigned int steps_len = stats->template->steps_len;
+    location pool = location_append(enc->private_location, POOL_DIR), lock = { NULL, false };
+    fmpz_mat_t **clrs = NULL;
+    int *lens = NULL, fd = -1;
+    unsigned int count, i;
+    struct dirent *entry;
+    bool success = false;
+    DIR *dir;
+
+    *added = 0;
+    if(NULL == pool.path || NULL == (lock = location_append(pool, "fill.lock")).path ||
+       ALLOC_FAILS(clrs, steps_len) || ALLOC_FAILS(lens, steps_len)) {
+        fprintf(stderr, "out of memory while filling pool\n");
+        goto done;
+    }
+    if(!create_directory_if_missing(pool.path)) {
+        fprintf(stderr, "could not create pool directory %s\n", pool.path);
+        goto done;
+    }
+    if((fd = open(lock.path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR)) < 0 || 0 != flock(fd, LOCK_EX)) {
+        fprintf(stderr, "could not lock %s\n", lock.path);
+        goto done;
+    }
+
+    /* only fillers make .tmp entries, so any still here were abandoned */
+    if(NULL != (dir = opendir(pool.path))) {
+        while(NULL != (entry = readdir(dir))) {
+            const size_t len = strlen(entry->d_name);
+            if(len <= 4 || strcmp(entry->d_name + len - 4, ".tmp")) continue;
+            location stale = location_append(pool, entry->d_name);
+            if(NULL != stale.path) pool_remove(stale);
+            location_free(stale);
+        }
+        closedir(dir);
+    }
+
+    for(i = 0; i < steps_len; i++)
+        clrs[i] = NULL;
+    for(i = 0; i < steps_len; i++) {
+        if(NULL == (clrs[i] = mbp_template_stats_to_symbol_cleartexts(stats, i, lens + i))) {
+            fprintf(stderr, "out of memory while filling pool\n");
+            goto done;
+        }
+    }
+
+    /* recount every time, since entries may be committed while we work */
+    while(pool_count_in(pool, &count) && count < target) {
+        const unsigned int wanted = target - count < group_size ? target - count : group_size;
+        const uint64_t t = ggh_walltime(0);
+        const unsigned int group_added = pool_fill_group(mmap, enc, pool, clrs, wanted);
+        *added += group_added;
+        timer_printf("Added %u pool entries in %8.2fs\n", group_added, ggh_seconds(ggh_walltime(t)));
+        if(group_added < wanted) goto done;
+    }
+    success = count >= target;
+
+done:
+    if(NULL != clrs)
+        for(i = 0; i < steps_len && NULL != clrs[i]; i++)
+            mbp_template_stats_symbol_cleartexts_clear(clrs[i], lens[i]);
+    free(clrs);
+    free(lens);
+    if(fd >= 0) close(fd);
+    location_free(lock);
+    location_free(pool);
+    return success;
+}
+
+static bool pool_copy(const char *const src_path, const char *const dest_path) {
+    char buf[65536];
+    size_t len;
+    bool success = false;
+    FILE *src = fopen(src_path, "rb"), *dest = NULL;
+    if(NULL == src || NULL == (dest = fopen(dest_path, "wb"))) goto done;
+    success = true;
+    while(success && 0 < (len = fread(buf, 1, sizeof(buf), src)))
+        success = len == fwrite(buf, 1, len, dest);
+    success = success && !ferror(src);
+
+done:
+    if(NULL != dest) success = 0 == fclose(dest) && success;
+    if(NULL != src) fclose(src);
+    return success;
+}
+
+/* moves the chosen encodings into <database>/<uid>/<position>/<local>.bin */
+static bool pool_commit_files(const encryptor *const enc, const location claimed, const char *const uid, const int *const symbols) {
+    const mbp_template_stats *const stats    = enc->pp->mbp_params;
+    const mbp_template       *const template = stats->template;
+    location record_location = location_append(enc->database_location, uid);
+    char step_name[INT_STR_LEN + 1];
+    bool success = NULL != record_location.path;
+
+    for(unsigned int i = 0; success && i < template->steps_len; i++) {
+        char *src, *dest, *dest_dir = NULL;
+        snprintf(step_name, sizeof(step_name), "%u", i);
+        src  = pool_bin_path(claimed.path, step_name, symbols[i], NULL);
+        dest = pool_bin_path(record_location.path, template->steps[i].position, stats->local_index[i], &dest_dir);
+        success = NULL != src && NULL != dest && create_directory_if_missing(dest_dir);
+        /* the pool and the database may be on different file systems */
+        success = success && (0 == rename(src, dest) || (EXDEV == errno && pool_copy(src, dest)));
+        if(!success) fprintf(stderr, "could not move %s to %s\n", NULL == src ? "?" : src, NULL == dest ? "?" : dest);
+        free(src);
+        free(dest);
+        free(dest_dir);
+    }
+    location_free(record_location);
+    return success;
+}
+
+/* copies the chosen encodings into one record and appends it to the store */
+static bool pool_commit_packed(const encryptor *const enc, const location claimed, const char *const uid, const int *const symbols) {
+    const mbp_template *const template = ((mbp_template_stats *)enc->pp->mbp_params)->template;
+    char step_name[INT_STR_LEN + 1];
+    store_record record;
+    bool success;
+
+    if(!store_record_init(&record, template->steps_len)) {
+        fprintf(stderr, "out of memory while committing pool entry\n");
+        return false;
+    }
+    success = true;
+    for(unsigned int i = 0; success && i < template->steps_len; i++) {
+        char *src;
+        FILE *fp = NULL;
+        snprintf(step_name, sizeof(step_name), "%u", i);
+        src = pool_bin_path(claimed.path, step_name, symbols[i], NULL);
+        success = NULL != src && NULL != (fp = fopen(src, "rb")) && store_record_add_file(&record, i, fp);
+        if(!success) fprintf(stderr, "could not read %s\n", NULL == src ? "pool entry" : src);
+        if(NULL != fp) fclose(fp);
+        free(src);
+    }
+    success = success && store_append(enc->database_location, uid, &record);
+    store_record_clear(&record);
+    return success;
+}
+
+int pool_commit(encryptor *const enc, const mbp_plaintext *const pt, char **const uid) {
+    const mbp_template *const template = ((mbp_template_stats *)enc->pp->mbp_params)->template;
+    location pool = { NULL, false };
+    struct dirent *entry;
+    int *symbols = NULL, problem;
+    DIR *dir = NULL;
+
+    *uid = NULL;
+    if(0 != (problem = encryptor_check_plaintext(enc, pt))) return problem;
+    problem = -1;
+    if(NULL == (pool = location_append(enc->private_location, POOL_DIR)).path ||
+       ALLOC_FAILS(symbols, template->steps_len)) {
+        fprintf(stderr, "out of memory while committing pool entry\n");
+        goto done;
+    }
+    for(unsigned int i = 0; i < template->steps_len; i++)
+        symbols[i] = mbp_step_symbol_index(template->steps + i, pt->symbols[i]);
+
+    if(NULL == (dir = opendir(pool.path))) {
+        /* no pool at all is just an empty one */
+        if(ENOENT == errno) problem = 0;
+        else fprintf(stderr, "could not open pool %s\n", pool.path);
+        goto done;
+    }
+
+    problem = 0;
+    while(NULL == *uid && 0 == problem && NULL != (entry = readdir(dir))) {
+        if(!pool_is_entry(entry->d_name)) continue;
+        location ready   = pool_location(pool, entry->d_name, "");
+        location claimed = pool_location(pool, entry->d_name, ".claimed");
+
+        /* renaming claims the entry; losing the race to another committer
+         * just means trying the next one */
+        if(NULL == ready.path || NULL == claimed.path) {
+            fprintf(stderr, "out of memory while committing pool entry\n");
+            problem = -1;
+        } else if(0 == rename(ready.path, claimed.path)) {
+            /* a uid handed out since the entry was made can't be reused, but
+             * neither can the entry's randomness, so it is thrown away */
+            if(!store_uid_exists(enc->database_location, entry->d_name)) {
+                const bool success = enc->packed
+                    ? pool_commit_packed(enc, claimed, entry->d_name, symbols)
+                    : pool_commit_files (enc, claimed, entry->d_name, symbols);
+                if(!success || NULL == (*uid = strdup(entry->d_name)))
+                    problem = -1;
+            }
+            /* this deletes the encodings of every symbol not chosen */
+            if(!pool_remove(claimed))
+                fprintf(stderr, "could not remove %s\n", claimed.path);
+        }
+        location_free(ready);
+        location_free(claimed);
+    }
+
+done:
+    if(NULL != dir) closedir(dir);
+    free(symbols);
+    location_free(pool);
+    return problem;
+}
@@ -0,0 +1,36 @@
+#ifndef _MIFE_POOL_H
+#define _MIFE_POOL_H
+
+#include "encryptor.h"
+
+/* A pool of records encrypted before their plaintexts are known. Each entry
+ * has a uid and, for every step of the template, an encoding of every symbol
+ * that step knows, made with the same partition and randomness encrypt would
+ * use for that uid. Committing an entry moves the encodings a plaintext picks
+ * into the database and deletes the rest, so the online part of encryption is
+ * a few renames rather than any encoding.
+ *
+ * Entries live in <private>/pool/<uid>/<step>/<symbol>.bin, where step is the
+ * global step index and symbol is the symbol's index in the template. Since
+ * they hold the encodings of every symbol, they are exactly as secret as the
+ * keys. Names with a dot in them are never entries: <uid>.tmp is still being
+ * filled, and <uid>.claimed is being committed. */
+
+#define POOL_DIR "pool"
+
+/* the number of entries ready to be committed */
+bool pool_count(const encryptor *const enc, unsigned int *const count);
+
+/* Adds entries, group_size at a time, until the pool holds target of them;
+ * fillers take turns, so at most one runs at once. Sets *added to the number
+ * of entries this call added, and returns false if it stopped short. */
+bool pool_fill(const_mmap_vtable mmap, encryptor *const enc, const unsigned int target, const unsigned int group_size, unsigned int *const added);
+
+/* Takes one entry out of the pool and commits pt under its uid, to whichever
+ * store enc->packed selects. Returns 0 and sets *uid (which the caller frees)
+ * on success, or leaves *uid NULL if the pool is empty; otherwise returns a
+ * usage code if pt does not fit the template, or -1 on failure. An entry is
+ * used at most once, whether or not committing it worked. */
+int  pool_commit(encryptor *const enc, const mbp_plaintext *const pt, char **const uid);
+
+#endif /* ifndef _MIFE_POOL_H */
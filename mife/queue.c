@@ -0,0 +1,69 @@
+#include <stdlib.h>
+#include "queue.h"
+#include "util.h"
+
+bool queue_init(queue *q, int capacity) {
+  if(capacity < 1 || ALLOC_FAILS(q->items, capacity)) return false;
+  q->capacity = capacity;
+  q->head = 0;
+  q->len = 0;
+  q->closed = false;
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->not_empty, NULL);
+  pthread_cond_init(&q->not_full, NULL);
+  return true;
+}
+
+void queue_push(queue *q, void *item) {
+  pthread_mutex_lock(&q->lock);
+  while(q->len == q->capacity)
+    pthread_cond_wait(&q->not_full, &q->lock);
+  q->items[(q->head + q->len) % q->capacity] = item;
+  q->len++;
+  pthread_cond_signal(&q->not_empty);
+  pthread_mutex_unlock(&q->lock);
+}
+
+/* call with the lock held */
+static void *queue_take(queue *q) {
+  void *item = NULL;
+  if(q->len > 0) {
+    item = q->items[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->len--;
+    pthread_cond_signal(&q->not_full);
+  }
+  return item;
+}
+
+void *queue_pop(queue *q) {
+  void *item;
+  pthread_mutex_lock(&q->lock);
+  while(0 == q->len && !q->closed)
+    pthread_cond_wait(&q->not_empty, &q->lock);
+  item = queue_take(q);
+  pthread_mutex_unlock(&q->lock);
+  return item;
+}
+
+void *queue_try_pop(queue *q) {
+  void *item;
+  pthread_mutex_lock(&q->lock);
+  item = queue_take(q);
+  pthread_mutex_unlock(&q->lock);
+  return item;
+}
+
+void queue_close(queue *q) {
+  pthread_mutex_lock(&q->lock);
+  q->closed = true;
+  pthread_cond_broadcast(&q->not_empty);
+  pthread_mutex_unlock(&q->lock);
+}
+
+void queue_clear(queue *q) {
+  pthread_mutex_destroy(&q->lock);
+  pthread_cond_destroy(&q->not_empty);
+  pthread_cond_destroy(&q->not_full);
+  free(q->items);
+}
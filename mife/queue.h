@@ -0,0 +1,26 @@
+#ifndef _MIFE_QUEUE_H
+#define _MIFE_QUEUE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+/* A bounded, blocking FIFO of pointers for handing work between threads.
+ * push blocks while the queue is full, pop blocks while it is empty; once the
+ * queue is closed, pop drains what is left and then returns NULL. try_pop
+ * never blocks, and returns NULL whenever the queue is empty. */
+typedef struct {
+  void **items;
+  int capacity, head, len;
+  bool closed;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty, not_full;
+} queue;
+
+bool  queue_init (queue *q, int capacity);
+void  queue_push (queue *q, void *item);
+void *queue_pop  (queue *q);
+void *queue_try_pop(queue *q);
+void  queue_close(queue *q);
+void  queue_clear(queue *q);
+
+#endif /* ifndef _MIFE_QUEUE_H */
@@ -0,0 +1,257 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "result_cache.h"
+#include "store.h"
+
+typedef struct {
+  char magic[8];
+  uint64_t fingerprint;
+  uint64_t num_slots;
+} result_cache_header;
+
+/* an all-zero key marks an empty slot */
+typedef struct {
+  result_cache_key key;
+  uint16_t num_rows, num_cols;
+  uint32_t reserved;
+  uint8_t bits[RESULT_CACHE_BITS/8];
+} result_cache_slot;
+
+struct result_cache {
+  int fd;
+  void *map;
+  size_t map_len;
+  result_cache_header *header;
+  result_cache_slot *slots;
+  /* of the parameters this process opened the cache with; another process
+   * opening it with other parameters starts the table over under its own */
+  uint64_t fingerprint;
+  /* the file is locked against other processes with flock, but flock
+   * doesn't tell this process's threads apart */
+  pthread_mutex_t lock;
+  unsigned long hits, misses, stores;
+};
+
+#define RESULT_CACHE_FNV_OFFSET 14695981039346656037ull
+#define RESULT_CACHE_FNV_PRIME  1099511628211ull
+
+static uint64_t result_cache_hash(uint64_t h, const void *data, size_t len) {
+  const unsigned char *p = data;
+  for(size_t i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= RESULT_CACHE_FNV_PRIME;
+  }
+  return h;
+}
+
+static bool result_cache_hash_file(location public_location, const char *name, uint64_t *h) {
+  location path = location_append(public_location, name);
+  unsigned char buf[65536];
+  size_t len;
+  FILE *f;
+
+  if(NULL == path.path || NULL == (f = fopen(path.path, "rb"))) {
+    fprintf(stderr, "could not read %s/%s to fingerprint it\n", public_location.path, name);
+    location_free(path);
+    return false;
+  }
+  while((len = fread(buf, 1, sizeof(buf), f)) > 0)
+    *h = result_cache_hash(*h, buf, len);
+  fclose(f);
+  location_free(path);
+  return true;
+}
+
+result_cache *result_cache_open(location database, location public_location) {
+  const size_t map_len = sizeof(result_cache_header) + RESULT_CACHE_SLOTS*sizeof(result_cache_slot);
+  location path = location_append(database, RESULT_CACHE_FILE);
+  uint64_t fingerprint = RESULT_CACHE_FNV_OFFSET;
+  result_cache *c = NULL;
+  struct stat st;
+  int fd;
+
+  if(NULL == path.path) {
+    fprintf(stderr, "out of memory while opening the result cache\n");
+    return NULL;
+  }
+  if(!result_cache_hash_file(public_location, "template.json", &fingerprint) ||
+     !result_cache_hash_file(public_location, "mife.pub", &fingerprint))
+    goto free_path;
+
+  if((fd = open(path.path, O_RDWR | O_CREAT, 0644)) < 0) {
+    fprintf(stderr, "could not open result cache %s\n", path.path);
+    goto free_path;
+  }
+  if(0 != flock(fd, LOCK_EX) || 0 != fstat(fd, &st)) {
+    fprintf(stderr, "could not lock result cache %s\n", path.path);
+    goto close_fd;
+  }
+
+  /* start over if the file is new, damaged, or from other parameters */
+  result_cache_header header;
+  const bool usable = (size_t)st.st_size == map_len &&
+    sizeof(header) == pread(fd, &header, sizeof(header), 0) &&
+    0 == memcmp(header.magic, RESULT_CACHE_MAGIC, sizeof(header.magic)) &&
+    RESULT_CACHE_SLOTS == header.num_slots && fingerprint == header.fingerprint;
+  if(!usable) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RESULT_CACHE_MAGIC, sizeof(header.magic));
+    header.fingerprint = fingerprint;
+    header.num_slots = RESULT_CACHE_SLOTS;
+    if(0 != ftruncate(fd, 0) || 0 != ftruncate(fd, map_len) ||
+       sizeof(header) != pwrite(fd, &header, sizeof(header), 0)) {
+      fprintf(stderr, "could not initialize result cache %s\n", path.path);
+      goto unlock;
+    }
+  }
+
+  if(NULL == (c = calloc(1, sizeof(*c)))) {
+    fprintf(stderr, "out of memory while opening the result cache\n");
+    goto unlock;
+  }
+  c->map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(MAP_FAILED == c->map) {
+    fprintf(stderr, "could not map result cache %s\n", path.path);
+    free(c);
+    c = NULL;
+    goto unlock;
+  }
+  c->fd = fd;
+  c->map_len = map_len;
+  c->header = c->map;
+  c->slots = (result_cache_slot *)(c->header + 1);
+  c->fingerprint = fingerprint;
+  pthread_mutex_init(&c->lock, NULL);
+
+unlock:
+  flock(fd, LOCK_UN);
+close_fd:
+  if(NULL == c) close(fd);
+free_path:
+  location_free(path);
+  return c;
+}
+
+bool result_cache_key_of(const result_cache *c, location database, const ciphertext_mapping mapping, result_cache_key *key) {
+  unsigned int *order;
+  bool success = false;
+
+  /* the same mapping may list its positions in any order; there are only a
+   * handful of them */
+  if(ALLOC_FAILS(order, mapping.positions_len+1)) return false;
+  for(unsigned int i = 0; i < mapping.positions_len; i++) {
+    unsigned int j = i;
+    for(; j > 0 && strcmp(mapping.positions[order[j-1]], mapping.positions[i]) > 0; j--)
+      order[j] = order[j-1];
+    order[j] = i;
+  }
+
+  /* two differently-seeded hashes make a 128-bit key */
+  key->h[0] = result_cache_hash(RESULT_CACHE_FNV_OFFSET, &c->fingerprint, sizeof(c->fingerprint));
+  key->h[1] = result_cache_hash(c->fingerprint, "\x01", 1);
+  for(unsigned int i = 0; i < mapping.positions_len; i++) {
+    const char *position = mapping.positions[order[i]], *uid = mapping.uids[order[i]];
+    uint64_t stamp;
+    if(!store_stamp(database, uid, position, &stamp)) goto free_order;
+    for(unsigned int k = 0; k < 2; k++) {
+      key->h[k] = result_cache_hash(key->h[k], position, strlen(position)+1);
+      key->h[k] = result_cache_hash(key->h[k], uid, strlen(uid)+1);
+      key->h[k] = result_cache_hash(key->h[k], &stamp, sizeof(stamp));
+    }
+  }
+  key->h[0] |= 1;
+  success = true;
+
+free_order:
+  free(order);
+  return success;
+}
+
+static bool result_cache_key_eq(const result_cache_key *a, const result_cache_key *b) {
+  return a->h[0] == b->h[0] && a->h[1] == b->h[1];
+}
+
+bool result_cache_lookup(result_cache *c, const result_cache_key *key, f2_matrix *result) {
+  const uint64_t home = key->h[0] % RESULT_CACHE_SLOTS;
+  bool found = false;
+
+  pthread_mutex_lock(&c->lock);
+  flock(c->fd, LOCK_SH);
+  /* if the table now holds results for other parameters, none are ours */
+  for(unsigned int p = 0; p < RESULT_CACHE_PROBES && !found && c->fingerprint == c->header->fingerprint; p++) {
+    const result_cache_slot *const slot = c->slots + (home + p) % RESULT_CACHE_SLOTS;
+    if(!result_cache_key_eq(&slot->key, key)) continue;
+    if(!f2_matrix_zero(result, slot->num_rows, slot->num_cols)) break;
+    for(unsigned int i = 0; i < result->num_rows; i++)
+      for(unsigned int j = 0; j < result->num_cols; j++) {
+        const unsigned int bit = i*result->num_cols + j;
+        result->elems[i][j] = (slot->bits[bit/8] >> (bit%8)) & 1;
+      }
+    found = true;
+  }
+  flock(c->fd, LOCK_UN);
+  if(found) c->hits++;
+  else c->misses++;
+  pthread_mutex_unlock(&c->lock);
+  return found;
+}
+
+void result_cache_insert(result_cache *c, const result_cache_key *key, const f2_matrix result) {
+  const uint64_t home = key->h[0] % RESULT_CACHE_SLOTS;
+  result_cache_slot entry, *slot = NULL;
+
+  if((uint64_t)result.num_rows * result.num_cols > RESULT_CACHE_BITS) return;
+  memset(&entry, 0, sizeof(entry));
+  entry.key = *key;
+  entry.num_rows = result.num_rows;
+  entry.num_cols = result.num_cols;
+  for(unsigned int i = 0; i < result.num_rows; i++)
+    for(unsigned int j = 0; j < result.num_cols; j++)
+      if(result.elems[i][j]) {
+        const unsigned int bit = i*result.num_cols + j;
+        entry.bits[bit/8] |= 1 << (bit%8);
+      }
+
+  pthread_mutex_lock(&c->lock);
+  flock(c->fd, LOCK_EX);
+  /* don't leave results for these parameters in a table that another
+   * process has since started over for its own */
+  if(c->fingerprint != c->header->fingerprint) {
+    flock(c->fd, LOCK_UN);
+    pthread_mutex_unlock(&c->lock);
+    return;
+  }
+  /* reuse this key's slot or an empty one if there is one nearby, or else
+   * evict a neighbour picked by the key */
+  for(unsigned int p = 0; p < RESULT_CACHE_PROBES && NULL == slot; p++) {
+    result_cache_slot *const s = c->slots + (home + p) % RESULT_CACHE_SLOTS;
+    if(result_cache_key_eq(&s->key, key) || (0 == s->key.h[0] && 0 == s->key.h[1]))
+      slot = s;
+  }
+  if(NULL == slot)
+    slot = c->slots + (home + key->h[1] % RESULT_CACHE_PROBES) % RESULT_CACHE_SLOTS;
+  *slot = entry;
+  flock(c->fd, LOCK_UN);
+  c->stores++;
+  pthread_mutex_unlock(&c->lock);
+}
+
+void result_cache_print_stats(const result_cache *c, FILE *fp) {
+  const unsigned long lookups = c->hits + c->misses;
+  fprintf(fp, "result cache: %lu hits, %lu misses (%.1f%% hit rate), %lu stored\n",
+    c->hits, c->misses, lookups > 0 ? 100.0 * c->hits / lookups : 0.0, c->stores);
+}
+
+void result_cache_free(result_cache *c) {
+  munmap(c->map, c->map_len);
+  close(c->fd);
+  pthread_mutex_destroy(&c->lock);
+  free(c);
+}
@@ -0,0 +1,50 @@
+#ifndef _MIFE_RESULT_CACHE_H
+#define _MIFE_RESULT_CACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mbp_types.h"
+#include "util.h"
+
+/* A persistent, memory-mapped cache of evaluation results, shared by every
+ * process evaluating against the same database. An entry is keyed by a
+ * fingerprint of the template and public parameters together with each
+ * position, the uid mapped to it, and a stamp of that record (see
+ * store_stamp), so re-encrypting or deleting a record, or evaluating under
+ * different parameters, never finds an old answer. The table has a fixed
+ * number of slots; a new entry whose neighbourhood is full evicts one of
+ * its neighbours, which is how entries for stale records get reclaimed. The
+ * whole table is dropped when it was written under other parameters, and a
+ * process whose parameters no longer match the table's then neither finds
+ * nor stores anything in it. */
+
+#define RESULT_CACHE_FILE  "results"
+#define RESULT_CACHE_MAGIC "MIFERES" /* with its terminator, 8 bytes */
+#define RESULT_CACHE_SLOTS 65536
+/* how many slots past its home a key may be found in */
+#define RESULT_CACHE_PROBES 8
+/* the largest result, in entries, that fits in a slot */
+#define RESULT_CACHE_BITS 320
+
+typedef struct result_cache result_cache;
+
+typedef struct {
+  uint64_t h[2];
+} result_cache_key;
+
+/* opens <database>/results, creating it if need be, for evaluations with the
+ * template and public parameters in public_location; returns NULL (after
+ * saying why on stderr) on failure */
+result_cache *result_cache_open(location database, location public_location);
+/* returns false, quietly, if some mapped record is not in the database */
+bool result_cache_key_of(const result_cache *c, location database, const ciphertext_mapping mapping, result_cache_key *key);
+/* on a hit, returns true and sets *result, which the caller must free */
+bool result_cache_lookup(result_cache *c, const result_cache_key *key, f2_matrix *result);
+/* failing to remember a result only costs a repeat evaluation later, so
+ * this says nothing if the result doesn't fit */
+void result_cache_insert(result_cache *c, const result_cache_key *key, const f2_matrix result);
+void result_cache_print_stats(const result_cache *c, FILE *fp);
+void result_cache_free(result_cache *c);
+
+#endif /* ifndef _MIFE_RESULT_CACHE_H */
@@ -0,0 +1,261 @@
+#include <getopt.h>
+#include <string.h>
+
+#include <mife/mife.h>
+#include <gghlite/misc.h>
+
+#include "evaluator.h"
+#include "order_index.h"
+#include "store.h"
+#include "util.h"
+
+#define SCAN_MAX_QUERIES 2
+
+/* a fixed record for the query position, and the outputs that count as a
+ * match when it is evaluated against a scanned record */
+typedef struct {
+	char *uid;
+	char **labels;
+	unsigned int labels_len;
+} scan_query;
+
+typedef struct {
+	evaluator ev;
+	/* the position the queries go in; scanned records go in the other one */
+	const char *position, *other;
+	scan_query queries[SCAN_MAX_QUERIES];
+	unsigned int queries_len;
+} scan_inputs;
+
+void mife_scan_parse_cmdline(int argc, char **argv, scan_inputs *const ins, const mmap_vtable **mmap);
+bool mife_scan(const_mmap_vtable mmap, const scan_inputs *const ins);
+void mife_scan_cleanup(const_mmap_vtable mmap, scan_inputs ins);
+
+int main(int argc, char **argv) {
+	scan_inputs ins;
+
+	const mmap_vtable *mmap;
+	mife_scan_parse_cmdline(argc, argv, &ins, &mmap);
+
+	const bool success = mife_scan(mmap, &ins);
+	mife_scan_cleanup(mmap, ins);
+	return success ? 0 : -1;
+}
+
+static void mife_scan_usage(const int code) {
+	/* separate the diagnostic information from the usage information a little bit */
+	if(0 != code) printf("\n\n");
+	printf(
+		"USAGE: mife-scan [OPTIONS] QUERY LABELS [QUERY LABELS]\n"
+		"Evaluates a two-position template with each QUERY record in one position\n"
+		"against every other record in the database in the other position, and prints\n"
+		"the uid of each record for which every QUERY's evaluation has a non-zero\n"
+		"output among its comma-separated LABELS. Uids are printed as soon as they\n"
+		"match, so they come out in no particular order.\n"
+		"\n"
+		"For example, with an ORE template whose outputs are <, =, and >, and records\n"
+		"lo and hi encrypting the ends of a range,\n"
+		"    mife-scan lo '<,=' hi '>,='\n"
+		"prints the records r with lo <= r <= hi.\n"
+		"\n"
+		"Brackets indicate default values for each argument.\n"
+		"\n"
+		"Common options:\n"
+		"  -h, --help               Display this usage information\n"
+		"  -u, --public             A directory for public parameters [public]\n"
+		"  -d, --db, --database     A directory to store encrypted values in [database]\n"
+		"  -C, --clt13              Use CLT13 as the underlying multilinear map\n"
+		"  -s, --sequential         Disable parallelism\n"
+		"\n"
+		"Scan-specific options:\n"
+		"  -p, --position           The position for the queries [the template's\n"
+		"                           first position]\n"
+		"  -m, --cache              Keep up to this many MiB of step matrices in\n"
+		"                           memory; 0 disables the cache [1024]\n"
+		"  -R, --results            Remember results in <database>/results and\n"
+		"                           reuse them, in this run and later ones\n"
+		"\n"
+		"Files used:\n"
+		"  <database>/<uid>/<position>/*.bin\n"
+		"                            R  binary  the encrypted records\n"
+		"  <database>/packed/*/*     R  binary  the encrypted records, if they were\n"
+		"                                       encrypted with --packed\n"
+		"  <database>/results       RW  binary  remembered results, with --results\n"
+		"  <public>/template.json    R  JSON    a description of the function being\n"
+		"                                       evaluated\n"
+		"  <public>/mife.pub         R  custom  public parameters for evaluating\n"
+		);
+	exit(code);
+}
+
+/* splits a comma-separated list in place */
+static bool mife_scan_parse_labels(char *list, scan_query *const q) {
+	unsigned int n = 1;
+	for(char *p = list; *p; p++)
+		if(',' == *p) n++;
+	if(ALLOC_FAILS(q->labels, n)) return false;
+	q->labels_len = 0;
+	for(char *label = strtok(list, ","); NULL != label; label = strtok(NULL, ","))
+		q->labels[q->labels_len++] = label;
+	return true;
+}
+
+void mife_scan_parse_cmdline(int argc, char **argv, scan_inputs *const ins, const mmap_vtable **mmap) {
+	/* set defaults */
+	evaluator_options opts;
+	evaluator_options_init(&ins->ev, &opts);
+	ins->position = ins->other = NULL;
+	ins->queries_len = 0;
+
+	bool done = false;
+	struct option long_opts[] =
+		{ EVALUATOR_LONG_OPTIONS
+		, {"help"      ,       no_argument, NULL, 'h'}
+		, {"position"  , required_argument, NULL, 'p'}
+		, {NULL, 0, NULL, 0}
+		};
+
+	while(!done) {
+		int c = getopt_long(argc, argv, EVALUATOR_OPTSTRING "hp:", long_opts, NULL);
+		switch(c) {
+			case  -1: done = true; break;
+			case   0: break; /* a long option with non-NULL flag; should never happen */
+			case '?': mife_scan_usage(1); break; /* braking is good defensive driving */
+			case 'h': mife_scan_usage(0); break;
+			case 'p': ins->position = optarg; break;
+			default:
+				if(!evaluator_parse_option(&ins->ev, &opts, *argv, c, optarg, mife_scan_usage)) {
+					fprintf(stderr, "The impossible happened! getopt returned %d (%c)\n", c, c);
+					exit(-1);
+				}
+				break;
+		}
+	}
+
+	*mmap = opts.mmap;
+
+	/* read the queries */
+	const int args = argc - optind;
+	if(args < 2 || args > 2*SCAN_MAX_QUERIES || 0 != args % 2) {
+		fprintf(stderr, "%s: specify one or two QUERY LABELS pairs (found %d arguments)\n", *argv, args);
+		mife_scan_usage(2);
+	}
+	for(int i = optind; i < argc; i += 2) {
+		scan_query *const q = ins->queries + ins->queries_len++;
+		q->uid = argv[i];
+		if(!mife_scan_parse_labels(argv[i+1], q)) {
+			fprintf(stderr, "%s: out of memory while reading labels\n", *argv);
+			exit(-1);
+		}
+	}
+
+	/* read the template and public parameters */
+	int code = evaluator_load(opts.mmap, &ins->ev, opts.public_location);
+	if(code > 0) mife_scan_usage(code);
+	if(code < 0) exit(-1);
+
+	const mbp_template_stats *const stats = evaluator_stats(&ins->ev);
+	if(2 != stats->positions_len) {
+		fprintf(stderr, "%s: scans need a template with exactly 2 positions, not %u\n", *argv, stats->positions_len);
+		mife_scan_usage(5);
+	}
+	if(NULL == ins->position) ins->position = stats->positions[0];
+	if(!strcmp(ins->position, stats->positions[0])) ins->other = stats->positions[1];
+	else if(!strcmp(ins->position, stats->positions[1])) ins->other = stats->positions[0];
+	else {
+		fprintf(stderr, "%s: the template has no position %s\n", *argv, ins->position);
+		mife_scan_usage(6);
+	}
+
+	if(!evaluator_open_caches(&ins->ev, &opts)) exit(-1);
+}
+
+/* whether the evaluation of query q against uid gives one of q's labels;
+ * sets *failed instead if it can't be evaluated */
+static bool mife_scan_matches(const_mmap_vtable mmap, const scan_inputs *const ins, const scan_query *const q, const char *uid, bool *const failed) {
+	const string_matrix outputs = evaluator_template(&ins->ev)->outputs;
+	char *positions[2] = { (char *)ins->position, (char *)ins->other };
+	char *uids[2] = { q->uid, (char *)uid };
+	const ciphertext_mapping mapping = { 2, positions, uids };
+	bool match = false;
+
+	f2_matrix result = evaluator_evaluate(mmap, &ins->ev, mapping);
+	if(NULL == result.elems) {
+		*failed = true;
+		return false;
+	}
+	for(unsigned int i = 0; i < result.num_rows && i < outputs.num_rows; i++)
+		for(unsigned int j = 0; j < result.num_cols && j < outputs.num_cols; j++)
+			for(unsigned int k = 0; result.elems[i][j] && k < q->labels_len; k++)
+				match = match || !strcmp(outputs.elems[i][j], q->labels[k]);
+	f2_matrix_free(result);
+	return match;
+}
+
+bool mife_scan(const_mmap_vtable mmap, const scan_inputs *const ins) {
+	const char *const skip[] = { ORDER_INDEX_DIR, NULL };
+	evaluator_pin *pins[SCAN_MAX_QUERIES] = { NULL };
+	char **uids = NULL;
+	size_t uids_len = 0;
+	unsigned long matches = 0, failures = 0;
+	bool success = false;
+	unsigned int q;
+
+	if(!store_list(ins->ev.database_location, skip, &uids, &uids_len)) goto free_uids;
+
+	/* the query side is the same for every evaluation, so load it once up
+	 * front and keep it out of reach of eviction */
+	for(q = 0; q < ins->queries_len; q++) {
+		if(NULL == (pins[q] = evaluator_pin_record(mmap, &ins->ev, ins->position, ins->queries[q].uid))) {
+			fprintf(stderr, "could not load query record %s\n", ins->queries[q].uid);
+			goto unpin;
+		}
+	}
+
+	uint64_t t = ggh_walltime(0);
+#pragma omp parallel for schedule(dynamic,1) reduction(+:matches,failures) if(g_parallel)
+	for(size_t i = 0; i < uids_len; i++) {
+		bool match = true, failed = false, is_query = false;
+		for(unsigned int k = 0; k < ins->queries_len; k++)
+			is_query = is_query || !strcmp(uids[i], ins->queries[k].uid);
+		if(is_query) continue;
+
+		/* later queries only need checking if the earlier ones matched */
+		for(unsigned int k = 0; match && !failed && k < ins->queries_len; k++)
+			match = mife_scan_matches(mmap, ins, ins->queries + k, uids[i], &failed);
+
+		if(failed) {
+			fprintf(stderr, "could not evaluate record %s\n", uids[i]);
+			failures++;
+		} else if(match) {
+#pragma omp critical(mife_scan_output)
+			{
+				printf("%s\n", uids[i]);
+				fflush(stdout);
+			}
+			matches++;
+		}
+	}
+
+	const double seconds = ggh_seconds(ggh_walltime(t));
+	fprintf(stderr, "scanned %zu records: %lu matched, %lu failed, in %.2fs (%.2f records/s)\n",
+		uids_len, matches, failures, seconds, seconds > 0 ? uids_len / seconds : 0.0);
+	if(NULL != ins->ev.cache)
+		enc_cache_print_stats(ins->ev.cache, stderr);
+	if(NULL != ins->ev.results)
+		result_cache_print_stats(ins->ev.results, stderr);
+	success = 0 == failures;
+
+unpin:
+	for(q = 0; q < ins->queries_len; q++)
+		if(NULL != pins[q]) evaluator_unpin_record(&ins->ev, pins[q]);
+free_uids:
+	lines_free(uids, uids_len);
+	return success;
+}
+
+void mife_scan_cleanup(const_mmap_vtable mmap, scan_inputs ins) {
+	for(unsigned int q = 0; q < ins.queries_len; q++)
+		free(ins.queries[q].labels);
+	evaluator_clear(mmap, &ins.ev);
+}
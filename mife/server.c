@@ -0,0 +1,184 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "util.h"
+
+struct server_conn {
+  FILE *in, *out;
+  /* guards out and refs */
+  pthread_mutex_t lock;
+  unsigned int refs;
+};
+
+typedef struct {
+  server *s;
+  server_conn *conn;
+} server_reader_args;
+
+static volatile sig_atomic_t server_stopped = 0;
+
+static void server_stop(int signal) {
+  (void) signal;
+  server_stopped = 1;
+}
+
+bool server_stopping(void) {
+  return 0 != server_stopped;
+}
+
+int server_spawn(pthread_t *thread, const pthread_attr_t *attr, void *(*run)(void *), void *arg) {
+  sigset_t stop, old;
+  sigemptyset(&stop);
+  sigaddset(&stop, SIGINT);
+  sigaddset(&stop, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop, &old);
+  const int result = pthread_create(thread, attr, run, arg);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  return result;
+}
+
+FILE *server_reply_begin(server_conn *conn) {
+  pthread_mutex_lock(&conn->lock);
+  return conn->out;
+}
+
+void server_reply_end(server_conn *conn) {
+  fflush(conn->out);
+  pthread_mutex_unlock(&conn->lock);
+}
+
+void server_conn_release(server_conn *conn) {
+  pthread_mutex_lock(&conn->lock);
+  const bool last = 0 == --conn->refs;
+  pthread_mutex_unlock(&conn->lock);
+  if(!last) return;
+  fclose(conn->in);
+  fclose(conn->out);
+  pthread_mutex_destroy(&conn->lock);
+  free(conn);
+}
+
+/* reads requests off one connection and hands them to the daemon, which may
+ * block here to hold back clients that get too far ahead */
+static void *server_reader(void *arg) {
+  server_reader_args *const args = arg;
+  server *const s = args->s;
+  server_conn *const conn = args->conn;
+  unsigned long line = 0;
+  char *buf = NULL;
+  size_t buf_size = 0;
+  ssize_t len;
+
+  free(args);
+  while((len = getline(&buf, &buf_size, conn->in)) >= 0) {
+    void *request;
+    line++;
+    while(len > 0 && ('\n' == buf[len-1] || '\r' == buf[len-1]))
+      buf[--len] = '\0';
+    /* skip blank lines */
+    if(strspn(buf, " \t") == (size_t)len) continue;
+
+    if(NULL == (request = s->parse(s->context, conn, line, buf))) continue;
+    pthread_mutex_lock(&conn->lock);
+    conn->refs++;
+    pthread_mutex_unlock(&conn->lock);
+    s->handle(s->context, request);
+  }
+  free(buf);
+  server_conn_release(conn);
+  return NULL;
+}
+
+bool server_listen(server *s) {
+  struct sockaddr_un addr;
+  struct sigaction stop;
+  struct stat st;
+
+  if(strlen(s->socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "socket path %s is too long\n", s->socket_path);
+    return false;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, s->socket_path);
+
+  /* a socket left over from an earlier run is in the way, but anything
+   * else at that path is somebody's data */
+  if(0 == lstat(s->socket_path, &st) && S_ISSOCK(st.st_mode))
+    unlink(s->socket_path);
+  const mode_t mask = s->owner_only ? umask(077) : 0;
+  if((s->listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+     0 != bind(s->listener, (struct sockaddr *)&addr, sizeof(addr)) ||
+     0 != listen(s->listener, SOMAXCONN)) {
+    fprintf(stderr, "could not listen on %s: %s\n", s->socket_path, strerror(errno));
+    if(s->owner_only) umask(mask);
+    if(s->listener >= 0) close(s->listener);
+    return false;
+  }
+  if(s->owner_only) umask(mask);
+
+  /* without SA_RESTART, so that accept notices */
+  memset(&stop, 0, sizeof(stop));
+  stop.sa_handler = server_stop;
+  sigemptyset(&stop.sa_mask);
+  sigaction(SIGINT, &stop, NULL);
+  sigaction(SIGTERM, &stop, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  return true;
+}
+
+void server_unlisten(server *s) {
+  close(s->listener);
+  unlink(s->socket_path);
+}
+
+void server_run(server *s) {
+  pthread_attr_t detached;
+  pthread_t reader;
+
+  pthread_attr_init(&detached);
+  pthread_attr_setdetachstate(&detached, PTHREAD_CREATE_DETACHED);
+  while(!server_stopped) {
+    server_reader_args *args;
+    server_conn *conn;
+    int in_fd = accept(s->listener, NULL, NULL), out_fd;
+    if(in_fd < 0) {
+      if(EINTR != errno && ECONNABORTED != errno)
+        fprintf(stderr, "could not accept a connection: %s\n", strerror(errno));
+      continue;
+    }
+
+    if(ALLOC_FAILS(conn, 1) || ALLOC_FAILS(args, 1)) {
+      free(conn);
+      close(in_fd);
+      continue;
+    }
+    conn->in = fdopen(in_fd, "r");
+    conn->out = (out_fd = dup(in_fd)) < 0 ? NULL : fdopen(out_fd, "w");
+    if(NULL == conn->in || NULL == conn->out) {
+      fprintf(stderr, "could not set up a connection: %s\n", strerror(errno));
+      if(NULL != conn->in) fclose(conn->in); else close(in_fd);
+      if(NULL != conn->out) fclose(conn->out); else if(out_fd >= 0) close(out_fd);
+      free(conn);
+      free(args);
+      continue;
+    }
+    pthread_mutex_init(&conn->lock, NULL);
+    conn->refs = 1;
+    *args = (server_reader_args) { s, conn };
+    if(0 != server_spawn(&reader, &detached, server_reader, args)) {
+      fprintf(stderr, "could not start a thread for a connection\n");
+      free(args);
+      server_conn_release(conn);
+    }
+  }
+  pthread_attr_destroy(&detached);
+  server_unlisten(s);
+}
@@ -0,0 +1,61 @@
+#ifndef _MIFE_SERVER_H
+#define _MIFE_SERVER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* The Unix domain socket scaffolding shared by evald and encryptd. The main
+ * thread accepts connections until SIGINT or SIGTERM, and each connection
+ * gets a detached reader thread that splits it into lines and passes every
+ * non-blank one, tagged with its line number, to the daemon's parse callback.
+ * Whatever that returns goes to the handle callback, which usually queues it
+ * for the daemon's own threads. Those threads reply whenever they are done,
+ * so replies can come back out of order.
+ *
+ * A connection stays open until its reader has seen end of file and every
+ * request handed to handle has been released with server_conn_release. Only
+ * one server may run in a process, since it takes over SIGINT and SIGTERM. */
+
+typedef struct server_conn server_conn;
+
+typedef struct {
+  /* turns one line from conn, without its line ending, into a request; or
+   * answers it on the spot (with an error, say) and returns NULL. Runs on
+   * conn's reader thread. */
+  void *(*parse)(void *context, server_conn *conn, unsigned long id, char *line);
+  /* takes over a request parse returned; once it has been answered, whoever
+   * holds it must call server_conn_release(conn) */
+  void (*handle)(void *context, void *request);
+  void *context;
+  const char *socket_path;
+  /* whether only this process's owner may connect */
+  bool owner_only;
+  int listener;
+} server;
+
+/* Creates the socket, replacing one left over from an earlier run, and sets
+ * up the signal handlers; returns false (after saying why on stderr) if the
+ * server can't be started. */
+bool server_listen(server *s);
+/* accepts connections until SIGINT or SIGTERM, then removes the socket */
+void server_run(server *s);
+/* removes the socket without running the server */
+void server_unlisten(server *s);
+/* whether SIGINT or SIGTERM has arrived */
+bool server_stopping(void);
+
+/* pthread_create, except that the thread never takes SIGINT or SIGTERM, so
+ * that they always interrupt accept in the main thread rather than some read;
+ * start every thread of a daemon this way */
+int  server_spawn(pthread_t *thread, const pthread_attr_t *attr, void *(*run)(void *), void *arg);
+
+/* locks conn for writing one whole reply to the returned stream, so that
+ * replies from different threads never interleave; a client that has gone
+ * away just stops getting replies */
+FILE *server_reply_begin(server_conn *conn);
+/* flushes the reply and unlocks conn */
+void  server_reply_end(server_conn *conn);
+void  server_conn_release(server_conn *conn);
+
+#endif /* ifndef _MIFE_SERVER_H */
@@ -0,0 +1,178 @@
+#include <getopt.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <mife/mife.h>
+
+#include "compare.h"
+#include "evaluator.h"
+#include "util.h"
+
+typedef struct {
+	evaluator ev;
+	/* the positions the two sides of a comparison go in; NULL for default */
+	const char *left, *right;
+	/* the output label that means the left record sorts first */
+	const char *less;
+	/* where to read the uids to sort from, one per line */
+	FILE *input;
+} sort_inputs;
+
+void mife_sort_parse_cmdline(int argc, char **argv, sort_inputs *const ins, const mmap_vtable **mmap);
+void mife_sort_cleanup(const_mmap_vtable mmap, sort_inputs ins, char **uids, size_t uids_len);
+
+int main(int argc, char **argv) {
+	sort_inputs ins;
+	comparator *cmp;
+	char **uids = NULL;
+	unsigned int *order = NULL;
+	size_t uids_len = 0, i;
+	bool success = false;
+
+	const mmap_vtable *mmap;
+	mife_sort_parse_cmdline(argc, argv, &ins, &mmap);
+
+	if(!read_lines(ins.input, &uids, &uids_len) || ALLOC_FAILS(order, uids_len+1)) {
+		fprintf(stderr, "%s: out of memory while reading uids\n", *argv);
+		goto cleanup;
+	}
+	if(NULL == (cmp = comparator_new(mmap, &ins.ev, ins.left, ins.right, ins.less)))
+		goto cleanup;
+
+	for(i = 0; i < uids_len; i++) order[i] = i;
+	success = comparator_sort(cmp, uids, order, uids_len);
+	if(success)
+		for(i = 0; i < uids_len; i++)
+			printf("%s\n", uids[order[i]]);
+	else
+		fprintf(stderr, "%s: some comparisons could not be evaluated\n", *argv);
+
+	fprintf(stderr, "sorted %zu records; ", uids_len);
+	comparator_print_stats(cmp, stderr);
+	if(NULL != ins.ev.cache)
+		enc_cache_print_stats(ins.ev.cache, stderr);
+	if(NULL != ins.ev.results)
+		result_cache_print_stats(ins.ev.results, stderr);
+	comparator_free(cmp);
+
+cleanup:
+	free(order);
+	mife_sort_cleanup(mmap, ins, uids, uids_len);
+
+	{
+		struct rusage usage;
+		(void) getrusage(RUSAGE_SELF, &usage);
+		(void) fprintf(stderr, "Max memory usage: %ld\n", usage.ru_maxrss);
+	}
+
+	return success ? 0 : -1;
+}
+
+static void mife_sort_usage(const int code) {
+	/* separate the diagnostic information from the usage information a little bit */
+	if(0 != code) printf("\n\n");
+	printf(
+		"USAGE: mife-sort [OPTIONS] [FILE]\n"
+		"Sorts encrypted records by comparing them with a two-position template, such\n"
+		"as the ORE templates in samples/. FILE (or stdin, if it is missing or -) holds\n"
+		"one uid per line; the same uids are printed in sorted order, one per line.\n"
+		"Records that compare equal keep their input order.\n"
+		"\n"
+		"A record sorts before another when evaluating the template with the first\n"
+		"in the left position and the second in the right one gives the --less\n"
+		"output. Comparisons run in parallel, each answer is remembered, and step\n"
+		"matrices stay cached in memory across comparisons.\n"
+		"\n"
+		"Brackets indicate default values for each argument.\n"
+		"\n"
+		"Common options:\n"
+		"  -h, --help               Display this usage information\n"
+		"  -u, --public             A directory for public parameters [public]\n"
+		"  -d, --db, --database     A directory to store encrypted values in [database]\n"
+		"  -C, --clt13              Use CLT13 as the underlying multilinear map\n"
+		"  -s, --sequential         Disable parallelism\n"
+		"\n"
+		"Sort-specific options:\n"
+		"  -l, --left               The position for the left side of a comparison\n"
+		"                           [the template's first position]\n"
+		"  -r, --right              The position for the right side [the other one]\n"
+		"  -L, --less               The output meaning that the left side sorts\n"
+		"                           first [<]\n"
+		"  -m, --cache              Keep up to this many MiB of step matrices in\n"
+		"                           memory; 0 disables the cache [1024]\n"
+		"  -R, --results            Remember results in <database>/results and\n"
+		"                           reuse them, in this run and later ones\n"
+		"\n"
+		"Files used:\n"
+		"  <database>/<uid>/<position>/*.bin\n"
+		"                            R  binary  the encrypted records\n"
+		"  <database>/packed/*/*     R  binary  the encrypted records, if they were\n"
+		"                                       encrypted with --packed\n"
+		"  <database>/results       RW  binary  remembered results, with --results\n"
+		"  <public>/template.json    R  JSON    a description of the comparison\n"
+		"  <public>/mife.pub         R  custom  public parameters for evaluating\n"
+		);
+	exit(code);
+}
+
+void mife_sort_parse_cmdline(int argc, char **argv, sort_inputs *const ins, const mmap_vtable **mmap) {
+	/* set defaults */
+	evaluator_options opts;
+	evaluator_options_init(&ins->ev, &opts);
+	ins->left = ins->right = NULL;
+	ins->less = "<";
+	ins->input = stdin;
+
+	bool done = false;
+	struct option long_opts[] =
+		{ EVALUATOR_LONG_OPTIONS
+		, {"help"      ,       no_argument, NULL, 'h'}
+		, {"left"      , required_argument, NULL, 'l'}
+		, {"right"     , required_argument, NULL, 'r'}
+		, {"less"      , required_argument, NULL, 'L'}
+		, {NULL, 0, NULL, 0}
+		};
+
+	while(!done) {
+		int c = getopt_long(argc, argv, EVALUATOR_OPTSTRING "hl:L:r:", long_opts, NULL);
+		switch(c) {
+			case  -1: done = true; break;
+			case   0: break; /* a long option with non-NULL flag; should never happen */
+			case '?': mife_sort_usage(1); break; /* braking is good defensive driving */
+			case 'h': mife_sort_usage(0); break;
+			case 'l': ins->left = optarg; break;
+			case 'L': ins->less = optarg; break;
+			case 'r': ins->right = optarg; break;
+			default:
+				if(!evaluator_parse_option(&ins->ev, &opts, *argv, c, optarg, mife_sort_usage)) {
+					fprintf(stderr, "The impossible happened! getopt returned %d (%c)\n", c, c);
+					exit(-1);
+				}
+				break;
+		}
+	}
+
+	*mmap = opts.mmap;
+
+	if(optind < argc-1) {
+		fprintf(stderr, "%s: specify at most one file of uids (found %d)\n", *argv, argc-optind);
+		mife_sort_usage(2);
+	}
+	if(optind == argc-1 && strcmp(argv[optind], "-") && NULL == (ins->input = fopen(argv[optind], "r"))) {
+		fprintf(stderr, "%s: could not open '%s'\n", *argv, argv[optind]);
+		mife_sort_usage(3);
+	}
+
+	/* read the template and public parameters */
+	int code = evaluator_load(opts.mmap, &ins->ev, opts.public_location);
+	if(code > 0) mife_sort_usage(code);
+	if(code < 0) exit(-1);
+
+	if(!evaluator_open_caches(&ins->ev, &opts)) exit(-1);
+}
+
+void mife_sort_cleanup(const_mmap_vtable mmap, sort_inputs ins, char **uids, size_t uids_len) {
+	lines_free(uids, uids_len);
+	if(stdin != ins.input) fclose(ins.input);
+	evaluator_clear(mmap, &ins.ev);
+}
@@ -0,0 +1,563 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "store.h"
+
+/* FNV-1a; uids from encrypt are uniformly random, but user-chosen ones
+ * needn't be, so don't shard on the raw characters */
+static unsigned int store_shard(const char *uid) {
+  uint32_t h = 2166136261u;
+  for(; *uid; uid++) {
+    h ^= (unsigned char)*uid;
+    h *= 16777619u;
+  }
+  return h % STORE_SHARDS;
+}
+
+/* <database>/packed/<shard>[/file] */
+static location store_path(location database, const char *uid, const char *file) {
+  location root = location_append(database, STORE_DIR), shard = { NULL, false }, result;
+  char shard_name[3];
+
+  if(NULL == root.path) return root;
+  snprintf(shard_name, sizeof(shard_name), "%02x", store_shard(uid));
+  shard = location_append(root, shard_name);
+  location_free(root);
+  if(NULL == shard.path || NULL == file) return shard;
+  result = location_append(shard, file);
+  location_free(shard);
+  return result;
+}
+
+bool store_exists(location database) {
+  struct stat st;
+  location root = location_append(database, STORE_DIR);
+  const bool result = NULL != root.path && 0 == stat(root.path, &st) && S_ISDIR(st.st_mode);
+  location_free(root);
+  return result;
+}
+
+bool store_record_init(store_record *r, unsigned int num_steps) {
+  r->body = NULL;
+  r->body_size = 0;
+  r->num_steps = num_steps;
+  if(NULL == (r->steps = calloc(2*num_steps, sizeof(*r->steps))))
+    return false;
+  if(NULL == (r->stream = open_memstream(&r->body, &r->body_size))) {
+    free(r->steps);
+    return false;
+  }
+  return true;
+}
+
+bool store_record_add(const_mmap_vtable mmap, store_record *r, int step, mmap_enc_mat_t m) {
+  const long start = ftell(r->stream);
+  if(step < 0 || (unsigned int)step >= r->num_steps || start < 0) return false;
+  if(!fwrite_mmap_enc_mat_bin(mmap, m, step, r->stream)) return false;
+  r->steps[2*step  ] = start;
+  r->steps[2*step+1] = ftell(r->stream) - start;
+  return true;
+}
+
+bool store_record_add_file(store_record *r, int step, FILE *src) {
+  char buf[65536];
+  size_t len;
+  const long start = ftell(r->stream);
+  if(step < 0 || (unsigned int)step >= r->num_steps || start < 0) return false;
+  while(0 < (len = fread(buf, 1, sizeof(buf), src)))
+    if(len != fwrite(buf, 1, len, r->stream)) return false;
+  if(ferror(src)) return false;
+  r->steps[2*step  ] = start;
+  r->steps[2*step+1] = ftell(r->stream) - start;
+  return true;
+}
+
+void store_record_clear(store_record *r) {
+  fclose(r->stream);
+  free(r->body);
+  free(r->steps);
+}
+
+static bool store_write_all(int fd, const void *buf, size_t len) {
+  const char *p = buf;
+  while(len > 0) {
+    const ssize_t written = write(fd, p, len);
+    if(written < 0) {
+      if(EINTR == errno) continue;
+      return false;
+    }
+    p += written;
+    len -= written;
+  }
+  return true;
+}
+
+bool store_append(location database, const char *uid, store_record *r) {
+  const size_t table_size = sizeof(store_record_header) + 2*r->num_steps*sizeof(uint64_t);
+  store_record_header *header;
+  uint64_t *table;
+  bool success = false;
+  int segment;
+  FILE *index;
+  off_t offset;
+
+  location shard = store_path(database, uid, NULL);
+  location segment_location = store_path(database, uid, "segment");
+  location   index_location = store_path(database, uid, "index");
+  if(NULL == shard.path || NULL == segment_location.path || NULL == index_location.path ||
+     NULL == (header = calloc(1, table_size))) {
+    fprintf(stderr, "out of memory while appending record %s\n", uid);
+    goto free_locations;
+  }
+
+  /* the body is complete; rebase its offsets on the start of the record */
+  if(0 != fflush(r->stream)) goto free_header;
+  memcpy(header->magic, STORE_RECORD_MAGIC, sizeof(header->magic));
+  header->num_steps = r->num_steps;
+  table = (uint64_t *)(header+1);
+  for(unsigned int i = 0; i < r->num_steps; i++) {
+    if(0 == r->steps[2*i+1]) {
+      fprintf(stderr, "record %s is missing step %u\n", uid, i);
+      goto free_header;
+    }
+    table[2*i  ] = r->steps[2*i] + table_size;
+    table[2*i+1] = r->steps[2*i+1];
+  }
+
+  if(!create_directory_if_missing(shard.path)) {
+    fprintf(stderr, "could not create store directory %s\n", shard.path);
+    goto free_header;
+  }
+  if((segment = open(segment_location.path, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR)) < 0) {
+    fprintf(stderr, "could not open segment %s\n", segment_location.path);
+    goto free_header;
+  }
+  if(0 != flock(segment, LOCK_EX)) {
+    fprintf(stderr, "could not lock segment %s\n", segment_location.path);
+    goto close_segment;
+  }
+
+  /* a failure partway through leaves junk at the end of the segment, but
+   * with no index line pointing at it, it is never read */
+  if((offset = lseek(segment, 0, SEEK_END)) < 0 ||
+     !store_write_all(segment, header, table_size) ||
+     !store_write_all(segment, r->body, r->body_size) ||
+     0 != fdatasync(segment)) {
+    fprintf(stderr, "could not write record %s to %s\n", uid, segment_location.path);
+    goto unlock_segment;
+  }
+  if(NULL == (index = fopen(index_location.path, "a"))) {
+    fprintf(stderr, "could not open index %s\n", index_location.path);
+    goto unlock_segment;
+  }
+  fprintf(index, "%s\t%lld\t%llu\n", uid, (long long)offset,
+    (unsigned long long)(table_size + r->body_size));
+  success = 0 == fclose(index);
+  if(!success) fprintf(stderr, "could not write index %s\n", index_location.path);
+
+unlock_segment:
+  flock(segment, LOCK_UN);
+close_segment:
+  close(segment);
+free_header:
+  free(header);
+free_locations:
+  location_free(shard);
+  location_free(segment_location);
+  location_free(index_location);
+  return success;
+}
+
+/* Each process keeps a hash table of every shard index it has read, keyed by
+ * uid. Since an index is only ever appended to, bringing one up to date means
+ * parsing just the lines added since it was last read, and a lookup whose
+ * index has not grown costs one stat and one probe. The tables live as long
+ * as the process does. */
+typedef struct {
+  char *uid;
+  off_t offset;
+  size_t len;
+} store_index_entry;
+
+typedef struct {
+  pthread_mutex_t lock;
+  dev_t dev;
+  ino_t ino;
+  off_t parsed; /* bytes of complete lines read so far */
+  store_index_entry *entries;
+  size_t num_entries, capacity; /* capacity is 0 or a power of two */
+} store_index;
+
+typedef struct store_indexes {
+  char *database;
+  store_index shards[STORE_SHARDS];
+  struct store_indexes *next;
+} store_indexes;
+
+static pthread_mutex_t store_indexes_lock = PTHREAD_MUTEX_INITIALIZER;
+static store_indexes *store_indexes_list = NULL;
+
+static store_index *store_index_of(location database, const char *uid) {
+  store_indexes *d;
+  pthread_mutex_lock(&store_indexes_lock);
+  for(d = store_indexes_list; NULL != d; d = d->next)
+    if(!strcmp(d->database, database.path)) break;
+  if(NULL == d && NULL != (d = calloc(1, sizeof(*d)))) {
+    if(NULL == (d->database = strdup(database.path))) {
+      free(d);
+      d = NULL;
+    } else {
+      for(unsigned int i = 0; i < STORE_SHARDS; i++)
+        pthread_mutex_init(&d->shards[i].lock, NULL);
+      d->next = store_indexes_list;
+      store_indexes_list = d;
+    }
+  }
+  pthread_mutex_unlock(&store_indexes_lock);
+  return NULL == d ? NULL : d->shards + store_shard(uid);
+}
+
+/* 64-bit FNV-1a; every uid in one shard agrees on store_shard's low bits, so
+ * the table needs a hash of its own */
+static uint64_t store_index_hash(const char *uid) {
+  uint64_t h = 14695981039346656037ull;
+  for(; *uid; uid++) {
+    h ^= (unsigned char)*uid;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+static store_index_entry *store_index_probe(const store_index *ix, const char *uid) {
+  size_t i = store_index_hash(uid) & (ix->capacity - 1);
+  while(NULL != ix->entries[i].uid && 0 != strcmp(ix->entries[i].uid, uid))
+    i = (i+1) & (ix->capacity - 1);
+  return ix->entries + i;
+}
+
+static void store_index_reset(store_index *ix) {
+  for(size_t i = 0; i < ix->capacity; i++)
+    free(ix->entries[i].uid);
+  free(ix->entries);
+  ix->entries = NULL;
+  ix->num_entries = ix->capacity = 0;
+  ix->parsed = 0;
+}
+
+/* a later line for the same uid replaces the earlier one */
+static bool store_index_put(store_index *ix, const char *uid, off_t offset, size_t len) {
+  store_index_entry *e;
+  if(2*(ix->num_entries+1) > ix->capacity) {
+    const size_t capacity = 0 == ix->capacity ? 64 : 2*ix->capacity;
+    store_index old = *ix;
+    if(NULL == (ix->entries = calloc(capacity, sizeof(*ix->entries)))) {
+      ix->entries = old.entries;
+      return false;
+    }
+    ix->capacity = capacity;
+    for(size_t i = 0; i < old.capacity; i++)
+      if(NULL != old.entries[i].uid)
+        *store_index_probe(ix, old.entries[i].uid) = old.entries[i];
+    free(old.entries);
+  }
+  e = store_index_probe(ix, uid);
+  if(NULL == e->uid) {
+    if(NULL == (e->uid = strdup(uid))) return false;
+    ix->num_entries++;
+  }
+  e->offset = offset;
+  e->len = len;
+  return true;
+}
+
+/* reads whatever complete lines were appended to the index since last time,
+ * or all of it again if it was replaced; call with ix->lock held */
+static bool store_index_refresh(store_index *ix, const char *index_path) {
+  struct stat st;
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t line_len;
+  bool success = true;
+  FILE *index;
+
+  if(0 == stat(index_path, &st) && st.st_dev == ix->dev && st.st_ino == ix->ino &&
+     st.st_size == ix->parsed)
+    return true;
+  if(NULL == (index = fopen(index_path, "r"))) {
+    store_index_reset(ix);
+    return ENOENT == errno;
+  }
+  if(0 != fstat(fileno(index), &st)) {
+    fclose(index);
+    return false;
+  }
+  if(st.st_dev != ix->dev || st.st_ino != ix->ino || st.st_size < ix->parsed) {
+    store_index_reset(ix);
+    ix->dev = st.st_dev;
+    ix->ino = st.st_ino;
+  }
+  if(0 != fseeko(index, ix->parsed, SEEK_SET)) {
+    fclose(index);
+    return false;
+  }
+
+  while((line_len = getline(&line, &line_size, index)) > 0) {
+    long long o;
+    unsigned long long l;
+    char *tab;
+    /* a line without its newline may still be being written */
+    if('\n' != line[line_len-1]) break;
+    if(NULL != (tab = strchr(line, '\t')) && 2 == sscanf(tab+1, "%lld\t%llu", &o, &l)) {
+      *tab = '\0';
+      if(!(success = store_index_put(ix, line, o, l))) {
+        fprintf(stderr, "out of memory while reading index %s\n", index_path);
+        break;
+      }
+    }
+    ix->parsed += line_len;
+  }
+  free(line);
+  fclose(index);
+  return success;
+}
+
+/* finds the last complete index line for uid */
+static bool store_lookup(location database, const char *uid, off_t *offset, size_t *len) {
+  location index_location = store_path(database, uid, "index");
+  store_index *const ix = store_index_of(database, uid);
+  bool found = false;
+
+  if(NULL == index_location.path || NULL == ix) {
+    fprintf(stderr, "out of memory while looking up record %s\n", uid);
+    location_free(index_location);
+    return false;
+  }
+  pthread_mutex_lock(&ix->lock);
+  if(store_index_refresh(ix, index_location.path) && 0 < ix->num_entries) {
+    const store_index_entry *const e = store_index_probe(ix, uid);
+    if((found = NULL != e->uid)) {
+      *offset = e->offset;
+      *len = e->len;
+    }
+  }
+  pthread_mutex_unlock(&ix->lock);
+  location_free(index_location);
+  return found;
+}
+
+/* Records are appended back to back, so they start at arbitrary bytes of the
+ * segment; their header and step table are copied out rather than read in
+ * place. */
+static uint32_t store_view_num_steps(const store_view *v) {
+  store_record_header header;
+  memcpy(&header, v->data, sizeof(header));
+  return header.num_steps;
+}
+
+/* the offset (i = 0) or size (i = 1) of a step */
+static uint64_t store_view_table(const store_view *v, int step, int i) {
+  uint64_t entry;
+  memcpy(&entry, v->data + sizeof(store_record_header) + (2*(size_t)step + i)*sizeof(entry), sizeof(entry));
+  return entry;
+}
+
+bool store_open(location database, const char *uid, store_view *v) {
+  location segment_location = store_path(database, uid, "segment");
+  bool success = false;
+  off_t offset;
+  size_t len;
+  int fd;
+
+  *v = (store_view) { NULL, 0, NULL, 0 };
+  if(NULL == segment_location.path) {
+    fprintf(stderr, "out of memory while opening record %s\n", uid);
+    goto free_locations;
+  }
+  if(!store_lookup(database, uid, &offset, &len)) goto free_locations;
+  if((fd = open(segment_location.path, O_RDONLY)) < 0) {
+    fprintf(stderr, "could not open segment %s\n", segment_location.path);
+    goto free_locations;
+  }
+
+  /* mmap offsets must be page-aligned */
+  const off_t page = sysconf(_SC_PAGESIZE), aligned = offset - offset % page;
+  v->map_len = len + (offset - aligned);
+  v->map = mmap(NULL, v->map_len, PROT_READ, MAP_SHARED, fd, aligned);
+  close(fd);
+  if(MAP_FAILED == v->map) {
+    fprintf(stderr, "could not map record %s from %s\n", uid, segment_location.path);
+    v->map = NULL;
+    goto free_locations;
+  }
+  v->data = (const char *)v->map + (offset - aligned);
+  v->len = len;
+
+  if(v->len < sizeof(store_record_header) || 0 != memcmp(v->data, STORE_RECORD_MAGIC, sizeof(STORE_RECORD_MAGIC)) ||
+     v->len < sizeof(store_record_header) + 2*(uint64_t)store_view_num_steps(v)*sizeof(uint64_t)) {
+    fprintf(stderr, "record %s in %s is corrupt\n", uid, segment_location.path);
+    store_close(v);
+    goto free_locations;
+  }
+  success = true;
+
+free_locations:
+  location_free(segment_location);
+  return success;
+}
+
+bool store_view_load(const_mmap_vtable mmap, const store_view *v, int step, mmap_enc_mat_t m) {
+  if(step < 0 || (uint32_t)step >= store_view_num_steps(v)) {
+    fprintf(stderr, "record has no step %d\n", step);
+    return false;
+  }
+  const uint64_t offset = store_view_table(v, step, 0), size = store_view_table(v, step, 1);
+  if(offset > v->len || size > v->len - offset) {
+    fprintf(stderr, "record is corrupt (step %d out of bounds)\n", step);
+    return false;
+  }
+  return mmap_enc_mat_from_bin(mmap, m, step, v->data + offset, size);
+}
+
+size_t store_view_step_size(const store_view *v, int step) {
+  if(step < 0 || (uint32_t)step >= store_view_num_steps(v)) return 0;
+  return store_view_table(v, step, 1);
+}
+
+void store_close(store_view *v) {
+  if(NULL != v->map) munmap(v->map, v->map_len);
+  *v = (store_view) { NULL, 0, NULL, 0 };
+}
+
+bool store_uid_exists(location database, const char *uid) {
+  location record_location = location_append(database, uid);
+  struct stat st;
+  off_t offset;
+  size_t len;
+  const bool exists = NULL == record_location.path || 0 == stat(record_location.path, &st) ||
+                      store_lookup(database, uid, &offset, &len);
+  location_free(record_location);
+  return exists;
+}
+
+bool store_stamp(location database, const char *uid, const char *position, uint64_t *stamp) {
+  struct stat st;
+  off_t offset;
+  size_t len;
+  char *path;
+  bool found;
+
+  /* a packed record is read in preference to a loose one, and appending it
+   * again always puts it at a new offset */
+  if((found = store_lookup(database, uid, &offset, &len))) {
+    *stamp = (uint64_t)offset ^ ((uint64_t)len << 32) ^ 1;
+    return true;
+  }
+
+  /* a loose record's files are all rewritten when it is encrypted again */
+  const int path_len = snprintf(NULL, 0, "%s/%s/%s/0.bin", database.path, uid, position);
+  if(ALLOC_FAILS(path, path_len+1)) return false;
+  snprintf(path, path_len+1, "%s/%s/%s/0.bin", database.path, uid, position);
+  found = 0 == stat(path, &st);
+  free(path);
+  if(found)
+    *stamp = ((uint64_t)st.st_ino << 32) ^ (uint64_t)st.st_size ^
+             ((uint64_t)st.st_mtim.tv_sec << 20) ^ (uint64_t)st.st_mtim.tv_nsec;
+  return found;
+}
+
+static int store_strcmp(const void *l, const void *r) {
+  return strcmp(*(char *const *)l, *(char *const *)r);
+}
+
+static bool store_list_push(char ***uids, size_t *len, size_t *capacity, const char *uid) {
+  char **tmp;
+  if(*len == *capacity) {
+    if(NULL == (tmp = realloc(*uids, 2*(*capacity)*sizeof(*tmp)))) return false;
+    *uids = tmp;
+    *capacity *= 2;
+  }
+  if(NULL == ((*uids)[*len] = strdup(uid))) return false;
+  (*len)++;
+  return true;
+}
+
+bool store_list(location database, const char *const *skip, char ***uids, size_t *uids_len) {
+  size_t capacity = 64, i, j;
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t line_len;
+  struct dirent *entry;
+  struct stat st;
+  bool success = false;
+  DIR *dir;
+
+  *uids_len = 0;
+  if(ALLOC_FAILS(*uids, capacity)) return false;
+  if(NULL == (dir = opendir(database.path))) {
+    fprintf(stderr, "could not open database %s\n", database.path);
+    return false;
+  }
+
+  /* one directory per record, besides the store's own and any the caller
+   * knows about */
+  while(NULL != (entry = readdir(dir))) {
+    bool skipped = '.' == entry->d_name[0] || !strcmp(entry->d_name, STORE_DIR);
+    for(i = 0; NULL != skip && NULL != skip[i] && !skipped; i++)
+      skipped = !strcmp(entry->d_name, skip[i]);
+    if(skipped) continue;
+
+    location path = location_append(database, entry->d_name);
+    const bool is_dir = NULL != path.path && 0 == stat(path.path, &st) && S_ISDIR(st.st_mode);
+    location_free(path);
+    if(is_dir && !store_list_push(uids, uids_len, &capacity, entry->d_name)) goto close_dir;
+  }
+
+  /* and every uid in every shard's index */
+  for(unsigned int shard = 0; shard < STORE_SHARDS; shard++) {
+    char shard_name[3], *tab;
+    FILE *index;
+    snprintf(shard_name, sizeof(shard_name), "%02x", shard);
+    location root = location_append(database, STORE_DIR);
+    location shard_location = { NULL, false }, index_location = { NULL, false };
+    if(NULL != root.path) shard_location = location_append(root, shard_name);
+    if(NULL != shard_location.path) index_location = location_append(shard_location, "index");
+    index = NULL == index_location.path ? NULL : fopen(index_location.path, "r");
+    location_free(root);
+    location_free(shard_location);
+    location_free(index_location);
+    if(NULL == index) continue;
+
+    while((line_len = getline(&line, &line_size, index)) > 0) {
+      /* a line without its newline may still be being written */
+      if('\n' != line[line_len-1] || NULL == (tab = strchr(line, '\t'))) continue;
+      *tab = '\0';
+      if(!store_list_push(uids, uids_len, &capacity, line)) {
+        fclose(index);
+        goto close_dir;
+      }
+    }
+    fclose(index);
+  }
+
+  /* a uid may have been appended more than once, or live in both layouts */
+  qsort(*uids, *uids_len, sizeof(**uids), store_strcmp);
+  for(i = 0, j = 0; i < *uids_len; i++) {
+    if(j > 0 && !strcmp((*uids)[j-1], (*uids)[i])) free((*uids)[i]);
+    else (*uids)[j++] = (*uids)[i];
+  }
+  *uids_len = j;
+  success = true;
+
+close_dir:
+  closedir(dir);
+  free(line);
+  return success;
+}
@@ -0,0 +1,83 @@
+#ifndef _MIFE_STORE_H
+#define _MIFE_STORE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mife.h"
+#include "util.h"
+
+/* A packed alternative to writing one file per step matrix. Whole records are
+ * appended to one segment file per shard under <database>/packed/, where the
+ * shard is picked by hashing the uid, and each shard has an append-only index
+ * with one "uid <tab> offset <tab> length" line per record (a uid's last line
+ * wins). Appenders hold an exclusive flock on the shard's segment; readers
+ * take no lock at all, since an index line is only written once the data it
+ * points to is. Each process loads a shard's index into a hash table the first
+ * time it needs it, and afterwards reads only the lines appended since. */
+
+#define STORE_DIR          "packed"
+#define STORE_SHARDS       256
+#define STORE_RECORD_MAGIC "MIFEREC" /* with its terminator, 8 bytes */
+
+/* A record is this header, then num_steps (offset, size) pairs of uint64_ts
+ * measured from the start of the record, then each step matrix in the binary
+ * format of mife_io.h. Records are packed with no padding, so none of this is
+ * aligned in a segment. */
+typedef struct {
+  char magic[8];
+  uint32_t num_steps;
+  uint32_t reserved;
+} store_record_header;
+
+/* a record being assembled in memory; steps may be added in any order */
+typedef struct {
+  FILE *stream;
+  char *body;
+  size_t body_size;
+  unsigned int num_steps;
+  uint64_t *steps; /* (offset into body, size) pairs; size 0 if missing */
+} store_record;
+
+/* a record mapped into memory for reading */
+typedef struct {
+  void *map;
+  size_t map_len;
+  const char *data;
+  size_t len;
+} store_view;
+
+bool store_exists(location database);
+
+bool store_record_init(store_record *r, unsigned int num_steps);
+bool store_record_add(const_mmap_vtable mmap, store_record *r, int step, mmap_enc_mat_t m);
+/* adds a step already serialized by fwrite_mmap_enc_mat_bin, copying the rest
+ * of src as is */
+bool store_record_add_file(store_record *r, int step, FILE *src);
+bool store_append(location database, const char *uid, store_record *r);
+void store_record_clear(store_record *r);
+
+/* returns false, quietly, if uid simply is not in the store */
+bool store_open(location database, const char *uid, store_view *v);
+bool store_view_load(const_mmap_vtable mmap, const store_view *v, int step, mmap_enc_mat_t m);
+/* the serialized size of one step, or 0 if the record has no such step */
+size_t store_view_step_size(const store_view *v, int step);
+void store_close(store_view *v);
+
+/* whether uid names a record in the database, either packed or as a
+ * directory of its own; says true if it cannot tell, so that callers picking
+ * a fresh uid err on the side of another try */
+bool store_uid_exists(location database, const char *uid);
+
+/* something that changes whenever the record uid is encrypted again in the
+ * given position, for telling whether results computed from it are stale;
+ * returns false, quietly, if the record is not in the database */
+bool store_stamp(location database, const char *uid, const char *position, uint64_t *stamp);
+
+/* every uid in the database, whether packed or stored as one directory per
+ * record, sorted and without duplicates; directories named in skip (a
+ * NULL-terminated list, or NULL) are not records. On failure, the
+ * *uids_len uids found so far are still returned. */
+bool store_list(location database, const char *const *skip, char ***uids, size_t *uids_len);
+
+#endif /* ifndef _MIFE_STORE_H */
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "substream.h"
+
+parse_result load_master_seed(location private_location, mife_master_seed *const seed) {
+	FILE *src;
+	parse_result result;
+	location seed_location = location_append(private_location, "seed.bin");
+
+	if(NULL == seed_location.path) {
+		fprintf(stderr, "out of memory when trying to create path to seed\n");
+		result = PARSE_OUT_OF_MEMORY;
+		goto fail_none;
+	}
+	if(NULL == (src = fopen(seed_location.path, "rb")) &&
+	   NULL == (src = fopen("/dev/urandom"    , "rb"))) {
+		fprintf(stderr, "could not open seed file for reading; attempted to read:\n");
+		fprintf(stderr, "\t%s\n\t/dev/urandom\n", seed_location.path);
+		result = PARSE_IO_ERROR;
+		goto fail_free_location;
+	}
+
+	if(fread(seed->bytes, sizeof(*seed->bytes), AES_SEED_BYTE_SIZE, src) != AES_SEED_BYTE_SIZE) {
+		fprintf(stderr, "could not read %d bytes of seed\n", AES_SEED_BYTE_SIZE);
+		result = PARSE_INVALID;
+		goto fail_close_src;
+	}
+	result = PARSE_SUCCESS;
+
+fail_close_src:
+	fclose(src);
+fail_free_location:
+	location_free(seed_location);
+fail_none:
+	return result;
+}
+
+/* The tuple is serialized with a length prefix on every string, so that no
+ * two distinct tuples share a context (think record "1" step 23 vs. record
+ * "12" step 3), and fed to the generator as additional seed input alongside
+ * the master seed. */
+bool mife_substream_init(aes_randstate_t out, const mife_master_seed *const seed,
+	const char *const domain, const char *const record, int step, int entry) {
+	const size_t domain_len = strlen(domain), record_len = strlen(record);
+	const char *const format = "%zu:%s%zu:%s%d:%d";
+	const int context_len = snprintf(NULL, 0, format, domain_len, domain, record_len, record, step, entry);
+	char *context;
+	char seed_bytes[AES_SEED_BYTE_SIZE];
+
+	if(context_len < 0 || ALLOC_FAILS(context, context_len+1)) {
+		fprintf(stderr, "out of memory when generating context for RNG seed\n");
+		return false;
+	}
+	snprintf(context, context_len+1, format, domain_len, domain, record_len, record, step, entry);
+
+	/* aes_randinit_seedn does not promise to leave its seed alone */
+	memcpy(seed_bytes, seed->bytes, AES_SEED_BYTE_SIZE);
+	aes_randinit_seedn(out, seed_bytes, AES_SEED_BYTE_SIZE, context, context_len);
+	free(context);
+	return true;
+}
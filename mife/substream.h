@@ -0,0 +1,23 @@
+#ifndef _MIFE_SUBSTREAM_H
+#define _MIFE_SUBSTREAM_H
+
+#include <aesrand.h>
+#include "util.h"
+
+/* Independent, reproducible random streams derived from the master seed.
+ * Each stream is named by a (domain, record, step, entry) tuple, so code
+ * that draws randomness for different steps or records can run in any order
+ * -- or in parallel -- and still produce the same bits. */
+
+/* pass as step or entry when the stream is not specific to one */
+#define MIFE_SUBSTREAM_ALL (-1)
+
+typedef struct {
+	char bytes[AES_SEED_BYTE_SIZE];
+} mife_master_seed;
+
+parse_result load_master_seed(location private_location, mife_master_seed *const seed);
+bool mife_substream_init(aes_randstate_t out, const mife_master_seed *const seed,
+	const char *const domain, const char *const record, int step, int entry);
+
+#endif /* ifndef _MIFE_SUBSTREAM_H */
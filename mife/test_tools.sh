@@ -0,0 +1,221 @@
+# Checks the tools built on eval against each other and against mife-plain,
+# using the base-2-length-2 ORE template that test_gghlite.sh and test_clt.sh
+# set up. Any arguments (such as -C) are passed to every tool that loads keys,
+# and keys made here for other keygen options use the security parameter in
+# $SECPARAM.
+# A two-digit binary number xy is the record ["x","xy","y"]: the L steps read
+# its digits one at a time, and the R step reads both at once.
+
+work=`mktemp -d`
+trap 'rm -rf "$work"' EXIT
+failed=0
+values="00 01 10 11"
+secparam=${SECPARAM:-20}
+
+fail() {
+	echo "FAILED: $1"
+	failed=1
+}
+
+label() {
+	if [ "$1" \< "$2" ]; then echo '<'
+	elif [ "$1" = "$2" ]; then echo '='
+	else echo '>'
+	fi
+}
+
+# runs eval --batch on the mappings in $2, with the remaining options, and
+# checks that it gives the same labels as the default path did
+check_labels() {
+	what=$1 mappings=$2
+	shift 2
+	./eval "$@" --batch "$mappings" >"$work/check.out" || fail "$what: eval --batch exited with $?"
+	diff "$work/eval.out" "$work/check.out" || fail "$what gave different labels from eval --batch"
+}
+
+# sets up $work/$1 for keygen's output, using the default keys' template
+keys_dir() {
+	mkdir -p "$work/$1/public" "$work/$1/private"
+	cp public/template.json "$work/$1/public"
+}
+
+# encrypts the records with the keys in $work/$2 and checks eval --batch on
+# them against the labels from the default keys
+check_keys() {
+	what=$1 keys=$work/$2
+	shift 2
+	./encrypt "$@" -u "$keys/public" -r "$keys/private" -d "$keys/database" --batch "$work/records" >/dev/null ||
+		fail "$what: encrypt --batch exited with $?"
+	check_labels "$what" "$work/mappings" "$@" -u "$keys/public" -d "$keys/database"
+}
+
+# starts daemon $1 with the remaining options, on the socket $work/$1.sock,
+# and waits until it is listening
+start_daemon() {
+	name=$1
+	shift
+	"./$name" "$@" "$work/$name.sock" >/dev/null &
+	daemon=$!
+	while kill -0 $daemon 2>/dev/null && [ ! -S "$work/$name.sock" ]; do
+		sleep 0.1
+	done
+	[ -S "$work/$name.sock" ] || fail "$name did not start"
+}
+
+# stops the daemon, which should then exit cleanly
+stop_daemon() {
+	kill -TERM $daemon
+	wait $daemon || fail "$1 exited with $? when stopped"
+}
+
+# sends stdin to the Unix domain socket $1 and prints the replies until the
+# daemon closes the connection, which it does once every request is answered
+unix_client() {
+	python3 -c '
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall(sys.stdin.buffer.read())
+s.shutdown(socket.SHUT_WR)
+for data in iter(lambda: s.recv(65536), b""):
+	sys.stdout.buffer.write(data)
+' "$1"
+}
+
+# mife-plain needs no keys: a plaintext that puts x's digits in the L steps
+# and y in the R step is exactly what eval sees for the mapping {L:x, R:y}
+line=0
+for x in $values; do
+	for y in $values; do
+		line=$((line+1))
+		echo '["'${x:0:1}'","'$y'","'${x:1:1}'"]' >>"$work/plain"
+		printf '%d\t%s\n' $line `label $x $y` >>"$work/expected"
+	done
+done
+./mife-plain "$work/plain" >"$work/plain.out" || fail "mife-plain exited with $?"
+diff "$work/expected" "$work/plain.out" || fail "mife-plain gave the wrong labels"
+
+# n10 and m10 (and n11 and m11) are equal, for mife-join
+for v in 10 00 11 01; do
+	echo '{"plaintext":["'${v:0:1}'","'$v'","'${v:1:1}'"],"uid":"n'$v'"}'
+done >"$work/records"
+echo '{"plaintext":["1","10","0"],"uid":"m10"}' >>"$work/records"
+echo '{"plaintext":["1","11","1"],"uid":"m11"}' >>"$work/records"
+./encrypt "$@" --batch "$work/records" >/dev/null || fail "encrypt --batch exited with $?"
+
+for x in $values; do
+	for y in $values; do
+		echo '{"L":"n'$x'","R":"n'$y'"}'
+	done
+done >"$work/mappings"
+./eval "$@" --batch "$work/mappings" >"$work/eval.out" || fail "eval --batch exited with $?"
+diff "$work/plain.out" "$work/eval.out" || fail "eval --batch disagrees with mife-plain"
+
+printf 'n10\nn00\nn11\nn01\n' >"$work/uids"
+printf 'n00\nn01\nn10\nn11\n' >"$work/sorted"
+./mife-sort "$@" "$work/uids" >"$work/sort.out" || fail "mife-sort exited with $?"
+diff "$work/sorted" "$work/sort.out" || fail "mife-sort gave the wrong order"
+
+./mife-index "$@" add "$work/uids" || fail "mife-index add exited with $?"
+./mife-index "$@" list >"$work/list.out" || fail "mife-index list exited with $?"
+diff "$work/sorted" "$work/list.out" || fail "mife-index list gave the wrong order"
+./mife-index "$@" add "$work/uids" || fail "mife-index add exited with $? on a re-add"
+./mife-index "$@" list >"$work/list.out" || fail "mife-index list exited with $?"
+diff "$work/sorted" "$work/list.out" || fail "mife-index add indexed some uids twice"
+./mife-index "$@" range n01 m10 >"$work/range.out" || fail "mife-index range exited with $?"
+printf 'n01\nn10\n' | diff - "$work/range.out" || fail "mife-index range gave the wrong records"
+
+printf 'n00\nn11\nn10\n' >"$work/left"
+printf 'm11\nn01\nm10\n' >"$work/right"
+./mife-join "$@" "$work/left" "$work/right" >"$work/join.out" || fail "mife-join exited with $?"
+printf 'n10\tm10\nn11\tm11\n' | diff - "$work/join.out" || fail "mife-join gave the wrong pairs"
+
+./encrypt "$@" -d "$work/packed" --packed --batch "$work/records" >/dev/null || fail "encrypt --packed exited with $?"
+check_labels "the packed store" "$work/mappings" "$@" -d "$work/packed"
+
+# records with neither a uid nor a partition come from the pool, in order
+./encrypt "$@" --fill 4 >/dev/null || fail "encrypt --fill exited with $?"
+for v in $values; do
+	echo '["'${v:0:1}'","'$v'","'${v:1:1}'"]'
+done >"$work/plaintexts"
+./encrypt "$@" -d "$work/pooled" --pool --batch "$work/plaintexts" >"$work/pool.out" 2>"$work/pool.err" ||
+	fail "encrypt --pool exited with $?"
+grep 'pool is empty' "$work/pool.err" && fail "encrypt --pool ran out of records that --fill made"
+pooled=(`grep -x '[0-9A-Za-z]\+' "$work/pool.out"`)
+for x in 0 1 2 3; do
+	for y in 0 1 2 3; do
+		echo '{"L":"'${pooled[$x]}'","R":"'${pooled[$y]}'"}'
+	done
+done >"$work/pool.mappings"
+check_labels "encrypt --pool" "$work/pool.mappings" "$@" -d "$work/pooled"
+
+check_labels "eval --tree" "$work/mappings" "$@" --tree
+
+# the first run fills <database>/results and the second answers from it
+check_labels "eval --results, computing" "$work/mappings" "$@" --results
+check_labels "eval --results, remembering" "$work/mappings" "$@" --results
+
+# mife-scan nx '<' should list the other records y for which eval gave
+# {L:nx, R:y} the label <, and likewise for = and >
+head -4 "$work/records" >"$work/scan.records"
+./encrypt "$@" -d "$work/scan" --batch "$work/scan.records" >/dev/null || fail "encrypt --batch exited with $?"
+line=0
+for x in $values; do
+	for y in $values; do
+		line=$((line+1))
+		[ $x = $y ] || printf 'n%s\t%s\n' $y "`sed -n ${line}p "$work/eval.out" | cut -f2`"
+	done >"$work/scan.labels"
+	for l in '<' '=' '>'; do
+		./mife-scan "$@" -d "$work/scan" n$x "$l" >"$work/scan.out" || fail "mife-scan exited with $?"
+		awk -F'\t' -v l="$l" '$2 == l { print $1 }' "$work/scan.labels" | sort >"$work/scan.expected"
+		sort "$work/scan.out" | diff "$work/scan.expected" - ||
+			fail "mife-scan n$x '$l' disagrees with eval --batch"
+	done
+done
+
+# evald answers out of order, but numbers its replies as eval --batch does
+start_daemon evald "$@"
+unix_client "$work/evald.sock" <"$work/mappings" | sort -n >"$work/evald.out"
+stop_daemon evald
+diff "$work/eval.out" "$work/evald.out" || fail "evald gave different labels from eval --batch"
+
+start_daemon encryptd "$@" -d "$work/encryptd"
+unix_client "$work/encryptd.sock" <"$work/records" | sort -n >"$work/encryptd.out"
+stop_daemon encryptd
+printf '1\tn10\n2\tn00\n3\tn11\n4\tn01\n5\tm10\n6\tm11\n' | diff - "$work/encryptd.out" ||
+	fail "encryptd did not write every record"
+check_labels "encryptd" "$work/mappings" "$@" -d "$work/encryptd"
+
+keys_dir precompute
+./keygen "$@" --secparam $secparam -u "$work/precompute/public" -r "$work/precompute/private" --precompute >/dev/null ||
+	fail "keygen --precompute exited with $?"
+check_keys "keygen --precompute" precompute "$@"
+
+keys_dir triangular
+./keygen "$@" --secparam $secparam -u "$work/triangular/public" -r "$work/triangular/private" --triangular >/dev/null ||
+	fail "keygen --triangular exited with $?"
+check_keys "keygen --triangular" triangular "$@"
+
+keys_dir stream
+./keygen "$@" --secparam $secparam -u "$work/stream/public" -r "$work/stream/private" --stream >/dev/null ||
+	fail "keygen --stream exited with $?"
+check_keys "keygen --stream" stream "$@"
+
+# a streaming run killed once it has written some Kilian pairs, then resumed;
+# the pairs are redrawn from the seed, so both runs need the same one. If the
+# first run finishes before it can be killed, the second just starts over.
+keys_dir resume
+head -c 32 /dev/urandom >"$work/resume/private/seed.bin"
+./keygen "$@" --secparam $secparam -u "$work/resume/public" -r "$work/resume/private" --stream --precompute >/dev/null &
+keygen=$!
+while kill -0 $keygen 2>/dev/null && [ ! -s "$work/resume/private/mife.priv.progress" ]; do
+	sleep 0.1
+done
+kill -KILL $keygen 2>/dev/null
+wait $keygen 2>/dev/null
+./keygen "$@" --secparam $secparam -u "$work/resume/public" -r "$work/resume/private" --resume --precompute >/dev/null ||
+	fail "keygen --resume exited with $?"
+check_keys "keygen --resume --precompute" resume "$@"
+
+[ 0 = $failed ] && echo "All tool checks passed"
+exit $failed
@@ -55,3 +55,36 @@ bool create_directory_if_missing(char *dir) {
 	free(dir_copy);
 	return success;
 }
+
+bool read_lines(FILE *input, char ***lines, size_t *lines_len) {
+	size_t capacity = 16, buf_size = 0;
+	char *buf = NULL, **tmp;
+	ssize_t len;
+
+	*lines_len = 0;
+	if(ALLOC_FAILS(*lines, capacity)) return false;
+	while((len = getline(&buf, &buf_size, input)) >= 0) {
+		while(len > 0 && ('\n' == buf[len-1] || '\r' == buf[len-1]))
+			buf[--len] = '\0';
+		if(0 == len) continue;
+		if(*lines_len == capacity) {
+			if(NULL == (tmp = realloc(*lines, 2*capacity*sizeof(*tmp)))) goto fail;
+			*lines = tmp;
+			capacity *= 2;
+		}
+		if(NULL == ((*lines)[*lines_len] = strdup(buf))) goto fail;
+		(*lines_len)++;
+	}
+	free(buf);
+	return true;
+
+fail:
+	free(buf);
+	return false;
+}
+
+void lines_free(char **lines, size_t lines_len) {
+	for(size_t i = 0; i < lines_len; i++)
+		free(lines[i]);
+	free(lines);
+}
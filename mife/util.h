@@ -2,6 +2,8 @@
 #define _MIFE_UTILS_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
 
 #define ALLOC_FAILS(path, len) (NULL == ((path) = malloc((len) * sizeof(*(path)))))
 #define AES_SEED_BYTE_SIZE 32
@@ -23,5 +25,9 @@ typedef enum {
 
 void check_parse_result(parse_result result, void usage(int), int problem);
 bool create_directory_if_missing(char *dir);
+/* reads every non-empty line of input, without its line ending; on failure,
+ * the *lines_len lines read so far are still returned */
+bool read_lines(FILE *input, char ***lines, size_t *lines_len);
+void lines_free(char **lines, size_t lines_len);
 
 #endif /* ifndef _MIFE_UTILS_H */